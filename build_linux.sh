@@ -3,7 +3,7 @@
 DEFS="-D_POSIX_C_SOURCE=200809L"
 OPTS="-std=c89 -Wall -Wextra -pedantic -O3 -flto -ffast-math"
 SRCS="main.c platforms/linux.c core/*.c scenes/*.c shaders/*.c tests/*.c"
-LIBS="-lm -lX11"
+LIBS="-lm -lX11 -lpthread"
 
 cd renderer && gcc -o ../viewer $DEFS $OPTS $SRCS $LIBS && cd ..
 
@@ -1,17 +1,22 @@
 #ifndef API_H
 #define API_H
 
+#include "bvh.h"
 #include "camera.h"
+#include "culling.h"
 #include "darray.h"
 #include "draw2d.h"
 #include "graphics.h"
 #include "image.h"
+#include "job.h"
 #include "macro.h"
 #include "maths.h"
 #include "mesh.h"
+#include "meshopt.h"
 #include "platform.h"
 #include "scene.h"
 #include "skeleton.h"
+#include "skinning.h"
 #include "texture.h"
 
 #endif
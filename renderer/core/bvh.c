@@ -0,0 +1,353 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bvh.h"
+#include "culling.h"
+#include "maths.h"
+#include "mesh.h"
+
+/*
+ * a bounding volume hierarchy over the bboxes of a set of items, built by
+ * median splits along the longest axis of the item centers, the tree is
+ * refitted in place when the items move and rebuilt by the caller when
+ * refitting has degraded it too much, see "How to build a BVH" by Bikker
+ */
+
+#define LEAF_SIZE 4
+#define STACK_SIZE 64
+#define REBUILD_RATIO 2.0f  /* of the refitted cost to the built one */
+
+typedef struct {
+    bbox_t bbox;
+    int left;        /* the right child follows it, 0 for leaves */
+    int first_item;  /* the items of a subtree are contiguous */
+    int num_items;
+} node_t;
+
+struct bvh {
+    int num_items;
+    int num_nodes;
+    bbox_t *bboxes;  /* of the items, as last refitted */
+    int *items;      /* item indices in tree order */
+    node_t *nodes;   /* children come after their parent */
+    float build_cost;
+};
+
+static bbox_t empty_bbox(void) {
+    bbox_t bbox;
+    bbox.min = vec3_new(+1e6, +1e6, +1e6);
+    bbox.max = vec3_new(-1e6, -1e6, -1e6);
+    return bbox;
+}
+
+static bbox_t merge_bbox(bbox_t a, bbox_t b) {
+    bbox_t bbox;
+    bbox.min = vec3_min(a.min, b.min);
+    bbox.max = vec3_max(a.max, b.max);
+    return bbox;
+}
+
+static float get_area(bbox_t bbox) {
+    vec3_t size = vec3_sub(bbox.max, bbox.min);
+    if (size.x < 0 || size.y < 0 || size.z < 0) {
+        return 0;
+    } else {
+        return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+}
+
+/* twice the center of the bbox along an axis */
+static float get_center(bbox_t bbox, int axis) {
+    if (axis == 0) {
+        return bbox.min.x + bbox.max.x;
+    } else if (axis == 1) {
+        return bbox.min.y + bbox.max.y;
+    } else {
+        return bbox.min.z + bbox.max.z;
+    }
+}
+
+/*
+ * the inner nodes stand for the cost of traversing the tree, each weighted
+ * by its surface area as in the surface area heuristic
+ */
+static float get_cost(bvh_t *bvh) {
+    float cost = 0;
+    int i;
+    for (i = 0; i < bvh->num_nodes; i++) {
+        if (bvh->nodes[i].left) {
+            cost += get_area(bvh->nodes[i].bbox);
+        }
+    }
+    return cost;
+}
+
+/* bvh building/releasing */
+
+/* quickselect, moves the median item along the axis to the middle */
+static void select_median(bvh_t *bvh, int *items, int num_items, int axis) {
+    int middle = num_items / 2;
+    int low = 0;
+    int high = num_items - 1;
+    while (low < high) {
+        float pivot = get_center(bvh->bboxes[items[(low + high) / 2]], axis);
+        int i = low;
+        int j = high;
+        while (i <= j) {
+            while (get_center(bvh->bboxes[items[i]], axis) < pivot) {
+                i += 1;
+            }
+            while (get_center(bvh->bboxes[items[j]], axis) > pivot) {
+                j -= 1;
+            }
+            if (i <= j) {
+                int item = items[i];
+                items[i] = items[j];
+                items[j] = item;
+                i += 1;
+                j -= 1;
+            }
+        }
+        if (middle <= j) {
+            high = j;
+        } else if (middle >= i) {
+            low = i;
+        } else {
+            break;
+        }
+    }
+}
+
+static void build_node(bvh_t *bvh, int index, int first_item,
+                       int num_items) {
+    node_t *node = &bvh->nodes[index];
+    bbox_t bbox = empty_bbox();
+    vec3_t center_min = vec3_new(+1e6, +1e6, +1e6);
+    vec3_t center_max = vec3_new(-1e6, -1e6, -1e6);
+    vec3_t extent;
+    int axis, left, i;
+
+    for (i = 0; i < num_items; i++) {
+        bbox_t item_bbox = bvh->bboxes[bvh->items[first_item + i]];
+        vec3_t center = vec3_add(item_bbox.min, item_bbox.max);
+        bbox = merge_bbox(bbox, item_bbox);
+        center_min = vec3_min(center_min, center);
+        center_max = vec3_max(center_max, center);
+    }
+    node->bbox = bbox;
+    node->left = 0;
+    node->first_item = first_item;
+    node->num_items = num_items;
+    if (num_items <= LEAF_SIZE) {
+        return;
+    }
+
+    extent = vec3_sub(center_max, center_min);
+    if (extent.x >= extent.y && extent.x >= extent.z) {
+        axis = 0;
+    } else if (extent.y >= extent.z) {
+        axis = 1;
+    } else {
+        axis = 2;
+    }
+    select_median(bvh, bvh->items + first_item, num_items, axis);
+
+    left = bvh->num_nodes;
+    bvh->num_nodes += 2;
+    node->left = left;
+    build_node(bvh, left, first_item, num_items / 2);
+    build_node(bvh, left + 1, first_item + num_items / 2,
+               num_items - num_items / 2);
+}
+
+bvh_t *bvh_create(bbox_t *bboxes, int num_items) {
+    bvh_t *bvh = (bvh_t*)malloc(sizeof(bvh_t));
+    int max_nodes = num_items > 0 ? num_items * 2 - 1 : 0;
+    int i;
+
+    assert(num_items >= 0);
+
+    bvh->num_items = num_items;
+    bvh->num_nodes = 0;
+    bvh->bboxes = (bbox_t*)malloc(sizeof(bbox_t) * num_items);
+    bvh->items = (int*)malloc(sizeof(int) * num_items);
+    bvh->nodes = (node_t*)malloc(sizeof(node_t) * max_nodes);
+    memcpy(bvh->bboxes, bboxes, sizeof(bbox_t) * num_items);
+    for (i = 0; i < num_items; i++) {
+        bvh->items[i] = i;
+    }
+    if (num_items > 0) {
+        bvh->num_nodes = 1;
+        build_node(bvh, 0, 0, num_items);
+    }
+    bvh->build_cost = get_cost(bvh);
+
+    return bvh;
+}
+
+void bvh_release(bvh_t *bvh) {
+    free(bvh->bboxes);
+    free(bvh->items);
+    free(bvh->nodes);
+    free(bvh);
+}
+
+/*
+ * updates the node bboxes bottom up while keeping the topology, returns
+ * whether the tree has grown loose enough that it should be rebuilt
+ */
+int bvh_refit(bvh_t *bvh, bbox_t *bboxes) {
+    int i, j;
+
+    if (memcmp(bvh->bboxes, bboxes, sizeof(bbox_t) * bvh->num_items) == 0) {
+        return 0;
+    }
+    memcpy(bvh->bboxes, bboxes, sizeof(bbox_t) * bvh->num_items);
+    for (i = bvh->num_nodes - 1; i >= 0; i--) {
+        node_t *node = &bvh->nodes[i];
+        if (node->left) {
+            node->bbox = merge_bbox(bvh->nodes[node->left].bbox,
+                                    bvh->nodes[node->left + 1].bbox);
+        } else {
+            node->bbox = empty_bbox();
+            for (j = 0; j < node->num_items; j++) {
+                int item = bvh->items[node->first_item + j];
+                node->bbox = merge_bbox(node->bbox, bvh->bboxes[item]);
+            }
+        }
+    }
+    return get_cost(bvh) > bvh->build_cost * REBUILD_RATIO;
+}
+
+/* bvh querying */
+
+/*
+ * writes the items whose bboxes intersect the frustum, in tree order, a
+ * subtree inside the frustum is taken whole without testing its items
+ */
+int bvh_cull(bvh_t *bvh, frustum_t *frustum, int *items) {
+    int stack[STACK_SIZE];
+    int num_stack = 0;
+    int num_visible = 0;
+    int i;
+
+    if (bvh->num_nodes > 0) {
+        stack[num_stack++] = 0;
+    }
+    while (num_stack > 0) {
+        node_t *node = &bvh->nodes[stack[--num_stack]];
+        if (frustum_cull_bbox(frustum, node->bbox)) {
+            continue;
+        }
+        if (frustum_contains_bbox(frustum, node->bbox)) {
+            memcpy(items + num_visible, bvh->items + node->first_item,
+                   sizeof(int) * node->num_items);
+            num_visible += node->num_items;
+        } else if (node->left) {
+            assert(num_stack + 2 <= STACK_SIZE);
+            stack[num_stack++] = node->left + 1;
+            stack[num_stack++] = node->left;
+        } else {
+            for (i = 0; i < node->num_items; i++) {
+                int item = bvh->items[node->first_item + i];
+                if (!frustum_cull_bbox(frustum, bvh->bboxes[item])) {
+                    items[num_visible++] = item;
+                }
+            }
+        }
+    }
+    return num_visible;
+}
+
+/* slab test, the distance is where the ray enters the bbox */
+static int intersect_bbox(bbox_t bbox, vec3_t origin, vec3_t inv_direction,
+                          float max_distance, float *distance) {
+    float tx1 = (bbox.min.x - origin.x) * inv_direction.x;
+    float tx2 = (bbox.max.x - origin.x) * inv_direction.x;
+    float ty1 = (bbox.min.y - origin.y) * inv_direction.y;
+    float ty2 = (bbox.max.y - origin.y) * inv_direction.y;
+    float tz1 = (bbox.min.z - origin.z) * inv_direction.z;
+    float tz2 = (bbox.max.z - origin.z) * inv_direction.z;
+    float t_min = float_max(float_min(tx1, tx2), float_min(ty1, ty2));
+    float t_max = float_min(float_max(tx1, tx2), float_max(ty1, ty2));
+    t_min = float_max(float_max(t_min, float_min(tz1, tz2)), 0);
+    t_max = float_min(float_min(t_max, float_max(tz1, tz2)), max_distance);
+    *distance = t_min;
+    return t_min <= t_max;
+}
+
+static float get_inverse(float value) {
+    return (float)fabs(value) > 1e-12f ? 1 / value : 1e30f;
+}
+
+/*
+ * returns the nearest item hit by the ray, or -1, nearer children are
+ * visited first so that farther subtrees are mostly pruned by the closest
+ * hit so far, the distance is in units of the direction length
+ */
+int bvh_raycast(bvh_t *bvh, vec3_t origin, vec3_t direction,
+                bvh_intersect_t *intersect, void *userdata,
+                float *distance) {
+    vec3_t inv_direction = vec3_new(get_inverse(direction.x),
+                                    get_inverse(direction.y),
+                                    get_inverse(direction.z));
+    float closest = 1e30f;
+    int stack[STACK_SIZE];
+    int num_stack = 0;
+    int nearest = -1;
+    int i;
+
+    if (bvh->num_nodes > 0) {
+        stack[num_stack++] = 0;
+    }
+    while (num_stack > 0) {
+        node_t *node = &bvh->nodes[stack[--num_stack]];
+        float entry;
+        if (!intersect_bbox(node->bbox, origin, inv_direction, closest,
+                            &entry)) {
+            continue;
+        }
+        if (node->left) {
+            node_t *left = &bvh->nodes[node->left];
+            node_t *right = &bvh->nodes[node->left + 1];
+            float left_entry, right_entry;
+            int left_hit = intersect_bbox(left->bbox, origin, inv_direction,
+                                          closest, &left_entry);
+            int right_hit = intersect_bbox(right->bbox, origin,
+                                           inv_direction, closest,
+                                           &right_entry);
+            assert(num_stack + 2 <= STACK_SIZE);
+            if (left_hit && right_hit) {
+                if (left_entry <= right_entry) {
+                    stack[num_stack++] = node->left + 1;
+                    stack[num_stack++] = node->left;
+                } else {
+                    stack[num_stack++] = node->left;
+                    stack[num_stack++] = node->left + 1;
+                }
+            } else if (left_hit) {
+                stack[num_stack++] = node->left;
+            } else if (right_hit) {
+                stack[num_stack++] = node->left + 1;
+            }
+        } else {
+            for (i = 0; i < node->num_items; i++) {
+                int item = bvh->items[node->first_item + i];
+                if (intersect_bbox(bvh->bboxes[item], origin, inv_direction,
+                                   closest, &entry)) {
+                    float hit = intersect ? intersect(userdata, item, entry)
+                                          : entry;
+                    if (hit >= 0 && hit < closest) {
+                        closest = hit;
+                        nearest = item;
+                    }
+                }
+            }
+        }
+    }
+    if (nearest >= 0 && distance) {
+        *distance = closest;
+    }
+    return nearest;
+}
@@ -0,0 +1,27 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "culling.h"
+#include "maths.h"
+#include "mesh.h"
+
+typedef struct bvh bvh_t;
+
+/*
+ * exact test of an item whose bbox the ray enters at box_distance, returns
+ * the distance along the ray to the item, or a negative value for a miss
+ */
+typedef float bvh_intersect_t(void *userdata, int item, float box_distance);
+
+/* bvh building/releasing */
+bvh_t *bvh_create(bbox_t *bboxes, int num_items);
+void bvh_release(bvh_t *bvh);
+int bvh_refit(bvh_t *bvh, bbox_t *bboxes);
+
+/* bvh querying */
+int bvh_cull(bvh_t *bvh, frustum_t *frustum, int *items);
+int bvh_raycast(bvh_t *bvh, vec3_t origin, vec3_t direction,
+                bvh_intersect_t *intersect, void *userdata,
+                float *distance);
+
+#endif
@@ -94,6 +94,10 @@ vec3_t camera_get_position(camera_t *camera) {
     return camera->position;
 }
 
+vec3_t camera_get_target(camera_t *camera) {
+    return camera->target;
+}
+
 vec3_t camera_get_forward(camera_t *camera) {
     return vec3_normalize(vec3_sub(camera->target, camera->position));
 }
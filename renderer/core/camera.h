@@ -16,6 +16,7 @@ void camera_update_transform(camera_t *camera, motion_t motion);
 
 /* property retrieving */
 vec3_t camera_get_position(camera_t *camera);
+vec3_t camera_get_target(camera_t *camera);
 vec3_t camera_get_forward(camera_t *camera);
 mat4_t camera_get_view_matrix(camera_t *camera);
 mat4_t camera_get_proj_matrix(camera_t *camera);
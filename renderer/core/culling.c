@@ -0,0 +1,142 @@
+#include <math.h>
+#include "culling.h"
+#include "maths.h"
+#include "mesh.h"
+#include "meshopt.h"
+
+/* frustum testing */
+
+/*
+ * for plane extraction, see
+ * Fast Extraction of Viewing Frustum Planes from the World-View-Projection
+ * Matrix, the planes are in the space the matrix transforms from, so a
+ * model-view-projection matrix gives model space planes
+ */
+frustum_t frustum_from_matrix(mat4_t mvp_matrix) {
+    vec4_t rows[4];
+    frustum_t frustum;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        float *row = mvp_matrix.m[i];
+        rows[i] = vec4_new(row[0], row[1], row[2], row[3]);
+    }
+    frustum.planes[0] = vec4_add(rows[3], rows[0]);  /* left */
+    frustum.planes[1] = vec4_sub(rows[3], rows[0]);  /* right */
+    frustum.planes[2] = vec4_add(rows[3], rows[1]);  /* bottom */
+    frustum.planes[3] = vec4_sub(rows[3], rows[1]);  /* top */
+    frustum.planes[4] = vec4_add(rows[3], rows[2]);  /* near */
+    frustum.planes[5] = vec4_sub(rows[3], rows[2]);  /* far */
+    for (i = 0; i < 6; i++) {
+        vec4_t plane = frustum.planes[i];
+        float length = vec3_length(vec3_from_vec4(plane));
+        if (length > 0) {
+            frustum.planes[i] = vec4_div(plane, length);
+        }
+    }
+    return frustum;
+}
+
+int frustum_cull_sphere(frustum_t *frustum, vec3_t center, float radius) {
+    int i;
+    for (i = 0; i < 6; i++) {
+        vec4_t plane = frustum->planes[i];
+        float distance = vec3_dot(vec3_from_vec4(plane), center) + plane.w;
+        if (distance < -radius) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* culled when the corner farthest along a plane normal is still outside */
+int frustum_cull_bbox(frustum_t *frustum, bbox_t bbox) {
+    int i;
+    for (i = 0; i < 6; i++) {
+        vec4_t plane = frustum->planes[i];
+        vec3_t corner = vec3_new(plane.x >= 0 ? bbox.max.x : bbox.min.x,
+                                 plane.y >= 0 ? bbox.max.y : bbox.min.y,
+                                 plane.z >= 0 ? bbox.max.z : bbox.min.z);
+        float distance = vec3_dot(vec3_from_vec4(plane), corner) + plane.w;
+        if (distance < 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* contained when even the corner nearest along each plane normal is inside */
+int frustum_contains_bbox(frustum_t *frustum, bbox_t bbox) {
+    int i;
+    for (i = 0; i < 6; i++) {
+        vec4_t plane = frustum->planes[i];
+        vec3_t corner = vec3_new(plane.x >= 0 ? bbox.min.x : bbox.max.x,
+                                 plane.y >= 0 ? bbox.min.y : bbox.max.y,
+                                 plane.z >= 0 ? bbox.min.z : bbox.max.z);
+        float distance = vec3_dot(vec3_from_vec4(plane), corner) + plane.w;
+        if (distance < 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* meshlet culling */
+
+/*
+ * the eye is the preimage of the clip space z direction, where x, y and w
+ * all vanish, for a parallel projection it is the view direction instead,
+ * a mirroring model matrix turns the model space front faces into screen
+ * space back faces, so the cone test is flipped for it
+ */
+culler_t culler_from_matrices(mat4_t vp_matrix, mat4_t model_matrix,
+                              int backface_culling) {
+    mat4_t mvp_matrix = mat4_mul_mat4(vp_matrix, model_matrix);
+    mat4_t inverse = mat4_inverse(mvp_matrix);
+    vec4_t eye = mat4_mul_vec4(inverse, vec4_new(0, 0, 1, 0));
+    float length = vec3_length(vec3_from_vec4(eye));
+    culler_t culler;
+
+    culler.frustum = frustum_from_matrix(mvp_matrix);
+    if ((float)fabs(eye.w) > length * 1e-6f) {
+        culler.eye = vec4_new(eye.x / eye.w, eye.y / eye.w, eye.z / eye.w, 1);
+    } else {
+        culler.eye = vec4_new(eye.x / length, eye.y / length,
+                              eye.z / length, 0);
+    }
+    culler.backface_culling = backface_culling;
+    culler.mirrored = mat4_determinant(model_matrix) < 0;
+    return culler;
+}
+
+/*
+ * every face normal of the meshlet lies within its cone, so the meshlet is
+ * back-facing when the whole bounding sphere is seen from behind the cone,
+ * this is the cluster cone test of meshoptimizer
+ */
+static int is_back_facing(culler_t *culler, meshlet_t *meshlet) {
+    vec3_t eye = vec3_from_vec4(culler->eye);
+    vec3_t axis = meshlet->cone_axis;
+    if (culler->mirrored) {
+        axis = vec3_negate(axis);
+    }
+    if (culler->eye.w == 0) {
+        return vec3_dot(eye, axis) > meshlet->cone_cutoff;
+    } else {
+        vec3_t view = vec3_sub(meshlet->center, eye);
+        float distance = vec3_length(view);
+        return vec3_dot(view, axis)
+               >= meshlet->cone_cutoff * distance + meshlet->radius;
+    }
+}
+
+int culler_cull_meshlet(culler_t *culler, meshlet_t *meshlet) {
+    if (frustum_cull_sphere(&culler->frustum,
+                            meshlet->center, meshlet->radius)) {
+        return 1;
+    }
+    if (culler->backface_culling && is_back_facing(culler, meshlet)) {
+        return 1;
+    }
+    return 0;
+}
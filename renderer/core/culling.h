@@ -0,0 +1,28 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include "maths.h"
+#include "mesh.h"
+#include "meshopt.h"
+
+typedef struct {vec4_t planes[6];} frustum_t;
+
+typedef struct {
+    frustum_t frustum;
+    vec4_t eye;  /* w is 0 for a parallel projection */
+    int backface_culling;
+    int mirrored;  /* the model matrix flips the winding */
+} culler_t;
+
+/* frustum testing */
+frustum_t frustum_from_matrix(mat4_t mvp_matrix);
+int frustum_cull_sphere(frustum_t *frustum, vec3_t center, float radius);
+int frustum_cull_bbox(frustum_t *frustum, bbox_t bbox);
+int frustum_contains_bbox(frustum_t *frustum, bbox_t bbox);
+
+/* meshlet culling */
+culler_t culler_from_matrices(mat4_t vp_matrix, mat4_t model_matrix,
+                              int backface_culling);
+int culler_cull_meshlet(culler_t *culler, meshlet_t *meshlet);
+
+#endif
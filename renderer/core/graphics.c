@@ -57,6 +57,7 @@ void framebuffer_clear_depth(framebuffer_t *framebuffer, float depth) {
 /* program management */
 
 #define MAX_VARYINGS 10
+#define VERTEX_CACHE_SIZE 32
 
 /*这其实是 模拟opengl, 将shader封装在了Program上，这个program就代表了一种渲染管线配置*/
 struct program {
@@ -76,6 +77,11 @@ struct program {
     vec4_t out_coords[MAX_VARYINGS]; /*存储的 可见的顶点(in_coords经过裁减剔除后的结果)*/
     void *in_varyings[MAX_VARYINGS];
     void *out_varyings[MAX_VARYINGS];
+    /* for post-transform vertex caching */
+    int vertex_indices[3];
+    int cached_indices[VERTEX_CACHE_SIZE];
+    vec4_t cached_coords[VERTEX_CACHE_SIZE];
+    void *cached_varyings;
 };
 
 /*创建渲染管线*/
@@ -113,6 +119,11 @@ program_t *program_create(
         program->out_varyings[i] = malloc(sizeof_varyings);
         memset(program->out_varyings[i], 0, sizeof_varyings);
     }
+    for (i = 0; i < 3; i++) {
+        program->vertex_indices[i] = -1;
+    }
+    program->cached_varyings = malloc(sizeof_varyings * VERTEX_CACHE_SIZE);
+    program_clear_cache(program);
 
     return program;
 }
@@ -128,6 +139,7 @@ void program_release(program_t *program) {
         free(program->in_varyings[i]);
         free(program->out_varyings[i]);
     }
+    free(program->cached_varyings);
     free(program);
 }
 
@@ -140,6 +152,39 @@ void *program_get_uniforms(program_t *program) {
     return program->shader_uniforms;
 }
 
+/*
+ * the shaded vertices are cached by index, so a vertex shared by adjacent
+ * triangles is only shaded once, the cache must be cleared whenever the
+ * uniforms change, i.e. before each draw
+ */
+void program_clear_cache(program_t *program) {
+    int i;
+    for (i = 0; i < VERTEX_CACHE_SIZE; i++) {
+        program->cached_indices[i] = -1;
+    }
+}
+
+/* tags the attribs of the nth vertex with its index in the vertex buffer */
+void program_set_index(program_t *program, int nth_vertex, int index) {
+    assert(nth_vertex >= 0 && nth_vertex < 3);
+    program->vertex_indices[nth_vertex] = index;
+}
+
+/* the attribs of a cached vertex are not read and need not be set */
+int program_is_cached(program_t *program, int index) {
+    int slot = index & (VERTEX_CACHE_SIZE - 1);
+    return index >= 0 && program->cached_indices[slot] == index;
+}
+
+int program_is_double_sided(program_t *program) {
+    return program->double_sided;
+}
+
+static void *get_cached_varyings(program_t *program, int slot) {
+    char *cached_varyings = (char*)program->cached_varyings;
+    return cached_varyings + program->sizeof_varyings * slot;
+}
+
 /* graphics pipeline */
 
 /*
@@ -541,16 +586,45 @@ void graphics_draw_triangle(framebuffer_t *framebuffer, program_t *program) {
     其中可以看出，只有vertex shader和fragment shader被薄露了出来【各种算法共用整个流程】
     其余的都封装起来了（现实情况是被封装的部分，一般是GPU进行了硬件固化加速）
     */
+    int sizeof_varyings = program->sizeof_varyings;
+    int cache_hits[3];
     int num_vertices;
     int i;
 
+    /* fetch cached vertices, before any insertion can evict them */
+    for (i = 0; i < 3; i++) {
+        int index = program->vertex_indices[i];
+        int slot = index & (VERTEX_CACHE_SIZE - 1);
+        cache_hits[i] = program_is_cached(program, index);
+        if (cache_hits[i]) {
+            program->in_coords[i] = program->cached_coords[slot];
+            memcpy(program->in_varyings[i], get_cached_varyings(program, slot),
+                   sizeof_varyings);
+        }
+    }
+
     /* execute vertex shader */
     for (i = 0; i < 3; i++) {
         /*对三个顶点，逐个进行 顶点shader*/
-        vec4_t clip_coord = program->vertex_shader(program->shader_attribs[i],
-                                                   program->in_varyings[i],
-                                                   program->shader_uniforms);
+        int index = program->vertex_indices[i];
+        int slot = index & (VERTEX_CACHE_SIZE - 1);
+        vec4_t clip_coord;
+        if (cache_hits[i]) {
+            continue;
+        }
+        clip_coord = program->vertex_shader(program->shader_attribs[i],
+                                            program->in_varyings[i],
+                                            program->shader_uniforms);
         program->in_coords[i] = clip_coord;
+        if (index >= 0) {
+            program->cached_indices[slot] = index;
+            program->cached_coords[slot] = clip_coord;
+            memcpy(get_cached_varyings(program, slot), program->in_varyings[i],
+                   sizeof_varyings);
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        program->vertex_indices[i] = -1;
     }
 
     /* triangle clipping[裁减]: 也称为图元(primitive)裁减(clipping)剔除
@@ -28,6 +28,10 @@ program_t *program_create(
 void program_release(program_t *program);
 void *program_get_attribs(program_t *program, int nth_vertex);
 void *program_get_uniforms(program_t *program);
+void program_clear_cache(program_t *program);
+void program_set_index(program_t *program, int nth_vertex, int index);
+int program_is_cached(program_t *program, int index);
+int program_is_double_sided(program_t *program);
 
 /* graphics pipeline */
 void graphics_draw_triangle(framebuffer_t *framebuffer, program_t *program);
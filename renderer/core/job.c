@@ -0,0 +1,386 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "darray.h"
+#include "job.h"
+#include "macro.h"
+#include "platform.h"
+
+/*
+ * a pool of persistent worker threads, each owning a deque of jobs, the
+ * owner pushes and pops at the bottom so nested work runs depth first while
+ * it is still in the cache, and idle workers steal the oldest jobs from the
+ * top of the other deques, see "Parallelizing the Naughty Dog engine using
+ * fibers" by Gyrling
+ *
+ * c89 has no atomics, so each deque is guarded by its own mutex, and the
+ * counters and the sleeping workers by a global one, which is only taken
+ * once per job, threads other than the workers share the first deque
+ */
+
+#define MAX_THREADS 64
+#define INITIAL_CAPACITY 64  /* jobs per deque, a power of 2 */
+
+typedef struct {
+    jobfunc_t *jobfunc;
+    void *userdata;
+    counter_t *signal;
+} job_t;
+
+struct counter {
+    int value;      /* of the jobs submitted against it and not yet done */
+    job_t *parked;  /* darray, queued when the value drops to 0 */
+};
+
+typedef struct {
+    int index;
+    thread_t *thread;
+    mutex_t *mutex;
+    job_t *jobs;   /* ring buffer, from top to bottom */
+    int capacity;
+    int top;
+    int bottom;
+} worker_t;
+
+static worker_t g_workers[MAX_THREADS];
+static int g_num_threads = 0;
+static mutex_t *g_mutex = NULL;
+static condition_t *g_condition = NULL;
+static int g_num_sleeping = 0;
+static int g_stopping = 0;
+
+/* deque operations */
+
+static void push_job(worker_t *worker, job_t job) {
+    mutex_lock(worker->mutex);
+    if (worker->bottom - worker->top == worker->capacity) {
+        int capacity = worker->capacity * 2;
+        job_t *jobs = (job_t*)malloc(sizeof(job_t) * capacity);
+        int i;
+        for (i = worker->top; i < worker->bottom; i++) {
+            jobs[i - worker->top] = worker->jobs[i & (worker->capacity - 1)];
+        }
+        free(worker->jobs);
+        worker->jobs = jobs;
+        worker->capacity = capacity;
+        worker->bottom -= worker->top;
+        worker->top = 0;
+    }
+    worker->jobs[worker->bottom & (worker->capacity - 1)] = job;
+    worker->bottom += 1;
+    mutex_unlock(worker->mutex);
+}
+
+static int take_job(worker_t *worker, job_t *job, int from_bottom) {
+    int found = 0;
+    mutex_lock(worker->mutex);
+    if (worker->top < worker->bottom) {
+        if (from_bottom) {
+            worker->bottom -= 1;
+            *job = worker->jobs[worker->bottom & (worker->capacity - 1)];
+        } else {
+            *job = worker->jobs[worker->top & (worker->capacity - 1)];
+            worker->top += 1;
+        }
+        if (worker->top == worker->bottom) {
+            worker->top = worker->bottom = 0;
+        }
+        found = 1;
+    }
+    mutex_unlock(worker->mutex);
+    return found;
+}
+
+/* pops the newest job of the worker, or steals the oldest of another */
+static int find_job(worker_t *worker, job_t *job) {
+    int i;
+    if (take_job(worker, job, 1)) {
+        return 1;
+    }
+    for (i = 1; i < g_num_threads; i++) {
+        worker_t *victim = &g_workers[(worker->index + i) % g_num_threads];
+        if (take_job(victim, job, 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* called with the global mutex held */
+static int has_jobs(void) {
+    int found = 0;
+    int i;
+    for (i = 0; i < g_num_threads && !found; i++) {
+        mutex_lock(g_workers[i].mutex);
+        found = g_workers[i].top < g_workers[i].bottom;
+        mutex_unlock(g_workers[i].mutex);
+    }
+    return found;
+}
+
+static worker_t *get_worker(void) {
+    worker_t *worker = (worker_t*)thread_get_local();
+    return worker ? worker : &g_workers[0];
+}
+
+/* job running */
+
+static void run_job(job_t *job) {
+    counter_t *counter = job->signal;
+    job->jobfunc(job->userdata);
+    if (counter) {
+        mutex_lock(g_mutex);
+        counter->value -= 1;
+        if (counter->value == 0) {
+            worker_t *worker = get_worker();
+            int num_parked = darray_size(counter->parked);
+            int i;
+            for (i = 0; i < num_parked; i++) {
+                push_job(worker, counter->parked[i]);
+            }
+            darray_free(counter->parked);
+            counter->parked = NULL;
+            if (g_num_sleeping > 0) {
+                condition_broadcast(g_condition);
+            }
+        }
+        mutex_unlock(g_mutex);
+    }
+}
+
+static void run_worker(void *worker_) {
+    worker_t *worker = (worker_t*)worker_;
+    int stopping = 0;
+    job_t job;
+
+    thread_set_local(worker);
+    while (!stopping) {
+        if (find_job(worker, &job)) {
+            run_job(&job);
+            continue;
+        }
+        mutex_lock(g_mutex);
+        while (!has_jobs() && !g_stopping) {
+            g_num_sleeping += 1;
+            condition_wait(g_condition, g_mutex);
+            g_num_sleeping -= 1;
+        }
+        stopping = g_stopping && !has_jobs();
+        mutex_unlock(g_mutex);
+    }
+}
+
+/* job system initialization */
+
+/*
+ * starts the workers, the calling thread counts as one of them, 0 threads
+ * is one per core, pinned workers are bound to a core each
+ */
+void job_initialize(int num_threads, int pin_threads) {
+    int num_cores = platform_get_num_cores();
+    int i;
+
+    assert(g_num_threads == 0);
+    if (num_threads <= 0) {
+        num_threads = num_cores;
+    }
+    num_threads = num_threads > MAX_THREADS ? MAX_THREADS : num_threads;
+
+    g_mutex = mutex_create();
+    g_condition = condition_create();
+    for (i = 0; i < num_threads; i++) {
+        worker_t *worker = &g_workers[i];
+        memset(worker, 0, sizeof(worker_t));
+        worker->index = i;
+        worker->mutex = mutex_create();
+        worker->jobs = (job_t*)malloc(sizeof(job_t) * INITIAL_CAPACITY);
+        worker->capacity = INITIAL_CAPACITY;
+    }
+    g_num_threads = num_threads;
+
+    /* before any worker, as the slot may be allocated on first use */
+    thread_set_local(&g_workers[0]);
+    for (i = 1; i < num_threads; i++) {
+        g_workers[i].thread = thread_create(run_worker, &g_workers[i]);
+        if (pin_threads) {
+            thread_set_affinity(g_workers[i].thread, i % num_cores);
+        }
+    }
+}
+
+/* joins the workers, after they have run the jobs still queued */
+void job_terminate(void) {
+    int i;
+
+    if (g_num_threads == 0) {
+        return;
+    }
+    mutex_lock(g_mutex);
+    g_stopping = 1;
+    condition_broadcast(g_condition);
+    mutex_unlock(g_mutex);
+    for (i = 1; i < g_num_threads; i++) {
+        thread_join(g_workers[i].thread);
+    }
+    for (i = 0; i < g_num_threads; i++) {
+        assert(g_workers[i].top == g_workers[i].bottom);
+        mutex_destroy(g_workers[i].mutex);
+        free(g_workers[i].jobs);
+    }
+    mutex_destroy(g_mutex);
+    condition_destroy(g_condition);
+    g_mutex = NULL;
+    g_condition = NULL;
+    g_num_threads = 0;
+    g_stopping = 0;
+    thread_set_local(NULL);
+}
+
+/* the job system starts with the defaults when first used */
+int job_get_num_threads(void) {
+    if (g_num_threads == 0) {
+        job_initialize(0, 0);
+    }
+    return g_num_threads;
+}
+
+/* counter creating/releasing */
+
+counter_t *counter_create(void) {
+    counter_t *counter = (counter_t*)malloc(sizeof(counter_t));
+    counter->value = 0;
+    counter->parked = NULL;
+    return counter;
+}
+
+/* the jobs signaling the counter must have been waited for */
+void counter_release(counter_t *counter) {
+    assert(counter->value == 0 && counter->parked == NULL);
+    free(counter);
+}
+
+/* job submitting/waiting */
+
+/*
+ * queues a job on the deque of the calling thread, the signal counter is
+ * raised until the job is done, and a job waiting on a counter is parked
+ * until that counter drops to 0, both counters are optional
+ */
+void job_submit(jobfunc_t *jobfunc, void *userdata,
+                counter_t *signal, counter_t *wait) {
+    job_t job;
+
+    job.jobfunc = jobfunc;
+    job.userdata = userdata;
+    job.signal = signal;
+    job_get_num_threads();
+
+    mutex_lock(g_mutex);
+    if (signal) {
+        signal->value += 1;
+    }
+    if (wait && wait->value > 0) {
+        darray_push(wait->parked, job);
+    } else {
+        push_job(get_worker(), job);
+        if (g_num_sleeping > 0) {
+            condition_broadcast(g_condition);
+        }
+    }
+    mutex_unlock(g_mutex);
+}
+
+/*
+ * runs other jobs until the counter drops to 0, so waiting inside a job
+ * never blocks a worker while there is work left
+ */
+void job_wait(counter_t *counter) {
+    worker_t *worker = get_worker();
+    job_t job;
+
+    for (;;) {
+        int done;
+        mutex_lock(g_mutex);
+        done = counter->value == 0;
+        mutex_unlock(g_mutex);
+        if (done) {
+            return;
+        }
+        if (find_job(worker, &job)) {
+            run_job(&job);
+            continue;
+        }
+        mutex_lock(g_mutex);
+        while (counter->value > 0 && !has_jobs()) {
+            g_num_sleeping += 1;
+            condition_wait(g_condition, g_mutex);
+            g_num_sleeping -= 1;
+        }
+        mutex_unlock(g_mutex);
+    }
+}
+
+typedef struct {
+    rangefunc_t *rangefunc;
+    void *userdata;
+    mutex_t *mutex;
+    int count;
+    int grain;
+    int next;
+} range_t;
+
+static void run_range(void *range_) {
+    range_t *range = (range_t*)range_;
+    for (;;) {
+        int first, last;
+        mutex_lock(range->mutex);
+        first = range->next;
+        last = first + range->grain;
+        last = last < range->count ? last : range->count;
+        range->next = last;
+        mutex_unlock(range->mutex);
+        if (first >= last) {
+            break;
+        }
+        range->rangefunc(range->userdata, first, last);
+    }
+}
+
+/*
+ * calls the function over [0, count) in batches of the grain size, the
+ * caller and up to one job per other thread take batches in order from a
+ * shared cursor, so batches of uneven cost are balanced as they finish
+ */
+void job_parallel_for(rangefunc_t *rangefunc, void *userdata,
+                      int count, int grain) {
+    int num_batches, num_helpers, i;
+    counter_t counter;
+    range_t range;
+
+    assert(count >= 0 && grain > 0);
+    num_batches = count / grain + (count % grain ? 1 : 0);
+    num_helpers = job_get_num_threads() - 1;
+    num_helpers = num_helpers < num_batches - 1 ? num_helpers
+                                                : num_batches - 1;
+    if (num_helpers <= 0) {
+        if (count > 0) {
+            rangefunc(userdata, 0, count);
+        }
+        return;
+    }
+
+    range.rangefunc = rangefunc;
+    range.userdata = userdata;
+    range.mutex = mutex_create();
+    range.count = count;
+    range.grain = grain;
+    range.next = 0;
+    counter.value = 0;
+    counter.parked = NULL;
+    for (i = 0; i < num_helpers; i++) {
+        job_submit(run_range, &range, &counter, NULL);
+    }
+    run_range(&range);
+    job_wait(&counter);
+    mutex_destroy(range.mutex);
+}
@@ -0,0 +1,24 @@
+#ifndef JOB_H
+#define JOB_H
+
+typedef struct counter counter_t;
+typedef void jobfunc_t(void *userdata);
+typedef void rangefunc_t(void *userdata, int first, int last);
+
+/* job system initialization */
+void job_initialize(int num_threads, int pin_threads);
+void job_terminate(void);
+int job_get_num_threads(void);
+
+/* counter creating/releasing */
+counter_t *counter_create(void);
+void counter_release(counter_t *counter);
+
+/* job submitting/waiting */
+void job_submit(jobfunc_t *jobfunc, void *userdata,
+                counter_t *signal, counter_t *wait);
+void job_wait(counter_t *counter);
+void job_parallel_for(rangefunc_t *rangefunc, void *userdata,
+                      int count, int grain);
+
+#endif
@@ -315,6 +315,41 @@ quat_t quat_slerp(quat_t a, quat_t b, float t) {
     }
 }
 
+/*
+ * m must be a rotation matrix, the largest of the four components is
+ * recovered first to keep the square root away from zero, see
+ * http://www.euclideanspace.com/maths/geometry/rotations/conversions/matrixToQuaternion/
+ */
+quat_t quat_from_mat3(mat3_t m) {
+    float trace = m.m[0][0] + m.m[1][1] + m.m[2][2];
+    float s;
+    if (trace > 0) {
+        s = (float)sqrt(trace + 1) * 2;
+        return quat_new((m.m[2][1] - m.m[1][2]) / s,
+                        (m.m[0][2] - m.m[2][0]) / s,
+                        (m.m[1][0] - m.m[0][1]) / s,
+                        s / 4);
+    } else if (m.m[0][0] > m.m[1][1] && m.m[0][0] > m.m[2][2]) {
+        s = (float)sqrt(1 + m.m[0][0] - m.m[1][1] - m.m[2][2]) * 2;
+        return quat_new(s / 4,
+                        (m.m[0][1] + m.m[1][0]) / s,
+                        (m.m[0][2] + m.m[2][0]) / s,
+                        (m.m[2][1] - m.m[1][2]) / s);
+    } else if (m.m[1][1] > m.m[2][2]) {
+        s = (float)sqrt(1 + m.m[1][1] - m.m[0][0] - m.m[2][2]) * 2;
+        return quat_new((m.m[0][1] + m.m[1][0]) / s,
+                        s / 4,
+                        (m.m[1][2] + m.m[2][1]) / s,
+                        (m.m[0][2] - m.m[2][0]) / s);
+    } else {
+        s = (float)sqrt(1 + m.m[2][2] - m.m[0][0] - m.m[1][1]) * 2;
+        return quat_new((m.m[0][2] + m.m[2][0]) / s,
+                        (m.m[1][2] + m.m[2][1]) / s,
+                        s / 4,
+                        (m.m[1][0] - m.m[0][1]) / s);
+    }
+}
+
 void quat_print(const char *name, quat_t q) {
     printf("quat %s =\n", name);
     printf("    %12f    %12f    %12f    %12f\n", q.x, q.y, q.z, q.w);
@@ -624,6 +659,15 @@ static mat4_t mat4_adjoint(mat4_t m) {
     return adjoint;
 }
 
+float mat4_determinant(mat4_t m) {
+    float determinant = 0;
+    int i;
+    for (i = 0; i < 4; i++) {
+        determinant += m.m[0][i] * mat4_cofactor(m, 0, i);
+    }
+    return determinant;
+}
+
 mat4_t mat4_inverse_transpose(mat4_t m) {
     mat4_t adjoint, inverse_transpose;
     float determinant, inv_determinant;
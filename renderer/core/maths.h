@@ -70,6 +70,7 @@ float quat_dot(quat_t a, quat_t b);
 float quat_length(quat_t q);
 quat_t quat_normalize(quat_t q);
 quat_t quat_slerp(quat_t a, quat_t b, float t);
+quat_t quat_from_mat3(mat3_t m);
 void quat_print(const char *name, quat_t q);
 
 /* mat3 related functions */
@@ -91,6 +92,7 @@ mat4_t mat4_from_trs(vec3_t t, quat_t r, vec3_t s);
 mat4_t mat4_combine(mat4_t m[4], vec4_t weights);
 vec4_t mat4_mul_vec4(mat4_t m, vec4_t v);
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b);
+float mat4_determinant(mat4_t m);
 mat4_t mat4_inverse(mat4_t m);
 mat4_t mat4_transpose(mat4_t m);
 mat4_t mat4_inverse_transpose(mat4_t m);
@@ -1,171 +1,1111 @@
 #include <assert.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "darray.h"
+#include "job.h"
 #include "macro.h"
 #include "maths.h"
 #include "mesh.h"
+#include "meshopt.h"
+#include "platform.h"
 #include "private.h"
 
+/* full precision vertex, only used while building the mesh */
+typedef struct {
+    vec3_t position;
+    vec2_t texcoord;
+    vec3_t normal;
+    vec4_t tangent;
+    vec4_t joint;
+    vec4_t weight;
+} vertex_t;
+
 struct mesh {
-    int num_faces;
-    vertex_t *vertices;
-    vec3_t center;
+    int num_faces;    /* of the full mesh */
+    int num_vertices;
+    void *streams[NUM_ATTRIBS];  /* NULL for absent attributes */
+    vec2_t texcoord_min;         /* texcoords are unorm16 in this range */
+    vec2_t texcoord_max;
+    int num_indices;  /* of all levels, the full mesh comes first */
+    int index_size;   /* 2 or 4 bytes */
+    void *indices;
+    bbox_t bbox;
+    vec3_t center;  /* bounding sphere, centered on the bbox */
+    float radius;
+    int num_joints;
+    bbox_t *joint_bboxes;  /* of the vertices each joint moves */
+    int num_meshlets;
+    meshlet_t *meshlets;
+    int num_lods;
+    lod_t lods[MESH_MAX_LODS];
+    vcache_stats_t vcache_stats;
+    void *mapping;  /* the cache the arrays point into, or NULL */
+    int mapping_size;
+};
+
+static const int ATTRIB_SIZES[NUM_ATTRIBS] = {
+    sizeof(vec3_t), sizeof(unsigned short) * 2, sizeof(short) * 2,
+    sizeof(unsigned int), sizeof(unsigned char) * 4, sizeof(unsigned char) * 4,
 };
 
+/* vertex quantization */
+
+static unsigned short quantize_unorm16(float value, float min, float max) {
+    float range = max - min;
+    float t = range > 0 ? (value - min) / range : 0;
+    return (unsigned short)(float_saturate(t) * 65535 + 0.5f);
+}
+
+static short quantize_snorm16(float value) {
+    return (short)floor(float_clamp(value, -1, 1) * 32767 + 0.5f);
+}
+
+static float dequantize_snorm16(short value) {
+    return float_max((float)value / 32767, -1);
+}
+
+static float sign_not_zero(float value) {
+    return value >= 0 ? 1.0f : -1.0f;
+}
+
+/*
+ * for octahedral normal encoding, see
+ * A Survey of Efficient Representations for Independent Unit Vectors
+ */
+static vec2_t encode_octahedral(vec3_t n) {
+    float l1_norm = (float)(fabs(n.x) + fabs(n.y) + fabs(n.z));
+    vec2_t p;
+    if (l1_norm == 0) {
+        return vec2_new(0, 0);
+    }
+    p = vec2_new(n.x / l1_norm, n.y / l1_norm);
+    if (n.z < 0) {
+        float x = p.x;
+        p.x = (1 - (float)fabs(p.y)) * sign_not_zero(x);
+        p.y = (1 - (float)fabs(x)) * sign_not_zero(p.y);
+    }
+    return p;
+}
+
+static vec3_t decode_octahedral(vec2_t p) {
+    vec3_t n = vec3_new(p.x, p.y, 1 - (float)fabs(p.x) - (float)fabs(p.y));
+    if (n.z < 0) {
+        float x = n.x;
+        n.x = (1 - (float)fabs(n.y)) * sign_not_zero(x);
+        n.y = (1 - (float)fabs(x)) * sign_not_zero(n.y);
+    }
+    return vec3_normalize(n);
+}
+
+/* xyz as 10-bit snorm, w as 2-bit snorm, in two's complement */
+static unsigned int encode_snorm1010102(vec4_t v) {
+    int x = (int)floor(float_clamp(v.x, -1, 1) * 511 + 0.5f);
+    int y = (int)floor(float_clamp(v.y, -1, 1) * 511 + 0.5f);
+    int z = (int)floor(float_clamp(v.z, -1, 1) * 511 + 0.5f);
+    int w = v.w < 0 ? -1 : 1;
+    return ((unsigned int)x & 0x3FF)
+           | (((unsigned int)y & 0x3FF) << 10)
+           | (((unsigned int)z & 0x3FF) << 20)
+           | (((unsigned int)w & 0x3) << 30);
+}
+
+static float extract_snorm(unsigned int bits, int shift, int width) {
+    int max = (1 << (width - 1)) - 1;
+    int value = (int)((bits >> shift) & ((1U << width) - 1));
+    if (value > max) {
+        value -= 1 << width;  /* sign extension */
+    }
+    return float_max((float)value / (float)max, -1);
+}
+
+static vec4_t decode_snorm1010102(unsigned int bits) {
+    return vec4_new(extract_snorm(bits, 0, 10), extract_snorm(bits, 10, 10),
+                    extract_snorm(bits, 20, 10), extract_snorm(bits, 30, 2));
+}
+
+/* the largest weight absorbs the rounding, so the weights still sum to 1 */
+static void quantize_weights(vec4_t weight, unsigned char quantized[4]) {
+    float *weights = (float*)&weight;
+    float sum = weight.x + weight.y + weight.z + weight.w;
+    int largest = 0;
+    int total = 0;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        int value = (int)(float_saturate(weights[i]) * 255 + 0.5f);
+        quantized[i] = (unsigned char)value;
+        total += value;
+        if (weights[i] > weights[largest]) {
+            largest = i;
+        }
+    }
+    if (sum > 0.5f && total != 255) {
+        int value = (int)quantized[largest] + 255 - total;
+        quantized[largest] = (unsigned char)(value < 0 ? 0 : value);
+    }
+}
+
+static void quantize_vertex(mesh_t *mesh, int index, vertex_t *vertex) {
+    void **streams = mesh->streams;
+    ((vec3_t*)streams[ATTRIB_POSITION])[index] = vertex->position;
+    if (streams[ATTRIB_TEXCOORD]) {
+        unsigned short *texcoord = (unsigned short*)streams[ATTRIB_TEXCOORD]
+                                   + index * 2;
+        texcoord[0] = quantize_unorm16(vertex->texcoord.x,
+                                       mesh->texcoord_min.x,
+                                       mesh->texcoord_max.x);
+        texcoord[1] = quantize_unorm16(vertex->texcoord.y,
+                                       mesh->texcoord_min.y,
+                                       mesh->texcoord_max.y);
+    }
+    if (streams[ATTRIB_NORMAL]) {
+        short *normal = (short*)streams[ATTRIB_NORMAL] + index * 2;
+        vec2_t encoded = encode_octahedral(vertex->normal);
+        normal[0] = quantize_snorm16(encoded.x);
+        normal[1] = quantize_snorm16(encoded.y);
+    }
+    if (streams[ATTRIB_TANGENT]) {
+        unsigned int *tangent = (unsigned int*)streams[ATTRIB_TANGENT] + index;
+        *tangent = encode_snorm1010102(vertex->tangent);
+    }
+    if (streams[ATTRIB_JOINT]) {
+        unsigned char *joint = (unsigned char*)streams[ATTRIB_JOINT]
+                               + index * 4;
+        float *joints = (float*)&vertex->joint;
+        int i;
+        for (i = 0; i < 4; i++) {
+            assert(joints[i] >= 0 && joints[i] < 256);
+            joint[i] = (unsigned char)(joints[i] + 0.5f);
+        }
+    }
+    if (streams[ATTRIB_WEIGHT]) {
+        unsigned char *weight = (unsigned char*)streams[ATTRIB_WEIGHT]
+                                + index * 4;
+        quantize_weights(vertex->weight, weight);
+    }
+}
+
 /* mesh loading/releasing */
 
+static mesh_t *allocate_mesh(int num_vertices, int num_indices,
+                             int attribs, int num_meshlets) {
+    mesh_t *mesh = (mesh_t*)malloc(sizeof(mesh_t));
+    int i;
+
+    assert(attribs & (1 << ATTRIB_POSITION));
+    mesh->num_faces = num_indices / 3;
+    mesh->num_vertices = num_vertices;
+    mesh->num_indices = num_indices;
+    for (i = 0; i < NUM_ATTRIBS; i++) {
+        if (attribs & (1 << i)) {
+            mesh->streams[i] = malloc((size_t)ATTRIB_SIZES[i] * num_vertices);
+        } else {
+            mesh->streams[i] = NULL;
+        }
+    }
+    mesh->index_size = num_vertices <= 65536 ? 2 : 4;
+    mesh->indices = malloc((size_t)mesh->index_size * num_indices);
+    mesh->texcoord_min = vec2_new(0, 0);
+    mesh->texcoord_max = vec2_new(1, 1);
+    mesh->bbox.min = vec3_new(0, 0, 0);
+    mesh->bbox.max = vec3_new(0, 0, 0);
+    mesh->center = vec3_new(0, 0, 0);
+    mesh->radius = 0;
+    mesh->num_joints = 0;
+    mesh->joint_bboxes = NULL;
+    mesh->num_meshlets = num_meshlets;
+    mesh->meshlets = (meshlet_t*)malloc(sizeof(meshlet_t) * num_meshlets);
+    mesh->num_lods = 1;
+    mesh->lods[0].first_meshlet = 0;
+    mesh->lods[0].num_meshlets = num_meshlets;
+    mesh->lods[0].num_faces = mesh->num_faces;
+    mesh->lods[0].error = 0;
+    memset(&mesh->vcache_stats, 0, sizeof(vcache_stats_t));
+    mesh->mapping = NULL;
+    mesh->mapping_size = 0;
+    return mesh;
+}
+
+/* the only walk over the vertices after loading */
+static void update_bounds(mesh_t *mesh) {
+    vec3_t *positions = (vec3_t*)mesh->streams[ATTRIB_POSITION];
+    float radius2 = 0;
+    int i;
+    mesh->bbox.min = vec3_new(+1e6, +1e6, +1e6);
+    mesh->bbox.max = vec3_new(-1e6, -1e6, -1e6);
+    for (i = 0; i < mesh->num_vertices; i++) {
+        mesh->bbox.min = vec3_min(mesh->bbox.min, positions[i]);
+        mesh->bbox.max = vec3_max(mesh->bbox.max, positions[i]);
+    }
+    mesh->center = vec3_div(vec3_add(mesh->bbox.min, mesh->bbox.max), 2);
+    for (i = 0; i < mesh->num_vertices; i++) {
+        vec3_t offset = vec3_sub(positions[i], mesh->center);
+        radius2 = float_max(radius2, vec3_dot(offset, offset));
+    }
+    mesh->radius = (float)sqrt(radius2);
+
+    if (mesh->streams[ATTRIB_JOINT] && mesh->streams[ATTRIB_WEIGHT]) {
+        unsigned char *joints = (unsigned char*)mesh->streams[ATTRIB_JOINT];
+        unsigned char *weights = (unsigned char*)mesh->streams[ATTRIB_WEIGHT];
+        int j;
+        for (i = 0; i < mesh->num_vertices * 4; i++) {
+            if (weights[i] > 0 && joints[i] >= mesh->num_joints) {
+                mesh->num_joints = joints[i] + 1;
+            }
+        }
+        mesh->joint_bboxes = (bbox_t*)malloc(sizeof(bbox_t)
+                                             * mesh->num_joints);
+        for (j = 0; j < mesh->num_joints; j++) {
+            mesh->joint_bboxes[j].min = vec3_new(+1e6, +1e6, +1e6);
+            mesh->joint_bboxes[j].max = vec3_new(-1e6, -1e6, -1e6);
+        }
+        for (i = 0; i < mesh->num_vertices * 4; i++) {
+            if (weights[i] > 0) {
+                bbox_t *bbox = &mesh->joint_bboxes[joints[i]];
+                bbox->min = vec3_min(bbox->min, positions[i / 4]);
+                bbox->max = vec3_max(bbox->max, positions[i / 4]);
+            }
+        }
+    }
+}
+
+static mesh_t *create_mesh(vertex_t *vertices, int num_vertices,
+                           unsigned int *indices, int num_indices,
+                           int attribs, meshlet_t *meshlets,
+                           int num_meshlets, lod_t *lods, int num_lods) {
+    mesh_t *mesh = allocate_mesh(num_vertices, num_indices,
+                                 attribs, num_meshlets);
+    int i;
+
+    mesh->texcoord_min = vec2_new(+1e6, +1e6);
+    mesh->texcoord_max = vec2_new(-1e6, -1e6);
+    for (i = 0; i < num_vertices; i++) {
+        vec2_t texcoord = vertices[i].texcoord;
+        mesh->texcoord_min.x = float_min(mesh->texcoord_min.x, texcoord.x);
+        mesh->texcoord_min.y = float_min(mesh->texcoord_min.y, texcoord.y);
+        mesh->texcoord_max.x = float_max(mesh->texcoord_max.x, texcoord.x);
+        mesh->texcoord_max.y = float_max(mesh->texcoord_max.y, texcoord.y);
+    }
+    for (i = 0; i < num_vertices; i++) {
+        quantize_vertex(mesh, i, &vertices[i]);
+    }
+    for (i = 0; i < num_indices; i++) {
+        if (mesh->index_size == 2) {
+            ((unsigned short*)mesh->indices)[i] = (unsigned short)indices[i];
+        } else {
+            ((unsigned int*)mesh->indices)[i] = indices[i];
+        }
+    }
+    memcpy(mesh->meshlets, meshlets, sizeof(meshlet_t) * num_meshlets);
+    memcpy(mesh->lods, lods, sizeof(lod_t) * num_lods);
+    mesh->num_lods = num_lods;
+    mesh->num_faces = lods[0].num_faces;
+    update_bounds(mesh);
+
+    return mesh;
+}
+
+/*
+ * each level is simplified from the previous one down to half of its
+ * triangles, while the accumulated error stays within a tenth of the mesh
+ * radius, a level that barely shrinks ends the chain, which happens when
+ * most vertices lie on seams or borders, the levels share the vertices
+ */
+
+#define LOD_RATIO 0.5f       /* target triangles of the next level */
+#define LOD_MIN_SHRINK 0.8f  /* max triangles kept for a level to be useful */
+#define LOD_MAX_ERROR 0.1f   /* relative to the mesh radius */
+
+static unsigned int *build_lods(vertex_t *vertices, int num_vertices,
+                                unsigned int *indices, int num_indices,
+                                lod_t *lods, int *num_lods) {
+    unsigned int *output;
+    vec3_t bbox_min = vec3_new(+1e6, +1e6, +1e6);
+    vec3_t bbox_max = vec3_new(-1e6, -1e6, -1e6);
+    float max_error;
+    int offset = num_indices;
+    int count = 1;
+    int i;
+
+    for (i = 0; i < num_vertices; i++) {
+        bbox_min = vec3_min(bbox_min, vertices[i].position);
+        bbox_max = vec3_max(bbox_max, vertices[i].position);
+    }
+    max_error = vec3_length(vec3_sub(bbox_max, bbox_min)) / 2 * LOD_MAX_ERROR;
+
+    output = (unsigned int*)malloc(sizeof(unsigned int) * num_indices
+                                   * MESH_MAX_LODS);
+    memcpy(output, indices, sizeof(unsigned int) * num_indices);
+    lods[0].num_faces = num_indices / 3;
+    lods[0].error = 0;
+    while (count < MESH_MAX_LODS) {
+        lod_t *prev = &lods[count - 1];
+        unsigned int *source = output + offset - prev->num_faces * 3;
+        int target = (int)(prev->num_faces * LOD_RATIO) * 3;
+        int num_simplified;
+        float error;
+
+        if (prev->error >= max_error) {
+            break;
+        }
+        num_simplified = meshopt_simplify(output + offset, source,
+                                          prev->num_faces * 3,
+                                          &vertices[0].position,
+                                          sizeof(vertex_t), num_vertices,
+                                          target, max_error - prev->error,
+                                          &error);
+        if (num_simplified == 0
+                || num_simplified > prev->num_faces * 3 * LOD_MIN_SHRINK) {
+            break;
+        }
+        lods[count].num_faces = num_simplified / 3;
+        lods[count].error = prev->error + error;
+        offset += num_simplified;
+        count += 1;
+    }
+
+    *num_lods = count;
+    return output;
+}
+
+/*
+ * the triangles of each level are reordered for the post-transform cache
+ * and for overdraw, then grouped into meshlets, then vertices are reordered
+ * for fetch locality, this runs once before the mesh is cached, so the cost
+ * is only paid on the first load
+ *
+ * the reordering is heuristic and can lose to an input that was already
+ * optimized by the exporter, so each step is measured on the cache model of
+ * the program and the input order is kept when the step made it worse
+ */
+
+#define MESHLET_SIZE 128  /* max triangles per meshlet */
+
+static float get_acmr(unsigned int *indices, int num_indices,
+                      int num_vertices) {
+    float acmr, atvr;
+    meshopt_analyze_vertex_cache(indices, num_indices, num_vertices,
+                                 &acmr, &atvr);
+    return acmr;
+}
+
+/* meshlets of consecutive triangles, which keeps the order of the level */
+static meshlet_t *split_meshlets(vertex_t *vertices, unsigned int *indices,
+                                 int num_indices, int *num_meshlets) {
+    int max_indices = MESHLET_SIZE * 3;
+    int count = (num_indices + max_indices - 1) / max_indices;
+    meshlet_t *meshlets = (meshlet_t*)malloc(sizeof(meshlet_t) * count);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        int first_index = i * max_indices;
+        int remaining = num_indices - first_index;
+        meshlets[i].first_index = first_index;
+        meshlets[i].num_indices = remaining < max_indices ? remaining
+                                                          : max_indices;
+        meshopt_compute_meshlet_bounds(&meshlets[i], indices,
+                                       &vertices[0].position,
+                                       sizeof(vertex_t));
+    }
+    *num_meshlets = count;
+    return meshlets;
+}
+
+static meshlet_t *optimize_level(vertex_t *vertices, int num_vertices,
+                                 unsigned int *level, int level_indices,
+                                 int *num_meshlets) {
+    unsigned int *input;
+    meshlet_t *meshlets;
+    float input_acmr;
+
+    input = (unsigned int*)malloc(sizeof(unsigned int) * level_indices);
+    memcpy(input, level, sizeof(unsigned int) * level_indices);
+    input_acmr = get_acmr(level, level_indices, num_vertices);
+
+    meshopt_optimize_vertex_cache(level, level_indices, num_vertices);
+    meshopt_optimize_overdraw(level, level_indices, &vertices[0].position,
+                              sizeof(vertex_t), num_vertices);
+    meshlets = meshopt_build_meshlets(level, level_indices,
+                                      &vertices[0].position,
+                                      sizeof(vertex_t), num_vertices,
+                                      MESHLET_SIZE, num_meshlets);
+    if (get_acmr(level, level_indices, num_vertices) > input_acmr) {
+        free(meshlets);
+        memcpy(level, input, sizeof(unsigned int) * level_indices);
+        meshlets = split_meshlets(vertices, level, level_indices,
+                                  num_meshlets);
+    }
+    free(input);
+    return meshlets;
+}
+
+/*
+ * renumbering the vertices changes the slots they take in the direct-mapped
+ * cache, so the full mesh is measured again before keeping the new order
+ */
+static void optimize_fetch(vertex_t *vertices, int num_vertices,
+                           unsigned int *indices, int num_indices,
+                           int num_full_indices) {
+    size_t vertices_size = sizeof(vertex_t) * num_vertices;
+    size_t indices_size = sizeof(unsigned int) * num_indices;
+    vertex_t *input_vertices = (vertex_t*)malloc(vertices_size);
+    unsigned int *input_indices = (unsigned int*)malloc(indices_size);
+    float input_acmr = get_acmr(indices, num_full_indices, num_vertices);
+
+    memcpy(input_vertices, vertices, vertices_size);
+    memcpy(input_indices, indices, indices_size);
+    /* the full mesh comes first, so its vertices are the most local */
+    meshopt_optimize_vertex_fetch(vertices, sizeof(vertex_t), num_vertices,
+                                  indices, num_indices);
+    if (get_acmr(indices, num_full_indices, num_vertices) > input_acmr) {
+        memcpy(vertices, input_vertices, vertices_size);
+        memcpy(indices, input_indices, indices_size);
+    }
+    free(input_vertices);
+    free(input_indices);
+}
+
+static meshlet_t *optimize_mesh(vertex_t *vertices, int num_vertices,
+                                unsigned int *indices, lod_t *lods,
+                                int num_lods, int *num_meshlets,
+                                vcache_stats_t *stats) {
+    meshlet_t *level_meshlets[MESH_MAX_LODS];
+    int num_full_indices = lods[0].num_faces * 3;
+    int offset = 0;
+    meshlet_t *meshlets;
+    int i, j;
+
+    meshopt_analyze_vertex_cache(indices, num_full_indices, num_vertices,
+                                 &stats->input_acmr, &stats->input_atvr);
+    *num_meshlets = 0;
+    for (i = 0; i < num_lods; i++) {
+        int level_indices = lods[i].num_faces * 3;
+        level_meshlets[i] = optimize_level(vertices, num_vertices,
+                                           indices + offset, level_indices,
+                                           &lods[i].num_meshlets);
+        for (j = 0; j < lods[i].num_meshlets; j++) {
+            level_meshlets[i][j].first_index += offset;
+        }
+        lods[i].first_meshlet = *num_meshlets;
+        *num_meshlets += lods[i].num_meshlets;
+        offset += level_indices;
+    }
+    meshlets = (meshlet_t*)malloc(sizeof(meshlet_t) * *num_meshlets);
+    for (i = 0; i < num_lods; i++) {
+        memcpy(meshlets + lods[i].first_meshlet, level_meshlets[i],
+               sizeof(meshlet_t) * lods[i].num_meshlets);
+        free(level_meshlets[i]);
+    }
+    optimize_fetch(vertices, num_vertices, indices, offset, num_full_indices);
+    meshopt_analyze_vertex_cache(indices, num_full_indices, num_vertices,
+                                 &stats->acmr, &stats->atvr);
+    return meshlets;
+}
+
+static unsigned long hash_triple(int a, int b, int c) {
+    unsigned long hash = (unsigned long)a * 73856093UL;
+    hash ^= (unsigned long)b * 19349663UL;
+    hash ^= (unsigned long)c * 83492791UL;
+    return hash & 0xFFFFFFFFUL;
+}
+
+/*
+ * a vertex is identified by its (position, texcoord, normal) index triple,
+ * tangents, joints and weights follow the position index
+ */
 static mesh_t *build_mesh(
         vec3_t *positions, vec2_t *texcoords, vec3_t *normals,
         vec4_t *tangents, vec4_t *joints, vec4_t *weights,
         int *position_indices, int *texcoord_indices, int *normal_indices) {
-    vec3_t bbox_min = vec3_new(+1e6, +1e6, +1e6);
-    vec3_t bbox_max = vec3_new(-1e6, -1e6, -1e6);
+    int attribs = (1 << ATTRIB_POSITION) | (1 << ATTRIB_TEXCOORD)
+                  | (1 << ATTRIB_NORMAL);
     int num_indices = darray_size(position_indices);
-    int num_faces = num_indices / 3;
+    int num_vertices = 0;
+    int num_slots = 1;
     vertex_t *vertices;
+    unsigned int *indices, *lod_indices;
+    meshlet_t *meshlets;
+    int num_meshlets;
+    lod_t lods[MESH_MAX_LODS];
+    int num_lods, num_lod_indices;
+    vcache_stats_t vcache_stats;
+    int *slots;
     mesh_t *mesh;
     int i;
 
-    assert(num_faces > 0 && num_faces * 3 == num_indices);
+    assert(num_indices > 0 && num_indices % 3 == 0);
     assert(darray_size(position_indices) == num_indices);
     assert(darray_size(texcoord_indices) == num_indices);
     assert(darray_size(normal_indices) == num_indices);
 
+    while (num_slots < num_indices * 2) {
+        num_slots *= 2;
+    }
+    slots = (int*)malloc(sizeof(int) * num_slots);
+    for (i = 0; i < num_slots; i++) {
+        slots[i] = -1;
+    }
     vertices = (vertex_t*)malloc(sizeof(vertex_t) * num_indices);
+    indices = (unsigned int*)malloc(sizeof(unsigned int) * num_indices);
     for (i = 0; i < num_indices; i++) {
         int position_index = position_indices[i];
         int texcoord_index = texcoord_indices[i];
         int normal_index = normal_indices[i];
+        unsigned long hash = hash_triple(position_index, texcoord_index,
+                                         normal_index);
+        int slot = (int)(hash & (unsigned long)(num_slots - 1));
+        vertex_t *vertex;
+
+        while (slots[slot] >= 0) {
+            int first = slots[slot];  /* first occurrence in the faces */
+            if (position_indices[first] == position_index
+                    && texcoord_indices[first] == texcoord_index
+                    && normal_indices[first] == normal_index) {
+                break;
+            }
+            slot = (slot + 1) & (num_slots - 1);
+        }
+        if (slots[slot] >= 0) {
+            indices[i] = indices[slots[slot]];
+            continue;
+        }
+        slots[slot] = i;
+        indices[i] = (unsigned int)num_vertices;
+
         assert(position_index >= 0 && position_index < darray_size(positions));
         assert(texcoord_index >= 0 && texcoord_index < darray_size(texcoords));
         assert(normal_index >= 0 && normal_index < darray_size(normals));
-        vertices[i].position = positions[position_index];
-        vertices[i].texcoord = texcoords[texcoord_index];
-        vertices[i].normal = normals[normal_index];
+        vertex = &vertices[num_vertices++];
+        vertex->position = positions[position_index];
+        vertex->texcoord = texcoords[texcoord_index];
+        vertex->normal = normals[normal_index];
 
         if (tangents) {
             int tangent_index = position_index;
             assert(tangent_index >= 0 && tangent_index < darray_size(tangents));
-            vertices[i].tangent = tangents[tangent_index];
+            vertex->tangent = tangents[tangent_index];
         } else {
-            vertices[i].tangent = vec4_new(1, 0, 0, 1);
+            vertex->tangent = vec4_new(1, 0, 0, 1);
         }
 
         if (joints) {
             int joint_index = position_index;
             assert(joint_index >= 0 && joint_index < darray_size(joints));
-            vertices[i].joint = joints[joint_index];
+            vertex->joint = joints[joint_index];
         } else {
-            vertices[i].joint = vec4_new(0, 0, 0, 0);
+            vertex->joint = vec4_new(0, 0, 0, 0);
         }
 
         if (weights) {
             int weight_index = position_index;
             assert(weight_index >= 0 && weight_index < darray_size(weights));
-            vertices[i].weight = weights[weight_index];
+            vertex->weight = weights[weight_index];
         } else {
-            vertices[i].weight = vec4_new(0, 0, 0, 0);
+            vertex->weight = vec4_new(0, 0, 0, 0);
         }
-
-        bbox_min = vec3_min(bbox_min, vertices[i].position);
-        bbox_max = vec3_max(bbox_max, vertices[i].position);
     }
 
-    mesh = (mesh_t*)malloc(sizeof(mesh_t));
-    mesh->num_faces = num_faces;
-    mesh->vertices = vertices;
-    mesh->center = vec3_div(vec3_add(bbox_min, bbox_max), 2);
+    attribs |= tangents ? 1 << ATTRIB_TANGENT : 0;
+    attribs |= joints ? 1 << ATTRIB_JOINT : 0;
+    attribs |= weights ? 1 << ATTRIB_WEIGHT : 0;
+    lod_indices = build_lods(vertices, num_vertices, indices, num_indices,
+                             lods, &num_lods);
+    meshlets = optimize_mesh(vertices, num_vertices, lod_indices, lods,
+                             num_lods, &num_meshlets, &vcache_stats);
+    num_lod_indices = 0;
+    for (i = 0; i < num_lods; i++) {
+        num_lod_indices += lods[i].num_faces * 3;
+    }
+    mesh = create_mesh(vertices, num_vertices, lod_indices, num_lod_indices,
+                       attribs, meshlets, num_meshlets, lods, num_lods);
+    mesh->vcache_stats = vcache_stats;
+    free(meshlets);
+    free(lod_indices);
+    free(vertices);
+    free(indices);
+    free(slots);
 
     return mesh;
 }
 
-static mesh_t *load_obj(const char *filename) {
-    vec3_t *positions = NULL;
-    vec2_t *texcoords = NULL;
-    vec3_t *normals = NULL;
-    vec4_t *tangents = NULL;
-    vec4_t *joints = NULL;
-    vec4_t *weights = NULL;
-    int *position_indices = NULL;
-    int *texcoord_indices = NULL;
-    int *normal_indices = NULL;
-    char line[LINE_SIZE];
-    mesh_t *mesh;
-    FILE *file;
+/*
+ * the obj loader maps the file, splits it into chunks at line boundaries,
+ * and tokenizes the chunks in parallel with a hand-written lexer, a first
+ * pass counts the lines of each kind so that every chunk can write straight
+ * into the final arrays at its offset, which keeps the order of the items
+ * and therefore the absolute (1-based) indices of the faces valid
+ */
 
-    file = fopen(filename, "rb");
-    assert(file != NULL);
-    while (1) {
-        int items;
-        if (fgets(line, LINE_SIZE, file) == NULL) {
-            break;
-        } else if (strncmp(line, "v ", 2) == 0) {               /* position */
-            vec3_t position;
-            items = sscanf(line, "v %f %f %f",
-                           &position.x, &position.y, &position.z);
-            assert(items == 3);
-            darray_push(positions, position);
-        } else if (strncmp(line, "vt ", 3) == 0) {              /* texcoord */
-            vec2_t texcoord;
-            items = sscanf(line, "vt %f %f",
-                           &texcoord.x, &texcoord.y);
-            assert(items == 2);
-            darray_push(texcoords, texcoord);
-        } else if (strncmp(line, "vn ", 3) == 0) {              /* normal */
-            vec3_t normal;
-            items = sscanf(line, "vn %f %f %f",
-                           &normal.x, &normal.y, &normal.z);
-            assert(items == 3);
-            darray_push(normals, normal);
-        } else if (strncmp(line, "f ", 2) == 0) {               /* face */
+#define MAX_CHUNKS 64
+#define MIN_CHUNK_SIZE (1024 * 1024)
+
+typedef enum {
+    STREAM_POSITION,
+    STREAM_TEXCOORD,
+    STREAM_NORMAL,
+    STREAM_TANGENT,
+    STREAM_JOINT,
+    STREAM_WEIGHT,
+    STREAM_POSITION_INDEX,
+    STREAM_TEXCOORD_INDEX,
+    STREAM_NORMAL_INDEX,
+    NUM_STREAMS
+} stream_t;
+
+static const int STREAM_ITEM_SIZES[NUM_STREAMS] = {
+    sizeof(vec3_t), sizeof(vec2_t), sizeof(vec3_t),
+    sizeof(vec4_t), sizeof(vec4_t), sizeof(vec4_t),
+    sizeof(int), sizeof(int), sizeof(int),
+};
+
+typedef struct {
+    const char *begin;
+    const char *end;
+    int offsets[NUM_STREAMS];
+    void *streams[NUM_STREAMS];
+} obj_chunk_t;
+
+static const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+static const char *skip_line(const char *p, const char *end) {
+    while (p < end && *p != '\n') {
+        p++;
+    }
+    return p < end ? p + 1 : end;
+}
+
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char *parse_int(const char *p, const char *end, int *value) {
+    int sign = 1;
+    int number = 0;
+    p = skip_spaces(p, end);
+    if (p < end && (*p == '-' || *p == '+')) {
+        sign = *p == '-' ? -1 : 1;
+        p++;
+    }
+    assert(p < end && is_digit(*p));
+    while (p < end && is_digit(*p)) {
+        number = number * 10 + (*p - '0');
+        p++;
+    }
+    *value = sign * number;
+    return p;
+}
+
+static const char *parse_float(const char *p, const char *end, float *value) {
+    static const double POWERS[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    };
+    double sign = 1;
+    double number = 0;
+    int exponent = 0;
+
+    p = skip_spaces(p, end);
+    if (p < end && (*p == '-' || *p == '+')) {
+        sign = *p == '-' ? -1 : 1;
+        p++;
+    }
+    assert(p < end && (is_digit(*p) || *p == '.'));
+    while (p < end && is_digit(*p)) {
+        number = number * 10 + (*p - '0');
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && is_digit(*p)) {
+            number = number * 10 + (*p - '0');
+            exponent -= 1;
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int explicit_exponent;
+        p = parse_int(p + 1, end, &explicit_exponent);
+        exponent += explicit_exponent;
+    }
+    if (exponent < 0 && exponent >= -20) {
+        number /= POWERS[-exponent];
+    } else if (exponent > 0 && exponent <= 20) {
+        number *= POWERS[exponent];
+    } else if (exponent != 0) {
+        number *= pow(10, exponent);
+    }
+    *value = (float)(sign * number);
+    return p;
+}
+
+static const char *parse_floats(const char *p, const char *end,
+                                float *values, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        p = parse_float(p, end, &values[i]);
+    }
+    return p;
+}
+
+static int match_prefix(const char *p, const char *end, const char *prefix) {
+    while (*prefix != '\0') {
+        if (p >= end || *p != *prefix) {
+            return 0;
+        }
+        p++;
+        prefix++;
+    }
+    return 1;
+}
+
+static stream_t match_line(const char *p, const char *end, int *skipped) {
+    if (match_prefix(p, end, "v ")) {
+        *skipped = 2;
+        return STREAM_POSITION;
+    } else if (match_prefix(p, end, "vt ")) {
+        *skipped = 3;
+        return STREAM_TEXCOORD;
+    } else if (match_prefix(p, end, "vn ")) {
+        *skipped = 3;
+        return STREAM_NORMAL;
+    } else if (match_prefix(p, end, "f ")) {
+        *skipped = 2;
+        return STREAM_POSITION_INDEX;  /* feeds all three index streams */
+    } else if (match_prefix(p, end, "# ext.tangent ")) {
+        *skipped = 14;
+        return STREAM_TANGENT;
+    } else if (match_prefix(p, end, "# ext.joint ")) {
+        *skipped = 12;
+        return STREAM_JOINT;
+    } else if (match_prefix(p, end, "# ext.weight ")) {
+        *skipped = 13;
+        return STREAM_WEIGHT;
+    } else {
+        *skipped = 0;
+        return NUM_STREAMS;
+    }
+}
+
+static void count_chunks(void *chunks_, int first, int last) {
+    obj_chunk_t *chunks = (obj_chunk_t*)chunks_;
+    int i, j;
+    for (i = first; i < last; i++) {
+        obj_chunk_t *chunk = &chunks[i];
+        const char *end = chunk->end;
+        const char *p = chunk->begin;
+        for (j = 0; j < NUM_STREAMS; j++) {
+            chunk->offsets[j] = 0;
+        }
+        while (p < end) {
+            int skipped;
+            stream_t stream = match_line(p, end, &skipped);
+            if (stream != NUM_STREAMS) {
+                chunk->offsets[stream] += 1;
+            }
+            p = skip_line(p, end);
+        }
+        /* each face has three corners in each index stream */
+        chunk->offsets[STREAM_POSITION_INDEX] *= 3;
+        chunk->offsets[STREAM_TEXCOORD_INDEX] =
+            chunk->offsets[STREAM_POSITION_INDEX];
+        chunk->offsets[STREAM_NORMAL_INDEX] =
+            chunk->offsets[STREAM_POSITION_INDEX];
+    }
+}
+
+static void parse_chunk(obj_chunk_t *chunk) {
+    vec3_t *positions = (vec3_t*)chunk->streams[STREAM_POSITION];
+    vec2_t *texcoords = (vec2_t*)chunk->streams[STREAM_TEXCOORD];
+    vec3_t *normals = (vec3_t*)chunk->streams[STREAM_NORMAL];
+    vec4_t *tangents = (vec4_t*)chunk->streams[STREAM_TANGENT];
+    vec4_t *joints = (vec4_t*)chunk->streams[STREAM_JOINT];
+    vec4_t *weights = (vec4_t*)chunk->streams[STREAM_WEIGHT];
+    int *position_indices = (int*)chunk->streams[STREAM_POSITION_INDEX];
+    int *texcoord_indices = (int*)chunk->streams[STREAM_TEXCOORD_INDEX];
+    int *normal_indices = (int*)chunk->streams[STREAM_NORMAL_INDEX];
+    int *offsets = chunk->offsets;
+    const char *end = chunk->end;
+    const char *p = chunk->begin;
+
+    while (p < end) {
+        int skipped;
+        stream_t stream = match_line(p, end, &skipped);
+        const char *q = p + skipped;
+        if (stream == STREAM_POSITION) {
+            parse_floats(q, end, (float*)&positions[offsets[stream]++], 3);
+        } else if (stream == STREAM_TEXCOORD) {
+            parse_floats(q, end, (float*)&texcoords[offsets[stream]++], 2);
+        } else if (stream == STREAM_NORMAL) {
+            parse_floats(q, end, (float*)&normals[offsets[stream]++], 3);
+        } else if (stream == STREAM_POSITION_INDEX) {
             int i;
-            int pos_indices[3], uv_indices[3], n_indices[3];
-            items = sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d",
-                           &pos_indices[0], &uv_indices[0], &n_indices[0],
-                           &pos_indices[1], &uv_indices[1], &n_indices[1],
-                           &pos_indices[2], &uv_indices[2], &n_indices[2]);
-            assert(items == 9);
             for (i = 0; i < 3; i++) {
-                darray_push(position_indices, pos_indices[i] - 1);
-                darray_push(texcoord_indices, uv_indices[i] - 1);
-                darray_push(normal_indices, n_indices[i] - 1);
+                int index = offsets[STREAM_POSITION_INDEX]++;
+                int pos_index, uv_index, n_index;
+                q = parse_int(q, end, &pos_index);
+                assert(q < end && *q == '/');
+                q = parse_int(q + 1, end, &uv_index);
+                assert(q < end && *q == '/');
+                q = parse_int(q + 1, end, &n_index);
+                assert(pos_index > 0 && uv_index > 0 && n_index > 0);
+                position_indices[index] = pos_index - 1;
+                texcoord_indices[index] = uv_index - 1;
+                normal_indices[index] = n_index - 1;
             }
-        } else if (strncmp(line, "# ext.tangent ", 14) == 0) {  /* tangent */
-            vec4_t tangent;
-            items = sscanf(line, "# ext.tangent %f %f %f %f",
-                           &tangent.x, &tangent.y, &tangent.z, &tangent.w);
-            assert(items == 4);
-            darray_push(tangents, tangent);
-        } else if (strncmp(line, "# ext.joint ", 12) == 0) {    /* joint */
-            vec4_t joint;
-            items = sscanf(line, "# ext.joint %f %f %f %f",
-                           &joint.x, &joint.y, &joint.z, &joint.w);
-            assert(items == 4);
-            darray_push(joints, joint);
-        } else if (strncmp(line, "# ext.weight ", 13) == 0) {   /* weight */
-            vec4_t weight;
-            items = sscanf(line, "# ext.weight %f %f %f %f",
-                           &weight.x, &weight.y, &weight.z, &weight.w);
-            assert(items == 4);
-            darray_push(weights, weight);
-        }
-        UNUSED_VAR(items);
+        } else if (stream == STREAM_TANGENT) {
+            parse_floats(q, end, (float*)&tangents[offsets[stream]++], 4);
+        } else if (stream == STREAM_JOINT) {
+            parse_floats(q, end, (float*)&joints[offsets[stream]++], 4);
+        } else if (stream == STREAM_WEIGHT) {
+            parse_floats(q, end, (float*)&weights[offsets[stream]++], 4);
+        }
+        p = skip_line(p, end);
+    }
+}
+
+static void parse_chunks(void *chunks_, int first, int last) {
+    obj_chunk_t *chunks = (obj_chunk_t*)chunks_;
+    int i;
+    for (i = first; i < last; i++) {
+        parse_chunk(&chunks[i]);
+    }
+}
+
+static mesh_t *load_obj(const char *filename) {
+    obj_chunk_t chunks[MAX_CHUNKS];
+    void *streams[NUM_STREAMS];
+    int num_chunks;
+    const char *data;
+    mesh_t *mesh;
+    int size, i, j;
+
+    data = (const char*)file_map(filename, &size);
+    assert(data != NULL);
+
+    num_chunks = job_get_num_threads();
+    if (num_chunks > size / MIN_CHUNK_SIZE) {
+        num_chunks = size / MIN_CHUNK_SIZE;
+    }
+    num_chunks = num_chunks < 1 ? 1 : num_chunks;
+    num_chunks = num_chunks > MAX_CHUNKS ? MAX_CHUNKS : num_chunks;
+    for (i = 0; i < num_chunks; i++) {
+        const char *end = data + size;
+        chunks[i].begin = i == 0 ? data : chunks[i - 1].end;
+        if (i < num_chunks - 1) {
+            const char *split = data + (long)size * (i + 1) / num_chunks;
+            chunks[i].end = skip_line(split, end);
+        } else {
+            chunks[i].end = end;
+        }
+    }
+
+    /* turn the per-chunk counts into offsets into the final arrays */
+    job_parallel_for(count_chunks, chunks, num_chunks, 1);
+    for (i = 0; i < NUM_STREAMS; i++) {
+        int num_items = 0;
+        for (j = 0; j < num_chunks; j++) {
+            int count = chunks[j].offsets[i];
+            chunks[j].offsets[i] = num_items;
+            num_items += count;
+        }
+        if (num_items > 0) {
+            streams[i] = darray_hold(NULL, num_items, STREAM_ITEM_SIZES[i]);
+        } else {
+            streams[i] = NULL;
+        }
+        for (j = 0; j < num_chunks; j++) {
+            chunks[j].streams[i] = streams[i];
+        }
+    }
+
+    job_parallel_for(parse_chunks, chunks, num_chunks, 1);
+    file_unmap((void*)data, size);
+
+    mesh = build_mesh((vec3_t*)streams[STREAM_POSITION],
+                      (vec2_t*)streams[STREAM_TEXCOORD],
+                      (vec3_t*)streams[STREAM_NORMAL],
+                      (vec4_t*)streams[STREAM_TANGENT],
+                      (vec4_t*)streams[STREAM_JOINT],
+                      (vec4_t*)streams[STREAM_WEIGHT],
+                      (int*)streams[STREAM_POSITION_INDEX],
+                      (int*)streams[STREAM_TEXCOORD_INDEX],
+                      (int*)streams[STREAM_NORMAL_INDEX]);
+    for (i = 0; i < NUM_STREAMS; i++) {
+        darray_free(streams[i]);
+    }
+
+    return mesh;
+}
+
+/* mesh caching */
+
+/*
+ * a binary copy of the mesh written next to the .obj file, it is
+ * memory-mapped on later loads and the mesh points straight into the
+ * mapping, the present vertex streams are stored as they are kept in
+ * memory, followed by the joint bboxes, the meshlets and the indices of
+ * all levels, in native byte order
+ */
+
+#define CACHE_MAGIC 0x4853454D  /* "MESH" */
+#define CACHE_VERSION 9
+
+typedef struct {
+    int magic;
+    int version;
+    stamp_t source;    /* of the file the cache was built from */
+    int num_vertices;
+    int num_indices;
+    int index_size;    /* 2 or 4 bytes */
+    int attribs;       /* mask of the stored vertex streams */
+    int num_meshlets;
+    int num_lods;
+    lod_t lods[MESH_MAX_LODS];
+    vcache_stats_t vcache_stats;
+    vec2_t texcoord_min;
+    vec2_t texcoord_max;
+    bbox_t bbox;
+    vec3_t center;
+    float radius;
+    int num_joints;
+} cache_header_t;
+
+static void get_cache_path(const char *filename, char *cache_path) {
+    const char *extension = private_get_extension(filename);
+    int length = (int)(extension - filename);
+    assert(length + 5 < PATH_SIZE);
+    sprintf(cache_path, "%.*smesh", length, filename);
+}
+
+static int get_cache_size(cache_header_t *header) {
+    int size = sizeof(cache_header_t);
+    int i;
+    for (i = 0; i < NUM_ATTRIBS; i++) {
+        if (header->attribs & (1 << i)) {
+            size += ATTRIB_SIZES[i] * header->num_vertices;
+        }
+    }
+    size += (int)sizeof(bbox_t) * header->num_joints;
+    size += (int)sizeof(meshlet_t) * header->num_meshlets;
+    size += header->index_size * header->num_indices;
+    return size;
+}
+
+static void save_cache(mesh_t *mesh, const char *cache_path,
+                       stamp_t *source) {
+    cache_header_t header;
+    FILE *file;
+    int i;
+
+    file = fopen(cache_path, "wb");
+    if (file == NULL) {
+        return;  /* the asset directory may be read-only */
+    }
+
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.source = *source;
+    header.num_vertices = mesh->num_vertices;
+    header.num_indices = mesh->num_indices;
+    header.index_size = mesh->index_size;
+    header.attribs = 0;
+    for (i = 0; i < NUM_ATTRIBS; i++) {
+        header.attribs |= mesh->streams[i] ? 1 << i : 0;
     }
+    header.num_meshlets = mesh->num_meshlets;
+    header.num_lods = mesh->num_lods;
+    memset(header.lods, 0, sizeof(header.lods));
+    memcpy(header.lods, mesh->lods, sizeof(lod_t) * mesh->num_lods);
+    header.vcache_stats = mesh->vcache_stats;
+    header.texcoord_min = mesh->texcoord_min;
+    header.texcoord_max = mesh->texcoord_max;
+    header.bbox = mesh->bbox;
+    header.center = mesh->center;
+    header.radius = mesh->radius;
+    header.num_joints = mesh->num_joints;
+
+    fwrite(&header, sizeof(cache_header_t), 1, file);
+    for (i = 0; i < NUM_ATTRIBS; i++) {
+        if (mesh->streams[i]) {
+            fwrite(mesh->streams[i], ATTRIB_SIZES[i], mesh->num_vertices,
+                   file);
+        }
+    }
+    fwrite(mesh->joint_bboxes, sizeof(bbox_t), mesh->num_joints, file);
+    fwrite(mesh->meshlets, sizeof(meshlet_t), mesh->num_meshlets, file);
+    fwrite(mesh->indices, mesh->index_size, header.num_indices, file);
     fclose(file);
+}
 
-    mesh = build_mesh(positions, texcoords, normals, tangents, joints, weights,
-                      position_indices, texcoord_indices, normal_indices);
-    darray_free(positions);
-    darray_free(texcoords);
-    darray_free(normals);
-    darray_free(tangents);
-    darray_free(joints);
-    darray_free(weights);
-    darray_free(position_indices);
-    darray_free(texcoord_indices);
-    darray_free(normal_indices);
+static mesh_t *load_cache(const char *cache_path, const char *filename) {
+    cache_header_t *header;
+    mesh_t *mesh;
+    char *data;
+    int size, i;
+
+    data = (char*)file_map(cache_path, &size);
+    if (data == NULL) {
+        return NULL;
+    }
+    header = (cache_header_t*)data;
+    if (size < (int)sizeof(cache_header_t)
+            || header->magic != CACHE_MAGIC
+            || header->version != CACHE_VERSION
+            || size != get_cache_size(header)
+            || !private_check_source(filename, &header->source, cache_path,
+                                     offsetof(cache_header_t, source))) {
+        file_unmap(data, size);
+        return NULL;  /* stale or foreign, will be rebuilt */
+    }
+
+    mesh = (mesh_t*)malloc(sizeof(mesh_t));
+    assert(header->num_lods >= 1 && header->num_lods <= MESH_MAX_LODS);
+    mesh->num_vertices = header->num_vertices;
+    mesh->num_indices = header->num_indices;
+    mesh->index_size = header->index_size;
+    mesh->texcoord_min = header->texcoord_min;
+    mesh->texcoord_max = header->texcoord_max;
+    mesh->bbox = header->bbox;
+    mesh->center = header->center;
+    mesh->radius = header->radius;
+    mesh->num_joints = header->num_joints;
+    mesh->num_meshlets = header->num_meshlets;
+    memcpy(mesh->lods, header->lods, sizeof(lod_t) * header->num_lods);
+    mesh->num_lods = header->num_lods;
+    mesh->num_faces = mesh->lods[0].num_faces;
+    mesh->vcache_stats = header->vcache_stats;
+    mesh->mapping = data;
+    mesh->mapping_size = size;
+
+    data += sizeof(cache_header_t);
+    for (i = 0; i < NUM_ATTRIBS; i++) {
+        if (header->attribs & (1 << i)) {
+            mesh->streams[i] = data;
+            data += ATTRIB_SIZES[i] * header->num_vertices;
+        } else {
+            mesh->streams[i] = NULL;
+        }
+    }
+    assert(mesh->streams[ATTRIB_POSITION] != NULL);
+    mesh->joint_bboxes = header->num_joints ? (bbox_t*)data : NULL;
+    data += sizeof(bbox_t) * header->num_joints;
+    mesh->meshlets = (meshlet_t*)data;
+    data += sizeof(meshlet_t) * header->num_meshlets;
+    mesh->indices = data;
+#ifndef NDEBUG
+    for (i = 0; i < header->num_indices; i++) {
+        int index = mesh_get_index(mesh, i);
+        assert(index >= 0 && index < header->num_vertices);
+    }
+#endif
 
     return mesh;
 }
@@ -173,7 +1113,18 @@ static mesh_t *load_obj(const char *filename) {
 mesh_t *mesh_load(const char *filename) {
     const char *extension = private_get_extension(filename);
     if (strcmp(extension, "obj") == 0) {
-        return load_obj(filename);
+        char cache_path[PATH_SIZE];
+        mesh_t *mesh;
+
+        get_cache_path(filename, cache_path);
+        mesh = load_cache(cache_path, filename);
+        if (mesh == NULL) {
+            stamp_t source;
+            private_stamp_source(filename, &source);
+            mesh = load_obj(filename);
+            save_cache(mesh, cache_path, &source);
+        }
+        return mesh;
     } else {
         assert(0);
         return NULL;
@@ -181,7 +1132,17 @@ mesh_t *mesh_load(const char *filename) {
 }
 
 void mesh_release(mesh_t *mesh) {
-    free(mesh->vertices);
+    if (mesh->mapping) {
+        file_unmap(mesh->mapping, mesh->mapping_size);
+    } else {
+        int i;
+        for (i = 0; i < NUM_ATTRIBS; i++) {
+            free(mesh->streams[i]);
+        }
+        free(mesh->indices);
+        free(mesh->meshlets);
+        free(mesh->joint_bboxes);
+    }
     free(mesh);
 }
 
@@ -191,10 +1152,148 @@ int mesh_get_num_faces(mesh_t *mesh) {
     return mesh->num_faces;
 }
 
-vertex_t *mesh_get_vertices(mesh_t *mesh) {
-    return mesh->vertices;
+int mesh_get_num_vertices(mesh_t *mesh) {
+    return mesh->num_vertices;
+}
+
+/* the vertex index of the nth corner, i.e. face nth / 3 */
+int mesh_get_index(mesh_t *mesh, int nth_index) {
+    if (mesh->index_size == 2) {
+        return ((unsigned short*)mesh->indices)[nth_index];
+    } else {
+        return (int)((unsigned int*)mesh->indices)[nth_index];
+    }
+}
+
+int mesh_has_attrib(mesh_t *mesh, attrib_t attrib) {
+    assert(attrib >= 0 && attrib < NUM_ATTRIBS);
+    return mesh->streams[attrib] != NULL;
+}
+
+vec3_t *mesh_get_positions(mesh_t *mesh) {
+    return (vec3_t*)mesh->streams[ATTRIB_POSITION];
+}
+
+/*
+ * the getters below decode one vertex, absent attributes decode to the
+ * defaults the obj loader used to fill in
+ */
+
+vec2_t mesh_get_texcoord(mesh_t *mesh, int index) {
+    unsigned short *texcoords = (unsigned short*)mesh->streams[ATTRIB_TEXCOORD];
+    if (texcoords) {
+        vec2_t min = mesh->texcoord_min;
+        vec2_t max = mesh->texcoord_max;
+        float u = (float)texcoords[index * 2] / 65535;
+        float v = (float)texcoords[index * 2 + 1] / 65535;
+        return vec2_new(min.x + (max.x - min.x) * u,
+                        min.y + (max.y - min.y) * v);
+    } else {
+        return vec2_new(0, 0);
+    }
+}
+
+vec3_t mesh_get_normal(mesh_t *mesh, int index) {
+    short *normals = (short*)mesh->streams[ATTRIB_NORMAL];
+    if (normals) {
+        vec2_t encoded = vec2_new(dequantize_snorm16(normals[index * 2]),
+                                  dequantize_snorm16(normals[index * 2 + 1]));
+        return decode_octahedral(encoded);
+    } else {
+        return vec3_new(0, 0, 1);
+    }
+}
+
+vec4_t mesh_get_tangent(mesh_t *mesh, int index) {
+    unsigned int *tangents = (unsigned int*)mesh->streams[ATTRIB_TANGENT];
+    if (tangents) {
+        vec4_t tangent = decode_snorm1010102(tangents[index]);
+        vec3_t direction = vec3_normalize(vec3_from_vec4(tangent));
+        return vec4_from_vec3(direction, tangent.w);
+    } else {
+        return vec4_new(1, 0, 0, 1);
+    }
+}
+
+void mesh_get_joint(mesh_t *mesh, int index, int joint[4]) {
+    unsigned char *joints = (unsigned char*)mesh->streams[ATTRIB_JOINT];
+    int i;
+    for (i = 0; i < 4; i++) {
+        joint[i] = joints ? joints[index * 4 + i] : 0;
+    }
+}
+
+vec4_t mesh_get_weight(mesh_t *mesh, int index) {
+    unsigned char *weights = (unsigned char*)mesh->streams[ATTRIB_WEIGHT];
+    if (weights) {
+        unsigned char *weight = weights + index * 4;
+        return vec4_new((float)weight[0] / 255, (float)weight[1] / 255,
+                        (float)weight[2] / 255, (float)weight[3] / 255);
+    } else {
+        return vec4_new(0, 0, 0, 0);
+    }
+}
+
+/* bounding volumes */
+
+bbox_t mesh_get_bbox(mesh_t *mesh) {
+    return mesh->bbox;
 }
 
 vec3_t mesh_get_center(mesh_t *mesh) {
     return mesh->center;
 }
+
+float mesh_get_radius(mesh_t *mesh) {
+    return mesh->radius;
+}
+
+/*
+ * a skinned vertex is a weighted average of its positions moved by each of
+ * its joints, so it stays within the union of the joint bboxes moved by
+ * their joints, joints that move no vertex have an empty (inverted) bbox
+ */
+int mesh_get_num_joints(mesh_t *mesh) {
+    return mesh->num_joints;
+}
+
+bbox_t *mesh_get_joint_bboxes(mesh_t *mesh) {
+    return mesh->joint_bboxes;
+}
+
+/* meshlet retrieving */
+
+int mesh_get_num_meshlets(mesh_t *mesh) {
+    return mesh->num_meshlets;
+}
+
+meshlet_t *mesh_get_meshlets(mesh_t *mesh) {
+    return mesh->meshlets;
+}
+
+/* level of detail */
+
+int mesh_get_num_lods(mesh_t *mesh) {
+    return mesh->num_lods;
+}
+
+lod_t *mesh_get_lod(mesh_t *mesh, int level) {
+    assert(level >= 0 && level < mesh->num_lods);
+    return &mesh->lods[level];
+}
+
+/* the coarsest level whose error is within max_error, in model space */
+int mesh_select_lod(mesh_t *mesh, float max_error) {
+    int level = 0;
+    while (level + 1 < mesh->num_lods
+           && mesh->lods[level + 1].error <= max_error) {
+        level += 1;
+    }
+    return level;
+}
+
+/* vertex cache statistics */
+
+vcache_stats_t mesh_get_vcache_stats(mesh_t *mesh) {
+    return mesh->vcache_stats;
+}
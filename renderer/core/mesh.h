@@ -2,17 +2,40 @@
 #define MESH_H
 
 #include "maths.h"
+#include "meshopt.h"
 
 typedef struct mesh mesh_t;
 
+typedef struct {vec3_t min; vec3_t max;} bbox_t;
+
+#define MESH_MAX_LODS 4
+
+/* a detail level, drawn through its own meshlets, level 0 is the full mesh */
 typedef struct {
-    vec3_t position;  /*顶点坐标*/
-    vec2_t texcoord; /*纹理坐标*/
-    vec3_t normal;   /*法线*/
-    vec4_t tangent; /*切线*/
-    vec4_t joint;    /*关节*/
-    vec4_t weight;  /*骨骼权重*/
-} vertex_t;
+    int first_meshlet;
+    int num_meshlets;
+    int num_faces;
+    float error;  /* distance from the full mesh, in model space */
+} lod_t;
+
+/* post-transform cache statistics of the full mesh, see meshopt.h */
+typedef struct {
+    float input_acmr;  /* in the order of the source */
+    float input_atvr;
+    float acmr;        /* in the stored order */
+    float atvr;
+} vcache_stats_t;
+
+/* vertex streams, only those present in the source are stored */
+typedef enum {
+    ATTRIB_POSITION,  /*顶点坐标, float3*/
+    ATTRIB_TEXCOORD,  /*纹理坐标, unorm16x2 in the uv range*/
+    ATTRIB_NORMAL,    /*法线, octahedral snorm16x2*/
+    ATTRIB_TANGENT,   /*切线, snorm 10:10:10:2*/
+    ATTRIB_JOINT,     /*关节, uint8x4*/
+    ATTRIB_WEIGHT,    /*骨骼权重, unorm8x4*/
+    NUM_ATTRIBS
+} attrib_t;
 
 /* mesh loading/releasing */
 mesh_t *mesh_load(const char *filename);
@@ -20,7 +43,33 @@ void mesh_release(mesh_t *mesh);
 
 /* vertex retrieving */
 int mesh_get_num_faces(mesh_t *mesh);
-vertex_t *mesh_get_vertices(mesh_t *mesh);
+int mesh_get_num_vertices(mesh_t *mesh);
+int mesh_get_index(mesh_t *mesh, int nth_index);
+int mesh_has_attrib(mesh_t *mesh, attrib_t attrib);
+vec3_t *mesh_get_positions(mesh_t *mesh);
+vec2_t mesh_get_texcoord(mesh_t *mesh, int index);
+vec3_t mesh_get_normal(mesh_t *mesh, int index);
+vec4_t mesh_get_tangent(mesh_t *mesh, int index);
+void mesh_get_joint(mesh_t *mesh, int index, int joint[4]);
+vec4_t mesh_get_weight(mesh_t *mesh, int index);
+
+/* bounding volumes, in model space */
+bbox_t mesh_get_bbox(mesh_t *mesh);
 vec3_t mesh_get_center(mesh_t *mesh);
+float mesh_get_radius(mesh_t *mesh);
+int mesh_get_num_joints(mesh_t *mesh);
+bbox_t *mesh_get_joint_bboxes(mesh_t *mesh);
+
+/* meshlet retrieving */
+int mesh_get_num_meshlets(mesh_t *mesh);
+meshlet_t *mesh_get_meshlets(mesh_t *mesh);
+
+/* level of detail */
+int mesh_get_num_lods(mesh_t *mesh);
+lod_t *mesh_get_lod(mesh_t *mesh, int level);
+int mesh_select_lod(mesh_t *mesh, float max_error);
+
+/* vertex cache statistics */
+vcache_stats_t mesh_get_vcache_stats(mesh_t *mesh);
 
 #endif
@@ -0,0 +1,1168 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "macro.h"
+#include "maths.h"
+#include "meshopt.h"
+
+/*
+ * for vertex cache optimization, see
+ * https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+ * the scores assume an lru cache, not the direct-mapped one of the program,
+ * so the callers check the result with meshopt_analyze_vertex_cache
+ */
+
+#define LRU_SIZE (MESHOPT_CACHE_SIZE + 3)
+
+typedef struct {
+    int *offsets;      /* first adjacent triangle of each vertex */
+    int *counts;       /* number of adjacent triangles of each vertex */
+    int *triangles;    /* adjacent triangles, grouped by vertex */
+} adjacency_t;
+
+static void build_adjacency(adjacency_t *adjacency, unsigned int *indices,
+                            int num_indices, int num_vertices) {
+    int *fill;
+    int i;
+
+    adjacency->offsets = (int*)malloc(sizeof(int) * num_vertices);
+    adjacency->counts = (int*)malloc(sizeof(int) * num_vertices);
+    adjacency->triangles = (int*)malloc(sizeof(int) * num_indices);
+    fill = (int*)malloc(sizeof(int) * num_vertices);
+
+    memset(adjacency->counts, 0, sizeof(int) * num_vertices);
+    for (i = 0; i < num_indices; i++) {
+        assert(indices[i] < (unsigned int)num_vertices);
+        adjacency->counts[indices[i]] += 1;
+    }
+    for (i = 0; i < num_vertices; i++) {
+        adjacency->offsets[i] = i == 0 ? 0 : adjacency->offsets[i - 1]
+                                             + adjacency->counts[i - 1];
+        fill[i] = adjacency->offsets[i];
+    }
+    for (i = 0; i < num_indices; i++) {
+        adjacency->triangles[fill[indices[i]]++] = i / 3;
+    }
+    free(fill);
+}
+
+static void free_adjacency(adjacency_t *adjacency) {
+    free(adjacency->offsets);
+    free(adjacency->counts);
+    free(adjacency->triangles);
+}
+
+static float get_vertex_score(int cache_position, int live_triangles) {
+    float score = 0;
+    if (live_triangles == 0) {
+        return -1;  /* no triangle left, the vertex is never needed again */
+    }
+    if (cache_position >= 0) {
+        if (cache_position < 3) {
+            score = 0.75f;  /* used by the last triangle */
+        } else {
+            float scaler = 1.0f / (MESHOPT_CACHE_SIZE - 3);
+            float factor = 1 - (float)(cache_position - 3) * scaler;
+            score = (float)pow(factor, 1.5f);
+        }
+    }
+    /* boost vertices with few triangles left, to finish them off */
+    return score + 2.0f / (float)sqrt((float)live_triangles);
+}
+
+void meshopt_optimize_vertex_cache(unsigned int *indices, int num_indices,
+                                   int num_vertices) {
+    int num_triangles = num_indices / 3;
+    adjacency_t adjacency;
+    int *live_triangles;
+    float *vertex_scores;
+    float *triangle_scores;
+    char *emitted;
+    unsigned int *output;
+    int cache[LRU_SIZE];
+    int cache_size = 0;
+    int input_cursor = 0;
+    int best_triangle = -1;
+    int num_emitted, i, j, k;
+
+    if (num_triangles == 0) {
+        return;
+    }
+    assert(num_triangles * 3 == num_indices);
+
+    build_adjacency(&adjacency, indices, num_indices, num_vertices);
+    live_triangles = (int*)malloc(sizeof(int) * num_vertices);
+    vertex_scores = (float*)malloc(sizeof(float) * num_vertices);
+    triangle_scores = (float*)malloc(sizeof(float) * num_triangles);
+    emitted = (char*)malloc(num_triangles);
+    output = (unsigned int*)malloc(sizeof(unsigned int) * num_indices);
+
+    for (i = 0; i < num_vertices; i++) {
+        live_triangles[i] = adjacency.counts[i];
+        vertex_scores[i] = get_vertex_score(-1, live_triangles[i]);
+    }
+    for (i = 0; i < num_triangles; i++) {
+        triangle_scores[i] = vertex_scores[indices[i * 3 + 0]]
+                             + vertex_scores[indices[i * 3 + 1]]
+                             + vertex_scores[indices[i * 3 + 2]];
+    }
+    memset(emitted, 0, num_triangles);
+
+    for (num_emitted = 0; num_emitted < num_triangles; num_emitted++) {
+        int new_cache[LRU_SIZE];
+        int new_cache_size = 0;
+        float best_score = -1;
+
+        if (best_triangle < 0) {
+            /* nothing useful in the cache, restart from the input order */
+            while (emitted[input_cursor]) {
+                input_cursor += 1;
+            }
+            best_triangle = input_cursor;
+        }
+
+        /* emit the triangle and move its vertices to the front */
+        emitted[best_triangle] = 1;
+        for (j = 0; j < 3; j++) {
+            int vertex = (int)indices[best_triangle * 3 + j];
+            int *triangles = adjacency.triangles + adjacency.offsets[vertex];
+            int count = live_triangles[vertex];
+            output[num_emitted * 3 + j] = (unsigned int)vertex;
+            for (k = 0; k < count; k++) {
+                if (triangles[k] == best_triangle) {
+                    triangles[k] = triangles[count - 1];
+                    triangles[count - 1] = best_triangle;
+                    break;
+                }
+            }
+            live_triangles[vertex] -= 1;
+            new_cache[new_cache_size++] = vertex;
+        }
+        for (j = 0; j < cache_size; j++) {
+            int vertex = cache[j];
+            if (vertex != new_cache[0] && vertex != new_cache[1]
+                    && vertex != new_cache[2]) {
+                new_cache[new_cache_size++] = vertex;
+            }
+        }
+
+        /* update the scores of the vertices in and just out of the cache */
+        for (j = 0; j < new_cache_size; j++) {
+            int vertex = new_cache[j];
+            int position = j < MESHOPT_CACHE_SIZE ? j : -1;
+            int *triangles = adjacency.triangles + adjacency.offsets[vertex];
+            float score = get_vertex_score(position, live_triangles[vertex]);
+            float delta = score - vertex_scores[vertex];
+            vertex_scores[vertex] = score;
+            for (k = 0; k < live_triangles[vertex]; k++) {
+                triangle_scores[triangles[k]] += delta;
+            }
+        }
+
+        /* pick the best triangle among those touching the cache */
+        best_triangle = -1;
+        cache_size = new_cache_size < MESHOPT_CACHE_SIZE
+                     ? new_cache_size : MESHOPT_CACHE_SIZE;
+        for (j = 0; j < cache_size; j++) {
+            int vertex = new_cache[j];
+            int *triangles = adjacency.triangles + adjacency.offsets[vertex];
+            cache[j] = vertex;
+            for (k = 0; k < live_triangles[vertex]; k++) {
+                int triangle = triangles[k];
+                if (triangle_scores[triangle] > best_score) {
+                    best_score = triangle_scores[triangle];
+                    best_triangle = triangle;
+                }
+            }
+        }
+    }
+
+    memcpy(indices, output, sizeof(unsigned int) * num_indices);
+
+    free_adjacency(&adjacency);
+    free(live_triangles);
+    free(vertex_scores);
+    free(triangle_scores);
+    free(emitted);
+    free(output);
+}
+
+/*
+ * for overdraw reduction, see
+ * Fast Triangle Reordering for Vertex Locality and Reduced Overdraw
+ *
+ * the cache-optimized sequence is cut where the cache starts over (a
+ * triangle with three misses), and the resulting clusters are sorted so
+ * that those facing away from the center, which tend to occlude the
+ * others, are drawn first
+ */
+
+typedef struct {
+    int first_triangle;
+    int num_triangles;
+    float sort_key;
+} cluster_t;
+
+static int compare_clusters(const void *cluster1p, const void *cluster2p) {
+    const cluster_t *cluster1 = (const cluster_t*)cluster1p;
+    const cluster_t *cluster2 = (const cluster_t*)cluster2p;
+    if (cluster1->sort_key != cluster2->sort_key) {
+        return cluster1->sort_key > cluster2->sort_key ? -1 : 1;
+    }
+    return cluster1->first_triangle - cluster2->first_triangle;
+}
+
+static vec3_t get_position(vec3_t *positions, int position_stride,
+                           unsigned int index) {
+    char *base = (char*)positions;
+    return *(vec3_t*)(base + (size_t)position_stride * index);
+}
+
+static vec3_t get_face_normal(vec3_t *positions, int position_stride,
+                              unsigned int *triangle) {
+    vec3_t a = get_position(positions, position_stride, triangle[0]);
+    vec3_t b = get_position(positions, position_stride, triangle[1]);
+    vec3_t c = get_position(positions, position_stride, triangle[2]);
+    vec3_t cross = vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+    float length = vec3_length(cross);
+    return length > 0 ? vec3_div(cross, length) : cross;
+}
+
+void meshopt_optimize_overdraw(unsigned int *indices, int num_indices,
+                               vec3_t *positions, int position_stride,
+                               int num_vertices) {
+    int num_triangles = num_indices / 3;
+    int cached[MESHOPT_CACHE_SIZE];
+    cluster_t *clusters;
+    unsigned int *output;
+    vec3_t mesh_center = vec3_new(0, 0, 0);
+    float mesh_area = 0;
+    int num_clusters = 0;
+    int offset = 0;
+    int i, j;
+
+    UNUSED_VAR(num_vertices);
+    if (num_triangles < 2) {
+        return;
+    }
+
+    /* find the hard boundaries with the direct-mapped cache model */
+    clusters = (cluster_t*)malloc(sizeof(cluster_t) * num_triangles);
+    for (i = 0; i < MESHOPT_CACHE_SIZE; i++) {
+        cached[i] = -1;
+    }
+    for (i = 0; i < num_triangles; i++) {
+        int num_misses = 0;
+        for (j = 0; j < 3; j++) {
+            int index = (int)indices[i * 3 + j];
+            int slot = index & (MESHOPT_CACHE_SIZE - 1);
+            assert(index >= 0 && index < num_vertices);
+            if (cached[slot] != index) {
+                cached[slot] = index;
+                num_misses += 1;
+            }
+        }
+        if (i == 0 || num_misses == 3) {
+            clusters[num_clusters].first_triangle = i;
+            clusters[num_clusters].num_triangles = 0;
+            num_clusters += 1;
+        }
+        clusters[num_clusters - 1].num_triangles += 1;
+    }
+    if (num_clusters < 2) {
+        free(clusters);
+        return;
+    }
+
+    /* area-weighted centroid of the whole mesh */
+    for (i = 0; i < num_triangles; i++) {
+        vec3_t a = get_position(positions, position_stride, indices[i * 3]);
+        vec3_t b = get_position(positions, position_stride,
+                                indices[i * 3 + 1]);
+        vec3_t c = get_position(positions, position_stride,
+                                indices[i * 3 + 2]);
+        vec3_t cross = vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+        float area = vec3_length(cross);
+        vec3_t centroid = vec3_div(vec3_add(vec3_add(a, b), c), 3);
+        mesh_center = vec3_add(mesh_center, vec3_mul(centroid, area));
+        mesh_area += area;
+    }
+    if (mesh_area > 0) {
+        mesh_center = vec3_div(mesh_center, mesh_area);
+    }
+
+    /* how much each cluster faces away from the center */
+    for (i = 0; i < num_clusters; i++) {
+        cluster_t *cluster = &clusters[i];
+        vec3_t center = vec3_new(0, 0, 0);
+        vec3_t normal = vec3_new(0, 0, 0);
+        float area_sum = 0;
+        float normal_length;
+        for (j = 0; j < cluster->num_triangles; j++) {
+            int triangle = cluster->first_triangle + j;
+            vec3_t a = get_position(positions, position_stride,
+                                    indices[triangle * 3]);
+            vec3_t b = get_position(positions, position_stride,
+                                    indices[triangle * 3 + 1]);
+            vec3_t c = get_position(positions, position_stride,
+                                    indices[triangle * 3 + 2]);
+            vec3_t cross = vec3_cross(vec3_sub(b, a), vec3_sub(c, a));
+            float area = vec3_length(cross);
+            vec3_t centroid = vec3_div(vec3_add(vec3_add(a, b), c), 3);
+            center = vec3_add(center, vec3_mul(centroid, area));
+            normal = vec3_add(normal, cross);
+            area_sum += area;
+        }
+        if (area_sum > 0) {
+            center = vec3_div(center, area_sum);
+        }
+        normal_length = vec3_length(normal);
+        if (normal_length > 0) {
+            normal = vec3_div(normal, normal_length);
+        }
+        cluster->sort_key = vec3_dot(vec3_sub(center, mesh_center), normal);
+    }
+    qsort(clusters, num_clusters, sizeof(cluster_t), compare_clusters);
+
+    output = (unsigned int*)malloc(sizeof(unsigned int) * num_indices);
+    for (i = 0; i < num_clusters; i++) {
+        int first = clusters[i].first_triangle * 3;
+        int count = clusters[i].num_triangles * 3;
+        memcpy(output + offset, indices + first, sizeof(unsigned int) * count);
+        offset += count;
+    }
+    assert(offset == num_indices);
+    memcpy(indices, output, sizeof(unsigned int) * num_indices);
+
+    free(output);
+    free(clusters);
+}
+
+/*
+ * vertices are renumbered in order of first use, which keeps the fetches
+ * sequential, and also turns the direct-mapped cache of the program into
+ * a fifo cache (each new vertex evicts the one first used 32 vertices ago)
+ */
+void meshopt_optimize_vertex_fetch(void *vertices, int vertex_size,
+                                   int num_vertices, unsigned int *indices,
+                                   int num_indices) {
+    int *remap = (int*)malloc(sizeof(int) * num_vertices);
+    char *source = (char*)vertices;
+    char *target = (char*)malloc((size_t)vertex_size * num_vertices);
+    int next_vertex = 0;
+    int i;
+
+    for (i = 0; i < num_vertices; i++) {
+        remap[i] = -1;
+    }
+    for (i = 0; i < num_indices; i++) {
+        int index = (int)indices[i];
+        if (remap[index] < 0) {
+            remap[index] = next_vertex++;
+            memcpy(target + (size_t)vertex_size * remap[index],
+                   source + (size_t)vertex_size * index, vertex_size);
+        }
+        indices[i] = (unsigned int)remap[index];
+    }
+    /* unreferenced vertices go last */
+    for (i = 0; i < num_vertices; i++) {
+        if (remap[i] < 0) {
+            remap[i] = next_vertex++;
+            memcpy(target + (size_t)vertex_size * remap[i],
+                   source + (size_t)vertex_size * i, vertex_size);
+        }
+    }
+    memcpy(vertices, target, (size_t)vertex_size * num_vertices);
+
+    free(target);
+    free(remap);
+}
+
+/*
+ * for the meshlet bounds, see meshopt_computeClusterBounds in
+ * https://github.com/zeux/meshoptimizer, the sphere holds all vertices and
+ * the cone holds all face normals
+ */
+void meshopt_compute_meshlet_bounds(meshlet_t *meshlet, unsigned int *indices,
+                                    vec3_t *positions, int position_stride) {
+    int num_triangles = meshlet->num_indices / 3;
+    vec3_t bbox_min = vec3_new(+1e6, +1e6, +1e6);
+    vec3_t bbox_max = vec3_new(-1e6, -1e6, -1e6);
+    vec3_t axis = vec3_new(0, 0, 0);
+    float radius = 0;
+    float min_dot = 1;
+    int num_normals = 0;
+    float axis_length;
+    int i;
+
+    for (i = 0; i < meshlet->num_indices; i++) {
+        unsigned int index = indices[meshlet->first_index + i];
+        vec3_t position = get_position(positions, position_stride, index);
+        bbox_min = vec3_min(bbox_min, position);
+        bbox_max = vec3_max(bbox_max, position);
+    }
+    meshlet->center = vec3_div(vec3_add(bbox_min, bbox_max), 2);
+    for (i = 0; i < meshlet->num_indices; i++) {
+        unsigned int index = indices[meshlet->first_index + i];
+        vec3_t position = get_position(positions, position_stride, index);
+        float distance = vec3_length(vec3_sub(position, meshlet->center));
+        radius = float_max(radius, distance);
+    }
+    meshlet->radius = radius;
+
+    for (i = 0; i < num_triangles; i++) {
+        unsigned int *triangle = indices + meshlet->first_index + i * 3;
+        vec3_t normal = get_face_normal(positions, position_stride, triangle);
+        axis = vec3_add(axis, normal);
+    }
+    axis_length = vec3_length(axis);
+    if (axis_length > 0) {
+        axis = vec3_div(axis, axis_length);
+        for (i = 0; i < num_triangles; i++) {
+            unsigned int *triangle = indices + meshlet->first_index + i * 3;
+            vec3_t normal = get_face_normal(positions, position_stride,
+                                            triangle);
+            if (vec3_length(normal) > 0) {
+                min_dot = float_min(min_dot, vec3_dot(normal, axis));
+                num_normals += 1;
+            }
+        }
+    }
+    meshlet->cone_axis = axis;
+    if (num_normals == 0 || min_dot <= 0) {
+        meshlet->cone_cutoff = 1;  /* spans a hemisphere, never culled */
+    } else {
+        meshlet->cone_cutoff = (float)sqrt(1 - min_dot * min_dot);
+    }
+}
+
+/*
+ * meshlets are grown greedily from the first remaining triangle in the
+ * current order, always adding the adjacent triangle that brings the fewest
+ * new vertices and stays closest to the center and normal of the meshlet,
+ * a meshlet past a quarter of max_triangles is closed early rather than
+ * letting its normal cone open wide, which would make it useless for
+ * culling, the triangles of each meshlet keep their relative order, so the
+ * vertex cache and overdraw orders mostly survive
+ */
+
+#define MESHLET_CONE_WEIGHT 2.0f
+#define MESHLET_MIN_DOT 0.8f
+
+static int compare_ints(const void *int1p, const void *int2p) {
+    return *(const int*)int1p - *(const int*)int2p;
+}
+
+/*
+ * vertices split at uv or normal seams share a position, each vertex is
+ * mapped to the first vertex with the same position
+ */
+static int *weld_positions(vec3_t *positions, int position_stride,
+                           int num_vertices) {
+    int *slots, *remap;
+    int num_slots = 1;
+    int i;
+
+    while (num_slots < num_vertices * 2) {
+        num_slots *= 2;
+    }
+    slots = (int*)malloc(sizeof(int) * num_slots);
+    remap = (int*)malloc(sizeof(int) * num_vertices);
+    for (i = 0; i < num_slots; i++) {
+        slots[i] = -1;
+    }
+    for (i = 0; i < num_vertices; i++) {
+        vec3_t position = get_position(positions, position_stride, i);
+        unsigned int hash = 2166136261U;  /* fnv-1a */
+        unsigned char *bytes = (unsigned char*)&position;
+        int slot, j;
+        for (j = 0; j < (int)sizeof(vec3_t); j++) {
+            hash = (hash ^ bytes[j]) * 16777619U;
+        }
+        slot = (int)(hash & (unsigned int)(num_slots - 1));
+        while (slots[slot] >= 0) {
+            vec3_t other = get_position(positions, position_stride,
+                                        slots[slot]);
+            if (memcmp(&other, &position, sizeof(vec3_t)) == 0) {
+                break;
+            }
+            slot = (slot + 1) & (num_slots - 1);
+        }
+        if (slots[slot] < 0) {
+            slots[slot] = i;
+        }
+        remap[i] = slots[slot];
+    }
+
+    free(slots);
+    return remap;
+}
+
+meshlet_t *meshopt_build_meshlets(unsigned int *indices, int num_indices,
+                                  vec3_t *positions, int position_stride,
+                                  int num_vertices, int max_triangles,
+                                  int *num_meshlets) {
+    int num_triangles = num_indices / 3;
+    int min_triangles = max_triangles / 4;
+    adjacency_t adjacency;
+    vec3_t *normals, *centroids;
+    int *emitted, *vertex_stamps, *triangle_stamps;
+    int *candidates, *order, *remap;
+    unsigned int *welded, *output;
+    meshlet_t *meshlets;
+    int count = 0;
+    int next_seed = 0;
+    int num_emitted = 0;
+    int i, j, k;
+
+    assert(max_triangles > 0);
+    remap = weld_positions(positions, position_stride, num_vertices);
+    welded = (unsigned int*)malloc(sizeof(unsigned int) * num_indices);
+    for (i = 0; i < num_indices; i++) {
+        welded[i] = (unsigned int)remap[indices[i]];
+    }
+    free(remap);
+    build_adjacency(&adjacency, welded, num_indices, num_vertices);
+    normals = (vec3_t*)malloc(sizeof(vec3_t) * num_triangles);
+    centroids = (vec3_t*)malloc(sizeof(vec3_t) * num_triangles);
+    emitted = (int*)malloc(sizeof(int) * num_triangles);
+    triangle_stamps = (int*)malloc(sizeof(int) * num_triangles);
+    vertex_stamps = (int*)malloc(sizeof(int) * num_vertices);
+    candidates = (int*)malloc(sizeof(int) * num_triangles);
+    order = (int*)malloc(sizeof(int) * num_triangles);
+    meshlets = (meshlet_t*)malloc(sizeof(meshlet_t) * (num_triangles + 1));
+    for (i = 0; i < num_triangles; i++) {
+        unsigned int *triangle = indices + i * 3;
+        vec3_t a = get_position(positions, position_stride, triangle[0]);
+        vec3_t b = get_position(positions, position_stride, triangle[1]);
+        vec3_t c = get_position(positions, position_stride, triangle[2]);
+        normals[i] = get_face_normal(positions, position_stride, triangle);
+        centroids[i] = vec3_div(vec3_add(vec3_add(a, b), c), 3);
+        emitted[i] = 0;
+        triangle_stamps[i] = -1;
+    }
+    for (i = 0; i < num_vertices; i++) {
+        vertex_stamps[i] = -1;
+    }
+
+    while (num_emitted < num_triangles) {
+        meshlet_t *meshlet = &meshlets[count];
+        vec3_t center_sum = vec3_new(0, 0, 0);
+        vec3_t normal_sum = vec3_new(0, 0, 0);
+        float radius = 0;
+        int num_candidates = 0;
+        int size = 0;
+        int triangle;
+
+        while (emitted[next_seed]) {
+            next_seed += 1;
+        }
+        triangle = next_seed;
+        meshlet->first_index = num_emitted * 3;
+        while (triangle >= 0) {
+            float best_cost = 0;
+            vec3_t center, axis;
+            float axis_length;
+
+            /* add the triangle, its neighbors become candidates */
+            emitted[triangle] = 1;
+            order[num_emitted + size] = triangle;
+            size += 1;
+            center_sum = vec3_add(center_sum, centroids[triangle]);
+            normal_sum = vec3_add(normal_sum, normals[triangle]);
+            for (j = 0; j < 3; j++) {
+                int vertex = (int)welded[triangle * 3 + j];
+                int offset = adjacency.offsets[vertex];
+                vertex_stamps[indices[triangle * 3 + j]] = count;
+                for (k = 0; k < adjacency.counts[vertex]; k++) {
+                    int neighbor = adjacency.triangles[offset + k];
+                    if (!emitted[neighbor]
+                            && triangle_stamps[neighbor] != count) {
+                        triangle_stamps[neighbor] = count;
+                        candidates[num_candidates++] = neighbor;
+                    }
+                }
+            }
+            if (size == max_triangles) {
+                break;
+            }
+
+            /* pick the cheapest candidate, dropping emitted ones */
+            center = vec3_div(center_sum, (float)size);
+            radius = float_max(radius, vec3_length(
+                vec3_sub(centroids[triangle], center)));
+            axis_length = vec3_length(normal_sum);
+            axis = axis_length > 0 ? vec3_div(normal_sum, axis_length)
+                                   : normal_sum;
+            triangle = -1;
+            for (j = 0; j < num_candidates; j++) {
+                int candidate = candidates[j];
+                float distance, dot, cost;
+                int new_vertices = 0;
+                if (emitted[candidate]) {
+                    candidates[j--] = candidates[--num_candidates];
+                    continue;
+                }
+                for (k = 0; k < 3; k++) {
+                    int vertex = (int)indices[candidate * 3 + k];
+                    new_vertices += vertex_stamps[vertex] != count;
+                }
+                dot = vec3_dot(normals[candidate], axis);
+                if (size >= min_triangles && dot < MESHLET_MIN_DOT) {
+                    continue;
+                }
+                distance = vec3_length(vec3_sub(centroids[candidate],
+                                                center));
+                cost = (float)new_vertices
+                       + MESHLET_CONE_WEIGHT * (1 - dot)
+                       + distance / (distance + radius + 1e-6f);
+                if (triangle < 0 || cost < best_cost) {
+                    triangle = candidate;
+                    best_cost = cost;
+                }
+            }
+        }
+
+        qsort(order + num_emitted, size, sizeof(int), compare_ints);
+        meshlet->num_indices = size * 3;
+        num_emitted += size;
+        count += 1;
+    }
+
+    output = (unsigned int*)malloc(sizeof(unsigned int) * num_indices);
+    for (i = 0; i < num_triangles; i++) {
+        memcpy(output + i * 3, indices + order[i] * 3,
+               sizeof(unsigned int) * 3);
+    }
+    memcpy(indices, output, sizeof(unsigned int) * num_indices);
+    for (i = 0; i < count; i++) {
+        meshopt_compute_meshlet_bounds(&meshlets[i], indices,
+                                       positions, position_stride);
+    }
+
+    free(output);
+    free(welded);
+    free(order);
+    free(candidates);
+    free(vertex_stamps);
+    free(triangle_stamps);
+    free(emitted);
+    free(centroids);
+    free(normals);
+    free_adjacency(&adjacency);
+
+    *num_meshlets = count;
+    return meshlets;
+}
+
+/*
+ * for the simplifier, see "Surface Simplification Using Quadric Error
+ * Metrics" by Garland and Heckbert, and meshopt_simplify in
+ * https://github.com/zeux/meshoptimizer, a vertex is always collapsed onto
+ * one of its neighbors instead of an optimal position, so the simplified
+ * index buffers share the vertex streams with the full mesh, a vertex on an
+ * open border only slides along the border, and the two copies of a vertex
+ * on a uv or normal seam slide along the seam together, the error is the
+ * quadric divided by the number of planes it holds, i.e. the squared rms
+ * distance to the planes of the merged triangles
+ */
+
+#define SIMPLIFY_MIN_DOT 0.25f     /* rejects collapses that flip triangles */
+#define SIMPLIFY_EDGE_WEIGHT 4.0f  /* keeps borders and seams in place */
+#define SIMPLIFY_PASS_BOUND 1.5f   /* of the cost that would reach the goal */
+
+typedef enum {
+    KIND_MANIFOLD,  /* moves to any neighbor */
+    KIND_BORDER,    /* moves along the border */
+    KIND_SEAM,      /* moves along the seam, together with its copy */
+    KIND_LOCKED     /* never moves */
+} kind_t;
+
+typedef struct {
+    double xx, xy, xz, yy, yz, zz;
+    double x, y, z;
+    double w;
+    double weight;
+} quadric_t;
+
+typedef struct {
+    int source;
+    int target;
+    float cost;
+} collapse_t;
+
+static void add_plane_quadric(quadric_t *quadric, vec3_t normal,
+                              float distance, float weight) {
+    quadric->xx += weight * normal.x * normal.x;
+    quadric->xy += weight * normal.x * normal.y;
+    quadric->xz += weight * normal.x * normal.z;
+    quadric->yy += weight * normal.y * normal.y;
+    quadric->yz += weight * normal.y * normal.z;
+    quadric->zz += weight * normal.z * normal.z;
+    quadric->x += weight * normal.x * distance;
+    quadric->y += weight * normal.y * distance;
+    quadric->z += weight * normal.z * distance;
+    quadric->w += weight * distance * distance;
+    quadric->weight += weight;
+}
+
+static void add_quadric(quadric_t *quadric, quadric_t *other) {
+    quadric->xx += other->xx;
+    quadric->xy += other->xy;
+    quadric->xz += other->xz;
+    quadric->yy += other->yy;
+    quadric->yz += other->yz;
+    quadric->zz += other->zz;
+    quadric->x += other->x;
+    quadric->y += other->y;
+    quadric->z += other->z;
+    quadric->w += other->w;
+    quadric->weight += other->weight;
+}
+
+static double eval_quadric(quadric_t *quadric, vec3_t p) {
+    double x = p.x, y = p.y, z = p.z;
+    double error = quadric->xx * x * x + quadric->yy * y * y
+                   + quadric->zz * z * z
+                   + 2 * (quadric->xy * x * y + quadric->xz * x * z
+                          + quadric->yz * y * z)
+                   + 2 * (quadric->x * x + quadric->y * y + quadric->z * z)
+                   + quadric->w;
+    return error > 0 ? error : 0;
+}
+
+static float get_collapse_cost(quadric_t *quadric, quadric_t *copy,
+                               vec3_t position) {
+    double error = eval_quadric(quadric, position);
+    double weight = quadric->weight;
+    if (copy != NULL) {
+        error += eval_quadric(copy, position);
+        weight += copy->weight;
+    }
+    return weight > 0 ? (float)(error / weight) : 0;
+}
+
+static int compare_collapses(const void *collapse1p, const void *collapse2p) {
+    const collapse_t *collapse1 = (const collapse_t*)collapse1p;
+    const collapse_t *collapse2 = (const collapse_t*)collapse2p;
+    if (collapse1->cost != collapse2->cost) {
+        return collapse1->cost < collapse2->cost ? -1 : 1;
+    }
+    return collapse1->source - collapse2->source;
+}
+
+/* whether a triangle around the first vertex has the edge to the second */
+static int has_edge(adjacency_t *adjacency, unsigned int *indices,
+                    int from, int to) {
+    int offset = adjacency->offsets[from];
+    int i, k;
+    for (i = 0; i < adjacency->counts[from]; i++) {
+        unsigned int *triangle = indices + adjacency->triangles[offset + i] * 3;
+        for (k = 0; k < 3; k++) {
+            if ((int)triangle[k] == from
+                    && (int)triangle[(k + 1) % 3] == to) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* the same, between any vertices at the two positions */
+static int has_welded_edge(adjacency_t *adjacency, unsigned int *indices,
+                           int *remap, int *wedges, int from, int to) {
+    int copy = from;
+    int i, k;
+    do {
+        int offset = adjacency->offsets[copy];
+        for (i = 0; i < adjacency->counts[copy]; i++) {
+            unsigned int *triangle = indices
+                                     + adjacency->triangles[offset + i] * 3;
+            for (k = 0; k < 3; k++) {
+                if ((int)triangle[k] == copy
+                        && remap[triangle[(k + 1) % 3]] == remap[to]) {
+                    return 1;
+                }
+            }
+        }
+        copy = wedges[copy];
+    } while (copy != from);
+    return 0;
+}
+
+/* the vertex around the given one that sits at the position of another */
+static int find_neighbor(adjacency_t *adjacency, unsigned int *indices,
+                         int *remap, int vertex, int position) {
+    int offset = adjacency->offsets[vertex];
+    int i, k;
+    for (i = 0; i < adjacency->counts[vertex]; i++) {
+        unsigned int *triangle = indices + adjacency->triangles[offset + i] * 3;
+        for (k = 0; k < 3; k++) {
+            if (remap[triangle[k]] == remap[position]) {
+                return (int)triangle[k];
+            }
+        }
+    }
+    return -1;
+}
+
+/*
+ * a border vertex has one open edge in and one out, a seam vertex has two
+ * copies whose triangles close up at the position, each copy having one
+ * seam edge in and one out, anything else is locked
+ */
+static kind_t classify_vertex(adjacency_t *adjacency, unsigned int *indices,
+                              int *remap, int *wedges, int vertex) {
+    int num_copies = 0;
+    int num_borders = 0;
+    int num_seams = 0;
+    int copy = vertex;
+    int i, k;
+
+    do {
+        int offset = adjacency->offsets[copy];
+        for (i = 0; i < adjacency->counts[copy]; i++) {
+            unsigned int *triangle = indices
+                                     + adjacency->triangles[offset + i] * 3;
+            for (k = 0; k < 3; k++) {
+                int next = (int)triangle[(k + 1) % 3];
+                int prev = (int)triangle[(k + 2) % 3];
+                if ((int)triangle[k] != copy) {
+                    continue;
+                }
+                num_borders += !has_welded_edge(adjacency, indices, remap,
+                                                wedges, next, copy);
+                num_borders += !has_welded_edge(adjacency, indices, remap,
+                                                wedges, copy, prev);
+                num_seams += !has_edge(adjacency, indices, next, copy);
+                num_seams += !has_edge(adjacency, indices, copy, prev);
+            }
+        }
+        num_copies += 1;
+        copy = wedges[copy];
+    } while (copy != vertex);
+
+    if (num_copies == 1 && num_borders == 0) {
+        return KIND_MANIFOLD;
+    } else if (num_copies == 1 && num_borders == 2) {
+        return KIND_BORDER;
+    } else if (num_copies == 2 && num_borders == 0 && num_seams == 4) {
+        return KIND_SEAM;
+    } else {
+        return KIND_LOCKED;
+    }
+}
+
+static int is_degenerate(unsigned int *triangle, int *remap) {
+    int a = remap[triangle[0]];
+    int b = remap[triangle[1]];
+    int c = remap[triangle[2]];
+    return a == b || b == c || c == a;
+}
+
+static int collapse_flips(adjacency_t *adjacency, unsigned int *indices,
+                          vec3_t *positions, int position_stride, int *remap,
+                          int source, int target) {
+    int offset = adjacency->offsets[source];
+    int i, k;
+
+    for (i = 0; i < adjacency->counts[source]; i++) {
+        unsigned int *triangle = indices + adjacency->triangles[offset + i] * 3;
+        unsigned int moved[3];
+        vec3_t before, after;
+        if (is_degenerate(triangle, remap)) {
+            continue;
+        }
+        if (triangle[0] == (unsigned int)target
+                || triangle[1] == (unsigned int)target
+                || triangle[2] == (unsigned int)target) {
+            continue;  /* collapsed away */
+        }
+        for (k = 0; k < 3; k++) {
+            moved[k] = triangle[k] == (unsigned int)source
+                       ? (unsigned int)target : triangle[k];
+        }
+        before = get_face_normal(positions, position_stride, triangle);
+        after = get_face_normal(positions, position_stride, moved);
+        if (vec3_length(before) > 0
+                && vec3_dot(before, after) < SIMPLIFY_MIN_DOT) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* returns the number of triangles that became degenerate */
+static int apply_collapse(adjacency_t *adjacency, unsigned int *indices,
+                          int *remap, int source, int target) {
+    int offset = adjacency->offsets[source];
+    int num_removed = 0;
+    int i, k;
+
+    for (i = 0; i < adjacency->counts[source]; i++) {
+        unsigned int *triangle = indices + adjacency->triangles[offset + i] * 3;
+        int was_degenerate = is_degenerate(triangle, remap);
+        for (k = 0; k < 3; k++) {
+            if (triangle[k] == (unsigned int)source) {
+                triangle[k] = (unsigned int)target;
+            }
+        }
+        if (!was_degenerate && is_degenerate(triangle, remap)) {
+            num_removed += 1;
+        }
+    }
+    return num_removed;
+}
+
+static int can_collapse(kind_t *kinds, adjacency_t *adjacency,
+                        unsigned int *indices, int *remap, int *wedges,
+                        int from, int to, int source) {
+    /* the edge runs from -> to in one of the triangles */
+    int target = source == from ? to : from;
+    switch (kinds[source]) {
+        case KIND_MANIFOLD:
+            return 1;
+        case KIND_BORDER:
+            return kinds[target] != KIND_MANIFOLD
+                   && !has_welded_edge(adjacency, indices, remap, wedges,
+                                       to, from);
+        case KIND_SEAM:
+            return kinds[target] != KIND_MANIFOLD
+                   && kinds[target] != KIND_BORDER
+                   && !has_edge(adjacency, indices, to, from);
+        default:
+            return 0;
+    }
+}
+
+int meshopt_simplify(unsigned int *destination, unsigned int *indices,
+                     int num_indices, vec3_t *positions, int position_stride,
+                     int num_vertices, int target_num_indices,
+                     float target_error, float *result_error) {
+    float max_cost = target_error * target_error;
+    float result_cost = 0;
+    adjacency_t adjacency;
+    quadric_t *quadrics;
+    collapse_t *collapses;
+    kind_t *kinds;
+    int *remap, *wedges, *stamps;
+    int bounded = 1;
+    int pass = 0;
+    int i, j, k;
+
+    if (destination != indices) {
+        memcpy(destination, indices, sizeof(unsigned int) * num_indices);
+    }
+    remap = weld_positions(positions, position_stride, num_vertices);
+    wedges = (int*)malloc(sizeof(int) * num_vertices);
+    stamps = (int*)malloc(sizeof(int) * num_vertices);
+    kinds = (kind_t*)malloc(sizeof(kind_t) * num_vertices);
+    quadrics = (quadric_t*)malloc(sizeof(quadric_t) * num_vertices);
+    collapses = (collapse_t*)malloc(sizeof(collapse_t) * num_indices * 2);
+    memset(quadrics, 0, sizeof(quadric_t) * num_vertices);
+
+    /* the referenced vertices at each position form a circular list */
+    for (i = 0; i < num_vertices; i++) {
+        wedges[i] = i;
+        stamps[i] = -1;
+    }
+    for (i = 0; i < num_indices; i++) {
+        int vertex = (int)destination[i];
+        int *first = &stamps[remap[vertex]];
+        if (*first < 0) {
+            *first = vertex;
+        } else if (*first != vertex && wedges[vertex] == vertex) {
+            wedges[vertex] = wedges[*first];
+            wedges[*first] = vertex;
+        }
+    }
+    for (i = 0; i < num_vertices; i++) {
+        stamps[i] = -1;
+    }
+
+    build_adjacency(&adjacency, destination, num_indices, num_vertices);
+    for (i = 0; i < num_vertices; i++) {
+        kinds[i] = classify_vertex(&adjacency, destination, remap, wedges, i);
+    }
+    for (i = 0; i < num_indices; i += 3) {
+        unsigned int *triangle = destination + i;
+        vec3_t normal = get_face_normal(positions, position_stride, triangle);
+        for (k = 0; k < 3; k++) {
+            int from = (int)triangle[k];
+            int to = (int)triangle[(k + 1) % 3];
+            vec3_t p1 = get_position(positions, position_stride, from);
+            vec3_t p2 = get_position(positions, position_stride, to);
+            add_plane_quadric(&quadrics[from], normal, -vec3_dot(normal, p1),
+                              1);
+            if (!has_edge(&adjacency, destination, to, from)) {
+                /* a plane through the border or seam, facing outwards */
+                vec3_t edge = vec3_cross(vec3_sub(p2, p1), normal);
+                float length = vec3_length(edge);
+                if (length > 0) {
+                    edge = vec3_div(edge, length);
+                    add_plane_quadric(&quadrics[from], edge,
+                                      -vec3_dot(edge, p1),
+                                      SIMPLIFY_EDGE_WEIGHT);
+                    add_plane_quadric(&quadrics[to], edge,
+                                      -vec3_dot(edge, p1),
+                                      SIMPLIFY_EDGE_WEIGHT);
+                }
+            }
+        }
+    }
+    free_adjacency(&adjacency);
+
+    while (num_indices > target_num_indices) {
+        int num_triangles = num_indices / 3;
+        int num_collapses = 0;
+        int num_collapsed = 0;
+        int num_removed = 0;
+        int num_kept = 0;
+        int goal = (num_triangles - target_num_indices / 3) / 2;
+        float pass_cost;
+
+        build_adjacency(&adjacency, destination, num_indices, num_vertices);
+        for (i = 0; i < num_indices; i += 3) {
+            for (k = 0; k < 3; k++) {
+                int from = (int)destination[i + k];
+                int to = (int)destination[i + (k + 1) % 3];
+                for (j = 0; j < 2; j++) {
+                    int source = j == 0 ? from : to;
+                    int target = j == 0 ? to : from;
+                    vec3_t position;
+                    float cost;
+                    if (!can_collapse(kinds, &adjacency, destination, remap,
+                                      wedges, from, to, source)) {
+                        continue;
+                    }
+                    position = get_position(positions, position_stride,
+                                            target);
+                    cost = get_collapse_cost(
+                        &quadrics[source], kinds[source] == KIND_SEAM
+                                           ? &quadrics[wedges[source]] : NULL,
+                        position);
+                    if (cost <= max_cost) {
+                        collapses[num_collapses].source = source;
+                        collapses[num_collapses].target = target;
+                        collapses[num_collapses].cost = cost;
+                        num_collapses += 1;
+                    }
+                }
+            }
+        }
+        qsort(collapses, num_collapses, sizeof(collapse_t),
+              compare_collapses);
+        /* a collapse usually removes two triangles */
+        pass_cost = bounded && goal < num_collapses
+                    ? collapses[goal].cost * SIMPLIFY_PASS_BOUND : max_cost;
+
+        /*
+         * each vertex takes part in one collapse per pass, the costlier
+         * collapses wait for the next pass, when the cheaper ones that
+         * were blocked in this pass may have become possible
+         */
+        for (i = 0; i < num_collapses; i++) {
+            int source = collapses[i].source;
+            int target = collapses[i].target;
+            int source_copy = -1;
+            int target_copy = -1;
+            if (collapses[i].cost > pass_cost) {
+                break;
+            }
+            if (stamps[source] == pass || stamps[target] == pass) {
+                continue;
+            }
+            if (kinds[source] == KIND_SEAM) {
+                source_copy = wedges[source];
+                target_copy = find_neighbor(&adjacency, destination, remap,
+                                            source_copy, target);
+                if (target_copy < 0 || stamps[source_copy] == pass
+                        || stamps[target_copy] == pass) {
+                    continue;
+                }
+            }
+            if (collapse_flips(&adjacency, destination, positions,
+                               position_stride, remap, source, target)) {
+                continue;
+            }
+            if (source_copy >= 0
+                    && collapse_flips(&adjacency, destination, positions,
+                                      position_stride, remap,
+                                      source_copy, target_copy)) {
+                continue;
+            }
+            num_removed += apply_collapse(&adjacency, destination, remap,
+                                          source, target);
+            add_quadric(&quadrics[target], &quadrics[source]);
+            stamps[source] = pass;
+            stamps[target] = pass;
+            if (source_copy >= 0) {
+                num_removed += apply_collapse(&adjacency, destination, remap,
+                                              source_copy, target_copy);
+                add_quadric(&quadrics[target_copy], &quadrics[source_copy]);
+                stamps[source_copy] = pass;
+                stamps[target_copy] = pass;
+            }
+            result_cost = float_max(result_cost, collapses[i].cost);
+            num_collapsed += 1;
+            if ((num_triangles - num_removed) * 3 <= target_num_indices) {
+                break;
+            }
+        }
+        free_adjacency(&adjacency);
+
+        for (i = 0; i < num_indices; i += 3) {
+            if (!is_degenerate(destination + i, remap)) {
+                memmove(destination + num_kept, destination + i,
+                        sizeof(unsigned int) * 3);
+                num_kept += 3;
+            }
+        }
+        num_indices = num_kept;
+        pass += 1;
+        if (num_collapsed == 0) {
+            if (pass_cost >= max_cost) {
+                break;
+            }
+            bounded = 0;  /* the cheap collapses are all blocked */
+        } else {
+            bounded = 1;
+        }
+    }
+
+    free(collapses);
+    free(quadrics);
+    free(kinds);
+    free(stamps);
+    free(wedges);
+    free(remap);
+
+    *result_error = (float)sqrt(result_cost);
+    return num_indices;
+}
+
+/*
+ * acmr is the average number of vertex shader invocations per triangle,
+ * atvr is that per vertex, i.e. 1 means every vertex is shaded only once
+ */
+void meshopt_analyze_vertex_cache(unsigned int *indices, int num_indices,
+                                  int num_vertices, float *acmr, float *atvr) {
+    int cached[MESHOPT_CACHE_SIZE];
+    int num_misses = 0;
+    int i;
+
+    for (i = 0; i < MESHOPT_CACHE_SIZE; i++) {
+        cached[i] = -1;
+    }
+    for (i = 0; i < num_indices; i++) {
+        int index = (int)indices[i];
+        int slot = index & (MESHOPT_CACHE_SIZE - 1);
+        if (cached[slot] != index) {
+            cached[slot] = index;
+            num_misses += 1;
+        }
+    }
+    *acmr = num_indices > 0 ? (float)num_misses / (float)(num_indices / 3) : 0;
+    *atvr = num_vertices > 0 ? (float)num_misses / (float)num_vertices : 0;
+}
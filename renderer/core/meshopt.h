@@ -0,0 +1,52 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include "maths.h"
+
+/*
+ * the size of the direct-mapped vertex cache of the program, the triangle
+ * reordering scores vertices with an lru cache of this size instead, which
+ * only approximates it, the statistics use the direct-mapped model
+ */
+#define MESHOPT_CACHE_SIZE 32
+
+typedef struct {
+    int first_index;
+    int num_indices;
+    vec3_t center;       /* bounding sphere */
+    float radius;
+    vec3_t cone_axis;    /* normal cone */
+    float cone_cutoff;
+} meshlet_t;
+
+/* triangle reordering */
+void meshopt_optimize_vertex_cache(unsigned int *indices, int num_indices,
+                                   int num_vertices);
+void meshopt_optimize_overdraw(unsigned int *indices, int num_indices,
+                               vec3_t *positions, int position_stride,
+                               int num_vertices);
+
+/* vertex reordering */
+void meshopt_optimize_vertex_fetch(void *vertices, int vertex_size,
+                                   int num_vertices, unsigned int *indices,
+                                   int num_indices);
+
+/* clustering */
+meshlet_t *meshopt_build_meshlets(unsigned int *indices, int num_indices,
+                                  vec3_t *positions, int position_stride,
+                                  int num_vertices, int max_triangles,
+                                  int *num_meshlets);
+void meshopt_compute_meshlet_bounds(meshlet_t *meshlet, unsigned int *indices,
+                                    vec3_t *positions, int position_stride);
+
+/* simplification */
+int meshopt_simplify(unsigned int *destination, unsigned int *indices,
+                     int num_indices, vec3_t *positions, int position_stride,
+                     int num_vertices, int target_num_indices,
+                     float target_error, float *result_error);
+
+/* statistics */
+void meshopt_analyze_vertex_cache(unsigned int *indices, int num_indices,
+                                  int num_vertices, float *acmr, float *atvr);
+
+#endif
@@ -4,6 +4,10 @@
 #include "graphics.h"
 
 typedef struct window window_t;
+typedef struct thread thread_t;
+typedef struct mutex mutex_t;
+typedef struct condition condition_t;
+typedef void threadfunc_t(void *userdata);
 typedef enum {KEY_A, KEY_D, KEY_S, KEY_W, KEY_SPACE, KEY_NUM} keycode_t;
 typedef enum {BUTTON_L, BUTTON_R, BUTTON_NUM} button_t;
 typedef struct {
@@ -31,7 +35,30 @@ int input_button_pressed(window_t *window, button_t button);
 void input_query_cursor(window_t *window, float *xpos, float *ypos);
 void input_set_callbacks(window_t *window, callbacks_t callbacks);
 
+/* thread related functions */
+thread_t *thread_create(threadfunc_t *threadfunc, void *userdata);
+void thread_join(thread_t *thread);
+int thread_set_affinity(thread_t *thread, int core);
+void thread_set_local(void *value);
+void *thread_get_local(void);
+
+/* synchronization functions */
+mutex_t *mutex_create(void);
+void mutex_destroy(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+condition_t *condition_create(void);
+void condition_destroy(condition_t *condition);
+void condition_wait(condition_t *condition, mutex_t *mutex);
+void condition_broadcast(condition_t *condition);
+
+/* file mapping functions */
+void *file_map(const char *filename, int *size);
+void file_unmap(void *data, int size);
+int file_get_status(const char *filename, long *size, double *mtime);
+
 /* misc platform functions */
 float platform_get_time(void);
+int platform_get_num_cores(void);
 
 #endif
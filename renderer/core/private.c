@@ -1,7 +1,10 @@
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 #include "graphics.h"
 #include "image.h"
+#include "platform.h"
+#include "private.h"
 
 /* framebuffer blitting */
 
@@ -49,9 +52,72 @@ void private_blit_rgb(framebuffer_t *src, image_t *dst) {
     }
 }
 
+/* source stamping */
+
+/*
+ * caches keep the size, modification time and hash of the file they were
+ * built from, the contents are only hashed again when the time changed,
+ * e.g. after a checkout, and if they did not the cache gets the new time
+ */
+
+void private_stamp_source(const char *filename, stamp_t *stamp) {
+    long size;
+    double mtime;
+    int exists = file_get_status(filename, &size, &mtime);
+    assert(exists);
+    stamp->size = (int)size;
+    stamp->hash = private_get_file_hash(filename);
+    stamp->mtime = mtime;
+}
+
+int private_check_source(const char *filename, const stamp_t *stamp,
+                         const char *cache_path, long stamp_offset) {
+    long size;
+    double mtime;
+    if (!file_get_status(filename, &size, &mtime)
+            || (int)size != stamp->size) {
+        return 0;
+    }
+    if (mtime != stamp->mtime) {
+        stamp_t touched = *stamp;
+        FILE *file;
+        if (private_get_file_hash(filename) != stamp->hash) {
+            return 0;
+        }
+        touched.mtime = mtime;
+        file = fopen(cache_path, "r+b");
+        if (file != NULL) {  /* the asset directory may be read-only */
+            fseek(file, stamp_offset, SEEK_SET);
+            fwrite(&touched, sizeof(stamp_t), 1, file);
+            fclose(file);
+        }
+    }
+    return 1;
+}
+
 /* misc functions */
 
 const char *private_get_extension(const char *filename) {
     const char *dot_pos = strrchr(filename, '.');
     return dot_pos == NULL ? "" : dot_pos + 1;
 }
+
+/*
+ * 32-bit fnv-1a over the contents, for telling when a cached file is stale
+ * even if its source kept the same size, see
+ * http://www.isthe.com/chongo/tech/comp/fnv/
+ */
+unsigned int private_get_file_hash(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    unsigned long hash = 2166136261UL;
+    unsigned char buffer[4096];
+    size_t count, i;
+    assert(file != NULL);
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (i = 0; i < count; i++) {
+            hash = ((hash ^ buffer[i]) * 16777619UL) & 0xFFFFFFFFUL;
+        }
+    }
+    fclose(file);
+    return (unsigned int)hash;
+}
@@ -8,7 +8,18 @@
 void private_blit_bgr(framebuffer_t *source, image_t *target);
 void private_blit_rgb(framebuffer_t *source, image_t *target);
 
+/* source stamping */
+typedef struct {
+    int size;
+    unsigned int hash;
+    double mtime;
+} stamp_t;
+void private_stamp_source(const char *filename, stamp_t *stamp);
+int private_check_source(const char *filename, const stamp_t *stamp,
+                         const char *cache_path, long stamp_offset);
+
 /* misc functions */
 const char *private_get_extension(const char *filename);
+unsigned int private_get_file_hash(const char *filename);
 
 #endif
@@ -1,4 +1,8 @@
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include "bvh.h"
+#include "culling.h"
 #include "darray.h"
 #include "graphics.h"
 #include "maths.h"
@@ -7,6 +11,10 @@
 #include "skeleton.h"
 #include "texture.h"
 
+#define ANIM_LOD_SIZE 0.25f  /* of the screen height, halved per level */
+#define ANIM_MAX_LOD 3
+#define CULLED_PERIOD 0.25f  /* seconds between poses of culled models */
+
 scene_t *scene_create(vec3_t background, model_t *skybox, model_t **models,
                       float ambient_intensity, float punctual_intensity,
                       int shadow_width, int shadow_height) {
@@ -18,11 +26,13 @@ scene_t *scene_create(vec3_t background, model_t *skybox, model_t **models,
     scene->punctual_intensity = punctual_intensity;
     if (shadow_width > 0 && shadow_height > 0) {
         scene->shadow_buffer = framebuffer_create(shadow_width, shadow_height);
-        scene->shadow_map = texture_create(shadow_width, shadow_height);
+        scene->shadow_map = depthmap_from_depthbuffer(scene->shadow_buffer);
     } else {
         scene->shadow_buffer = NULL;
         scene->shadow_map = NULL;
     }
+    scene->shadow_filter = SHADOW_FILTER_2X2;
+    scene->bvh = NULL;
     return scene;
 }
 
@@ -38,11 +48,400 @@ void scene_release(scene_t *scene) {
         model->release(model);
     }
     darray_free(scene->models);
+    if (scene->shadow_map) {
+        depthmap_release(scene->shadow_map);
+    }
     if (scene->shadow_buffer) {
         framebuffer_release(scene->shadow_buffer);
     }
-    if (scene->shadow_map) {
-        texture_release(scene->shadow_map);
+    if (scene->bvh) {
+        bvh_release(scene->bvh);
     }
     free(scene);
 }
+
+/* animation */
+
+/*
+ * the level of detail of a pose follows the size on the screen of the
+ * bounds of the last frame, models outside of the camera frustum and of
+ * the light frustum keep their pose, which is still refreshed now and
+ * then at the coarsest level so that their bounds can catch up
+ */
+static int select_anim_lod(model_t *model, perframe_t *perframe,
+                           frustum_t *frustums, int num_frustums) {
+    vec4_t world_pos = vec4_from_vec3(model->world_center, 1);
+    vec4_t view_pos;
+    float distance, size;
+    int lod = 0;
+    int i;
+
+    if (model->pose_time < 0) {
+        return 0;  /* no bounds yet */
+    }
+    for (i = 0; i < num_frustums; i++) {
+        if (!frustum_cull_sphere(&frustums[i], model->world_center,
+                                 model->world_radius)) {
+            break;
+        }
+    }
+    if (i == num_frustums) {
+        float elapsed = perframe->frame_time - model->pose_time;
+        return elapsed >= 0 && elapsed < CULLED_PERIOD ? -1 : ANIM_MAX_LOD;
+    }
+
+    view_pos = mat4_mul_vec4(perframe->camera_view_matrix, world_pos);
+    distance = -view_pos.z;
+    if (distance <= model->world_radius) {
+        return 0;
+    }
+    size = model->world_radius * perframe->camera_proj_matrix.m[1][1]
+           / distance;
+    while (lod < ANIM_MAX_LOD && size < ANIM_LOD_SIZE / (float)(1 << lod)) {
+        lod += 1;
+    }
+    return lod;
+}
+
+/*
+ * picks the level of detail of each skeleton, the finest one among the
+ * models sharing it, then evaluates the skeletons at full detail ahead of
+ * the model updates, each once however many models share it, the updates
+ * find those poses already cached and evaluate the coarser ones lazily
+ */
+void scene_update_skeletons(scene_t *scene, perframe_t *perframe) {
+    int num_models = darray_size(scene->models);
+    skeleton_t **skeletons;
+    int *lods;
+    int *slots;
+    frustum_t frustums[2];
+    int num_frustums = 1;
+    int num_skeletons = 0;
+    int num_evaluated = 0;
+    int i, j;
+
+    frustums[0] = frustum_from_matrix(
+        mat4_mul_mat4(perframe->camera_proj_matrix,
+                      perframe->camera_view_matrix));
+    if (scene->shadow_buffer && scene->shadow_map) {
+        frustums[num_frustums++] = frustum_from_matrix(
+            mat4_mul_mat4(perframe->light_proj_matrix,
+                          perframe->light_view_matrix));
+    }
+
+    skeletons = (skeleton_t**)malloc(sizeof(skeleton_t*) * num_models);
+    lods = (int*)malloc(sizeof(int) * num_models);
+    slots = (int*)malloc(sizeof(int) * num_models);
+    for (i = 0; i < num_models; i++) {
+        model_t *model = scene->models[i];
+        int lod;
+        if (model->skeleton == NULL) {
+            continue;
+        }
+        lod = select_anim_lod(model, perframe, frustums, num_frustums);
+        for (j = 0; j < num_skeletons; j++) {
+            if (skeletons[j] == model->skeleton) {
+                break;
+            }
+        }
+        if (j == num_skeletons) {
+            skeletons[num_skeletons++] = model->skeleton;
+            lods[j] = lod;
+        } else if (lods[j] < 0 || (lod >= 0 && lod < lods[j])) {
+            lods[j] = lod;
+        }
+        slots[i] = j;
+    }
+    for (i = 0; i < num_models; i++) {
+        model_t *model = scene->models[i];
+        if (model->skeleton != NULL) {
+            model->anim_lod = lods[slots[i]];
+            if (model->anim_lod >= 0) {
+                model->pose_time = perframe->frame_time;
+            }
+        }
+    }
+
+    for (i = 0; i < num_skeletons; i++) {
+        if (lods[i] == 0) {
+            skeletons[num_evaluated++] = skeletons[i];
+        }
+    }
+    skeleton_update_batch(skeletons, num_evaluated, perframe->frame_time);
+    free(skeletons);
+    free(lods);
+    free(slots);
+}
+
+/*
+ * lets the skeleton know how far its joints reach into the mesh of the
+ * model, for collapsing the small ones at coarse levels of detail, the
+ * joint a model is attached to reaches as far as the whole mesh
+ */
+void model_set_joint_extents(model_t *model) {
+    skeleton_t *skeleton = model->skeleton;
+    mesh_t *mesh = model->mesh;
+
+    if (skeleton == NULL) {
+        return;
+    } else if (model->attached >= 0) {
+        bbox_t bbox = mesh_get_bbox(mesh);
+        float extent = vec3_length(vec3_sub(bbox.max, bbox.min));
+        skeleton_set_extent(skeleton, model->attached, extent);
+    } else {
+        int num_joints = mesh_get_num_joints(mesh);
+        bbox_t *joint_bboxes = mesh_get_joint_bboxes(mesh);
+        int i;
+        for (i = 0; i < num_joints; i++) {
+            bbox_t bbox = joint_bboxes[i];
+            if (bbox.min.x <= bbox.max.x) {
+                float extent = vec3_length(vec3_sub(bbox.max, bbox.min));
+                skeleton_set_extent(skeleton, i, extent);
+            }
+        }
+    }
+}
+
+/* spatial queries */
+
+/*
+ * the models must have updated their world bounds, the bvh is built on
+ * first use and refitted afterwards, which costs nothing when no model has
+ * moved, it is rebuilt when animated models have drifted apart far enough
+ * to make the refitted tree loose
+ */
+void scene_update_bvh(scene_t *scene) {
+    int num_models = darray_size(scene->models);
+    bbox_t *bboxes = (bbox_t*)malloc(sizeof(bbox_t) * num_models);
+    int i;
+
+    for (i = 0; i < num_models; i++) {
+        bboxes[i] = scene->models[i]->world_bbox;
+    }
+    if (scene->bvh == NULL || bvh_refit(scene->bvh, bboxes)) {
+        if (scene->bvh) {
+            bvh_release(scene->bvh);
+        }
+        scene->bvh = bvh_create(bboxes, num_models);
+    }
+    free(bboxes);
+}
+
+/*
+ * writes the models whose world bounds intersect the frustum, the bvh
+ * tests their bboxes, their spheres are tested afterwards, returns the
+ * number of written models, the output must hold all of the models
+ */
+int scene_cull_models(scene_t *scene, frustum_t *frustum, model_t **models) {
+    int num_models = darray_size(scene->models);
+    int *items = (int*)malloc(sizeof(int) * num_models);
+    int num_items = bvh_cull(scene->bvh, frustum, items);
+    int num_visible = 0;
+    int i;
+
+    for (i = 0; i < num_items; i++) {
+        model_t *model = scene->models[items[i]];
+        if (!frustum_cull_sphere(frustum, model->world_center,
+                                 model->world_radius)) {
+            models[num_visible++] = model;
+        }
+    }
+    free(items);
+    return num_visible;
+}
+
+typedef struct {
+    scene_t *scene;
+    vec3_t origin;
+    vec3_t direction;
+} ray_t;
+
+static int intersect_sphere(vec3_t origin, vec3_t direction,
+                            vec3_t center, float radius) {
+    vec3_t offset = vec3_sub(center, origin);
+    float length2 = vec3_dot(direction, direction);
+    float t = float_max(vec3_dot(offset, direction) / length2, 0);
+    vec3_t closest = vec3_sub(vec3_mul(direction, t), offset);
+    return vec3_dot(closest, closest) <= radius * radius;
+}
+
+/* see "Fast, Minimum Storage Ray/Triangle Intersection" by Moller */
+static float intersect_triangle(vec3_t origin, vec3_t direction,
+                                vec3_t a, vec3_t b, vec3_t c) {
+    vec3_t edge1 = vec3_sub(b, a);
+    vec3_t edge2 = vec3_sub(c, a);
+    vec3_t pvec = vec3_cross(direction, edge2);
+    float det = vec3_dot(edge1, pvec);
+    vec3_t tvec, qvec;
+    float u, v;
+
+    if ((float)fabs(det) < 1e-12f) {
+        return -1;
+    }
+    tvec = vec3_sub(origin, a);
+    u = vec3_dot(tvec, pvec) / det;
+    if (u < 0 || u > 1) {
+        return -1;
+    }
+    qvec = vec3_cross(tvec, edge1);
+    v = vec3_dot(direction, qvec) / det;
+    if (v < 0 || u + v > 1) {
+        return -1;
+    }
+    return vec3_dot(edge2, qvec) / det;
+}
+
+/*
+ * rigid models are hit against the faces of their full mesh, the ray is
+ * taken to model space, which keeps its parameter, and meshlets it misses
+ * are skipped, skinned models are hit against their bbox
+ */
+static float intersect_model(void *userdata, int item, float box_distance) {
+    ray_t *ray = (ray_t*)userdata;
+    model_t *model = ray->scene->models[item];
+    mesh_t *mesh = model->mesh;
+    vec3_t *positions = mesh_get_positions(mesh);
+    lod_t *lod = mesh_get_lod(mesh, 0);
+    meshlet_t *meshlets = mesh_get_meshlets(mesh) + lod->first_meshlet;
+    mat4_t inverse;
+    vec3_t origin, direction;
+    float closest = -1;
+    int i, j;
+
+    if (!model->bounds_valid) {
+        return box_distance;
+    }
+    inverse = mat4_inverse(model->world_matrix);
+    origin = vec3_from_vec4(mat4_mul_vec4(inverse,
+                                          vec4_from_vec3(ray->origin, 1)));
+    direction = vec3_from_vec4(mat4_mul_vec4(inverse,
+                                             vec4_from_vec3(ray->direction,
+                                                            0)));
+    for (i = 0; i < lod->num_meshlets; i++) {
+        meshlet_t *meshlet = &meshlets[i];
+        if (!intersect_sphere(origin, direction,
+                              meshlet->center, meshlet->radius)) {
+            continue;
+        }
+        for (j = 0; j < meshlet->num_indices; j += 3) {
+            int first = meshlet->first_index + j;
+            vec3_t a = positions[mesh_get_index(mesh, first + 0)];
+            vec3_t b = positions[mesh_get_index(mesh, first + 1)];
+            vec3_t c = positions[mesh_get_index(mesh, first + 2)];
+            float t = intersect_triangle(origin, direction, a, b, c);
+            if (t >= 0 && (closest < 0 || t < closest)) {
+                closest = t;
+            }
+        }
+    }
+    return closest;
+}
+
+/*
+ * returns the model nearest along the ray, or NULL, the distance is in
+ * units of the direction length, scene_update_bvh must have been called
+ */
+model_t *scene_pick_model(scene_t *scene, vec3_t origin, vec3_t direction,
+                          float *distance) {
+    ray_t ray;
+    int item;
+
+    ray.scene = scene;
+    ray.origin = origin;
+    ray.direction = direction;
+    item = bvh_raycast(scene->bvh, origin, direction, intersect_model, &ray,
+                       distance);
+    return item >= 0 ? scene->models[item] : NULL;
+}
+
+/* model bounds */
+
+/* see "Transforming Axis-Aligned Bounding Boxes" by Arvo */
+static bbox_t transform_bbox(mat4_t matrix, bbox_t bbox) {
+    vec3_t center = vec3_div(vec3_add(bbox.min, bbox.max), 2);
+    vec3_t extent = vec3_div(vec3_sub(bbox.max, bbox.min), 2);
+    float local_extent[3];
+    float world_extent[3];
+    vec4_t world_center;
+    bbox_t result;
+    int i, j;
+
+    local_extent[0] = extent.x;
+    local_extent[1] = extent.y;
+    local_extent[2] = extent.z;
+    for (i = 0; i < 3; i++) {
+        world_extent[i] = 0;
+        for (j = 0; j < 3; j++) {
+            world_extent[i] += (float)fabs(matrix.m[i][j]) * local_extent[j];
+        }
+    }
+    extent = vec3_new(world_extent[0], world_extent[1], world_extent[2]);
+    world_center = mat4_mul_vec4(matrix, vec4_from_vec3(center, 1));
+    center = vec3_from_vec4(world_center);
+    result.min = vec3_sub(center, extent);
+    result.max = vec3_add(center, extent);
+    return result;
+}
+
+static float get_max_scale(mat4_t matrix) {
+    float max_scale = 0;
+    int i;
+    for (i = 0; i < 3; i++) {
+        vec3_t axis = vec3_new(matrix.m[0][i], matrix.m[1][i],
+                               matrix.m[2][i]);
+        max_scale = float_max(max_scale, vec3_length(axis));
+    }
+    return max_scale;
+}
+
+/*
+ * the world bounds are derived from the bounds of the mesh, for rigid
+ * models they are recomputed only when the model matrix (the transform,
+ * times the joint matrix for attached models) differs from the one they
+ * were cached for, skinned models move every frame, their bbox is the
+ * union of the joint bboxes of the mesh, and their sphere encloses it
+ */
+void model_update_bounds(model_t *model, mat4_t model_matrix,
+                         mat4_t *joint_matrices) {
+    mesh_t *mesh = model->mesh;
+    int num_joints = mesh_get_num_joints(mesh);
+
+    if (joint_matrices && num_joints > 0) {
+        bbox_t *joint_bboxes = mesh_get_joint_bboxes(mesh);
+        bbox_t bbox;
+        vec3_t half_size;
+        int i;
+
+        bbox.min = vec3_new(+1e6, +1e6, +1e6);
+        bbox.max = vec3_new(-1e6, -1e6, -1e6);
+        for (i = 0; i < num_joints; i++) {
+            if (joint_bboxes[i].min.x <= joint_bboxes[i].max.x) {
+                mat4_t matrix = mat4_mul_mat4(model_matrix,
+                                              joint_matrices[i]);
+                bbox_t joint_bbox = transform_bbox(matrix, joint_bboxes[i]);
+                bbox.min = vec3_min(bbox.min, joint_bbox.min);
+                bbox.max = vec3_max(bbox.max, joint_bbox.max);
+            }
+        }
+        half_size = vec3_div(vec3_sub(bbox.max, bbox.min), 2);
+        model->world_bbox = bbox;
+        model->world_center = vec3_add(bbox.min, half_size);
+        model->world_radius = vec3_length(half_size);
+        model->world_scale = get_max_scale(model_matrix);
+        model->bounds_valid = 0;  /* never reused */
+    } else {
+        if (model->bounds_valid
+                && memcmp(&model->world_matrix, &model_matrix,
+                          sizeof(mat4_t)) == 0) {
+            return;
+        }
+        model->world_matrix = model_matrix;
+        model->world_scale = get_max_scale(model_matrix);
+        model->world_bbox = transform_bbox(model_matrix, mesh_get_bbox(mesh));
+        /* the sphere shares the bbox center */
+        model->world_center = vec3_div(vec3_add(model->world_bbox.min,
+                                                model->world_bbox.max), 2);
+        model->world_radius = mesh_get_radius(mesh) * model->world_scale;
+        model->bounds_valid = 1;
+    }
+}
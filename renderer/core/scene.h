@@ -1,10 +1,13 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include "bvh.h"
+#include "culling.h"
 #include "graphics.h"
 #include "maths.h"
 #include "mesh.h"
 #include "skeleton.h"
+#include "skinning.h"
 #include "texture.h"
 
 typedef struct {
@@ -18,8 +21,12 @@ typedef struct {
     mat4_t camera_proj_matrix;
     float ambient_intensity;
     float punctual_intensity;
-    texture_t *shadow_map;
+    depthmap_t *shadow_map;
+    shadow_filter_t shadow_filter;
     int layer_view;
+    /* statistics, filled in while drawing */
+    int num_culled;         /* models outside the camera frustum */
+    int num_shadow_culled;  /* models outside the light frustum */
 } perframe_t;  /*这是 【当前帧】的各种场景*/
 
 typedef struct model {
@@ -29,9 +36,21 @@ typedef struct model {
     /* for animation */
     skeleton_t *skeleton;
     int attached;
+    skin_t *skin;  /* NULL unless the mesh follows the skeleton */
     /* for sorting */
     int opaque;
     float distance;
+    /* for level of detail */
+    int lod;
+    int anim_lod;     /* -1 while culled, the last pose is kept */
+    float pose_time;  /* frame time of the last pose, -1 before any */
+    /* world bounds, cached for world_matrix */
+    mat4_t world_matrix;
+    bbox_t world_bbox;
+    vec3_t world_center;
+    float world_radius;
+    float world_scale;  /* largest axis scale, ignoring skinning */
+    int bounds_valid;
     /* polymorphism */
     void (*update)(struct model *model, perframe_t *perframe);
     void (*draw)(struct model *model, framebuffer_t *framebuffer,
@@ -48,7 +67,10 @@ typedef struct {
     float punctual_intensity;
     /* shadow mapping */
     framebuffer_t *shadow_buffer;
-    texture_t *shadow_map;
+    depthmap_t *shadow_map;
+    shadow_filter_t shadow_filter;
+    /* over the world bboxes of the models, in the order of models */
+    bvh_t *bvh;
 } scene_t;
 
 scene_t *scene_create(vec3_t background, model_t *skybox, model_t **models,
@@ -56,4 +78,18 @@ scene_t *scene_create(vec3_t background, model_t *skybox, model_t **models,
                       int shadow_width, int shadow_height);
 void scene_release(scene_t *scene);
 
+/* animation */
+void scene_update_skeletons(scene_t *scene, perframe_t *perframe);
+void model_set_joint_extents(model_t *model);
+
+/* spatial queries */
+void scene_update_bvh(scene_t *scene);
+int scene_cull_models(scene_t *scene, frustum_t *frustum, model_t **models);
+model_t *scene_pick_model(scene_t *scene, vec3_t origin, vec3_t direction,
+                          float *distance);
+
+/* model bounds */
+void model_update_bounds(model_t *model, mat4_t model_matrix,
+                         mat4_t *joint_matrices);
+
 #endif
@@ -1,10 +1,13 @@
 #include <assert.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "job.h"
 #include "macro.h"
 #include "maths.h"
+#include "platform.h"
 #include "private.h"
 #include "skeleton.h"
 
@@ -13,40 +16,149 @@
  * https://people.rennes.inria.fr/Ludovic.Hoyet/teaching/IMO/05_IMO2016_Skinning.pdf
  */
 
+/* the version also stands for the tolerances, bump it when they change */
+#define CLIP_MAGIC 0x50494C43  /* "CLIP" */
+#define CLIP_VERSION 5
+
+#define CLIP_TOLERANCE 5e-4f  /* of the skeleton size */
+#define MIN_REACH 0.05f       /* of the skeleton size */
+
+#define MAX_CODE 65535           /* of translations and scales */
+#define MAX_ROTATION_CODE 32767  /* the top bits hold the largest index */
+#define ROTATION_RANGE 0.70710678f
+
+#define UNIFORM_TOLERANCE 1e-5f  /* relative, of scales and axis lengths */
+
+#define NUM_POSES 8
+#define POSE_RATE 1000  /* poses are keyed by the time in milliseconds */
+
+#define NUM_LODS 4
+#define LOD_RATE 15.0f     /* poses per second at level 1, halved after */
+#define LOD_EXTENT 0.02f   /* of the largest extent at level 1, doubled */
+
+#define BAKE_MAGIC 0x454B4142  /* "BAKE" */
+#define BAKE_VERSION 2
+#define BAKE_SNAP 1e-3f  /* of a frame, nearer times index the table */
+
+#define BATCH_JOINTS 512  /* of the skeletons evaluated per job */
+
+#if defined(SKELETON_NO_SIMD)
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define SKELETON_SSE2
+#endif
+
+enum {TRANSLATION, ROTATION, SCALE, NUM_CHANNELS};
+
+typedef unsigned short code_t[3];
+
+/*
+ * the keys of a channel are stored back to back for all the joints, each
+ * track owns a range of them, and remembers the key found last time
+ */
+typedef struct {
+    int first_key;
+    int num_keys;
+    int cursor;
+    vec3_t offset;  /* dequantization of translations and scales */
+    vec3_t step;
+} track_t;
+
 typedef struct {
-    int joint_index;
     int parent_index;
+    int uniform_scale;  /* no non-uniform scale down to the joint */
     mat4_t inverse_bind;
-    /* translations */
-    int num_translations;
-    float *translation_times;
-    vec3_t *translation_values;
-    /* rotations */
-    int num_rotations;
-    float *rotation_times;
-    quat_t *rotation_values;
-    /* scales */
-    int num_scales;
-    float *scale_times;
-    vec3_t *scale_values;
-    /* interpolated */
-    mat4_t transform;
+    track_t tracks[NUM_CHANNELS];
 } joint_t;
 
+typedef struct {
+    float *times;
+    code_t *values;
+} keys_t;
+
+/*
+ * baked palettes are a header followed by the joint matrices and then the
+ * normal matrices of each frame, in native byte order, the frames sample
+ * the clip from time 0 up to the end at a fixed rate
+ */
+typedef struct {
+    int magic;
+    int version;
+    int clip_version;  /* of the clip, to tell stale tables */
+    int source_size;
+    unsigned int source_hash;
+    int num_joints;
+    int frame_rate;
+    int num_frames;
+} bake_header_t;
+
+typedef struct {
+    int tick;                 /* -1 for an unused pose */
+    int lod;
+    int last_used;
+    mat4_t *transforms;       /* of the joints, in the skeleton space */
+    mat4_t *joint_matrices;   /* transforms times inverse binds */
+    mat3_t *normal_matrices;
+} pose_t;
+
 struct skeleton {
     float min_time;
     float max_time;
     int num_joints;
     joint_t *joints;
-    /* cached result */
-    mat4_t *joint_matrices;
-    mat3_t *normal_matrices;
-    float last_time;
+    /* keyframes of all joints, inside the clip */
+    keys_t keys[NUM_CHANNELS];
+    void *clip;
+    int clip_size;
+    int clip_mapped;
+    /* joints sorted by depth, the levels are ranges of the order */
+    int num_levels;
+    int *order;
+    int *level_offsets;
+    /* how far the joints reach into the meshes, for level of detail */
+    float *extents;
+    float max_extent;
+    int *targets;  /* the joint standing in for each joint, per level */
+    int targets_dirty;
+    /* local transforms, sampled before being converted in batches */
+    vec3_t *translations;
+    quat_t *rotations;
+    vec3_t *scales;
+    /* recently evaluated poses */
+    pose_t poses[NUM_POSES];
+    pose_t *pose;
+    int clock;
+    /* baked palettes, NULL unless baked */
+    bake_header_t *bake;
+    int bake_size;
+    int bake_mapped;
+    pose_t baked_pose;  /* points into the table */
 };
 
-/* skeleton loading/releasing */
+/* clip parsing */
+
+typedef struct {
+    int num_keys;
+    float *times;
+    vec4_t *values;  /* w is unused by translations and scales */
+    int num_kept;    /* keys left by the curve reduction */
+    int *kept;
+} source_track_t;
+
+typedef struct {
+    int parent_index;
+    mat4_t inverse_bind;
+    source_track_t tracks[NUM_CHANNELS];
+} source_joint_t;
 
-static void read_inverse_bind(FILE *file, joint_t *joint) {
+typedef struct {
+    float min_time;
+    float max_time;
+    int num_joints;
+    source_joint_t *joints;
+} source_t;
+
+static void read_inverse_bind(FILE *file, source_joint_t *joint) {
     char line[LINE_SIZE];
     int items;
     int i;
@@ -63,287 +175,1350 @@ static void read_inverse_bind(FILE *file, joint_t *joint) {
     UNUSED_VAR(items);
 }
 
-static void read_translations(FILE *file, joint_t *joint) {
+static void read_track(FILE *file, const char *name, int num_components,
+                       source_track_t *track) {
+    char format[LINE_SIZE];
     int items;
     int i;
-    items = fscanf(file, " translations %d:", &joint->num_translations);
-    assert(items == 1 && joint->num_translations >= 0);
-    if (joint->num_translations > 0) {
-        int time_size = sizeof(float) * joint->num_translations;
-        int value_size = sizeof(vec3_t) * joint->num_translations;
-        joint->translation_times = (float*)malloc(time_size);
-        joint->translation_values = (vec3_t*)malloc(value_size);
-        for (i = 0; i < joint->num_translations; i++) {
+
+    sprintf(format, " %s %%d:", name);
+    items = fscanf(file, format, &track->num_keys);
+    assert(items == 1 && track->num_keys >= 0);
+    track->times = (float*)malloc(sizeof(float) * track->num_keys);
+    track->values = (vec4_t*)malloc(sizeof(vec4_t) * track->num_keys);
+    track->num_kept = 0;
+    track->kept = (int*)malloc(sizeof(int) * track->num_keys);
+    for (i = 0; i < track->num_keys; i++) {
+        vec4_t *value = &track->values[i];
+        if (num_components == 3) {
             items = fscanf(file, " time: %f, value: [%f, %f, %f]",
-                           &joint->translation_times[i],
-                           &joint->translation_values[i].x,
-                           &joint->translation_values[i].y,
-                           &joint->translation_values[i].z);
-            assert(items == 4);
+                           &track->times[i],
+                           &value->x, &value->y, &value->z);
+            value->w = 0;
+        } else {
+            items = fscanf(file, " time: %f, value: [%f, %f, %f, %f]",
+                           &track->times[i],
+                           &value->x, &value->y, &value->z, &value->w);
         }
-    } else {
-        joint->translation_times = NULL;
-        joint->translation_values = NULL;
+        assert(items == num_components + 1);
     }
     UNUSED_VAR(items);
 }
 
-static void read_rotations(FILE *file, joint_t *joint) {
+static void read_source(const char *filename, source_t *source) {
+    FILE *file;
     int items;
     int i;
-    items = fscanf(file, " rotations %d:", &joint->num_rotations);
-    assert(items == 1 && joint->num_rotations >= 0);
-    if (joint->num_rotations > 0) {
-        int time_size = sizeof(float) * joint->num_rotations;
-        int value_size = sizeof(quat_t) * joint->num_rotations;
-        joint->rotation_times = (float*)malloc(time_size);
-        joint->rotation_values = (quat_t*)malloc(value_size);
-        for (i = 0; i < joint->num_rotations; i++) {
-            items = fscanf(file, " time: %f, value: [%f, %f, %f, %f]",
-                           &joint->rotation_times[i],
-                           &joint->rotation_values[i].x,
-                           &joint->rotation_values[i].y,
-                           &joint->rotation_values[i].z,
-                           &joint->rotation_values[i].w);
-            assert(items == 5);
+
+    file = fopen(filename, "rb");
+    assert(file != NULL);
+
+    items = fscanf(file, " joint-size: %d", &source->num_joints);
+    assert(items == 1 && source->num_joints > 0);
+    items = fscanf(file, " time-range: [%f, %f]",
+                   &source->min_time, &source->max_time);
+    assert(items == 2 && source->min_time < source->max_time);
+
+    source->joints = (source_joint_t*)malloc(sizeof(source_joint_t)
+                                             * source->num_joints);
+    for (i = 0; i < source->num_joints; i++) {
+        source_joint_t *joint = &source->joints[i];
+        int joint_index;
+
+        items = fscanf(file, " joint %d:", &joint_index);
+        assert(items == 1 && joint_index == i);
+        items = fscanf(file, " parent-index: %d", &joint->parent_index);
+        assert(items == 1 && joint->parent_index < i);
+
+        read_inverse_bind(file, joint);
+        read_track(file, "translations", 3, &joint->tracks[TRANSLATION]);
+        read_track(file, "rotations", 4, &joint->tracks[ROTATION]);
+        read_track(file, "scales", 3, &joint->tracks[SCALE]);
+    }
+
+    fclose(file);
+    UNUSED_VAR(items);
+}
+
+static void release_source(source_t *source) {
+    int i, c;
+    for (i = 0; i < source->num_joints; i++) {
+        for (c = 0; c < NUM_CHANNELS; c++) {
+            source_track_t *track = &source->joints[i].tracks[c];
+            free(track->times);
+            free(track->values);
+            free(track->kept);
         }
+    }
+    free(source->joints);
+}
+
+/* clip compression */
+
+typedef float key_error_t(source_track_t *track, int first, int last,
+                          int key);
+
+static float get_factor(source_track_t *track, int first, int last,
+                        int key) {
+    float duration = track->times[last] - track->times[first];
+    if (duration > 0) {
+        return (track->times[key] - track->times[first]) / duration;
     } else {
-        joint->rotation_times = NULL;
-        joint->rotation_values = NULL;
+        return 0;
     }
-    UNUSED_VAR(items);
 }
 
-static void read_scales(FILE *file, joint_t *joint) {
-    int items;
+static float get_vector_error(source_track_t *track, int first, int last,
+                              int key) {
+    vec3_t a = vec3_from_vec4(track->values[first]);
+    vec3_t b = vec3_from_vec4(track->values[last]);
+    vec3_t value = vec3_from_vec4(track->values[key]);
+    float t = get_factor(track, first, last, key);
+    return vec3_length(vec3_sub(vec3_lerp(a, b, t), value));
+}
+
+/* the angle between the interpolated rotation and the key */
+static float get_rotation_error(source_track_t *track, int first, int last,
+                                int key) {
+    vec4_t a = track->values[first];
+    vec4_t b = track->values[last];
+    vec4_t value = track->values[key];
+    float t = get_factor(track, first, last, key);
+    quat_t q = quat_slerp(quat_new(a.x, a.y, a.z, a.w),
+                          quat_new(b.x, b.y, b.z, b.w), t);
+    float sign = quat_dot(q, quat_new(value.x, value.y, value.z,
+                                      value.w)) < 0 ? -1.0f : 1.0f;
+    float dx = q.x - value.x * sign;
+    float dy = q.y - value.y * sign;
+    float dz = q.z - value.z * sign;
+    float dw = q.w - value.w * sign;
+    float distance = (float)sqrt(dx * dx + dy * dy + dz * dz + dw * dw);
+    return 4 * (float)asin(float_min(distance / 2, 1));
+}
+
+static int can_skip(source_track_t *track, key_error_t *get_error,
+                    float tolerance, int first, int last) {
     int i;
-    items = fscanf(file, " scales %d:", &joint->num_scales);
-    assert(items == 1 && joint->num_scales >= 0);
-    if (joint->num_scales > 0) {
-        int time_size = sizeof(float) * joint->num_scales;
-        int value_size = sizeof(vec3_t) * joint->num_scales;
-        joint->scale_times = (float*)malloc(time_size);
-        joint->scale_values = (vec3_t*)malloc(value_size);
-        for (i = 0; i < joint->num_scales; i++) {
-            items = fscanf(file, " time: %f, value: [%f, %f, %f]",
-                           &joint->scale_times[i],
-                           &joint->scale_values[i].x,
-                           &joint->scale_values[i].y,
-                           &joint->scale_values[i].z);
-            assert(items == 4);
+    for (i = first + 1; i < last; i++) {
+        if (get_error(track, first, last, i) > tolerance) {
+            return 0;
         }
-    } else {
-        joint->scale_times = NULL;
-        joint->scale_values = NULL;
     }
-    UNUSED_VAR(items);
+    return 1;
 }
 
-static joint_t load_joint(FILE *file) {
-    joint_t joint;
-    int items;
+/*
+ * error-bounded curve reduction, from each kept key the next one kept is
+ * the farthest key such that interpolating between the two reproduces
+ * every key in between within the tolerance, a track that never leaves the
+ * tolerance of its first key is reduced to that key
+ */
+static void reduce_track(source_track_t *track, key_error_t *get_error,
+                         float tolerance) {
+    int first = 0;
+    int i;
 
-    items = fscanf(file, " joint %d:", &joint.joint_index);
-    assert(items == 1);
-    items = fscanf(file, " parent-index: %d", &joint.parent_index);
-    assert(items == 1);
+    track->num_kept = 0;
+    if (track->num_keys == 0) {
+        return;
+    }
+    track->kept[track->num_kept++] = 0;
+    for (i = 1; i < track->num_keys; i++) {
+        if (get_error(track, 0, 0, i) > tolerance) {
+            break;
+        }
+    }
+    if (i == track->num_keys) {
+        return;
+    }
 
-    read_inverse_bind(file, &joint);
-    read_translations(file, &joint);
-    read_rotations(file, &joint);
-    read_scales(file, &joint);
+    while (first < track->num_keys - 1) {
+        int last = first + 1;
+        while (last + 1 < track->num_keys
+               && can_skip(track, get_error, tolerance, first, last + 1)) {
+            last += 1;
+        }
+        track->kept[track->num_kept++] = last;
+        first = last;
+    }
+}
 
-    UNUSED_VAR(items);
-    return joint;
+/*
+ * the reach of a joint is the distance to its farthest descendant in the
+ * bind pose, a rotation or scale error of the joint is magnified by it,
+ * the errors of all channels along a chain add up at its leaf, so each
+ * channel gets an even share of the tolerance of the longest chain
+ */
+static float get_tolerance(source_t *source, float *reaches) {
+    int num_joints = source->num_joints;
+    vec3_t *positions = (vec3_t*)malloc(sizeof(vec3_t) * num_joints);
+    vec3_t min = vec3_new(+1e6, +1e6, +1e6);
+    vec3_t max = vec3_new(-1e6, -1e6, -1e6);
+    int max_depth = 0;
+    float size;
+    int i, parent;
+
+    for (i = 0; i < num_joints; i++) {
+        mat4_t bind = mat4_inverse(source->joints[i].inverse_bind);
+        positions[i] = vec3_new(bind.m[0][3], bind.m[1][3], bind.m[2][3]);
+        min = vec3_min(min, positions[i]);
+        max = vec3_max(max, positions[i]);
+        reaches[i] = 0;
+    }
+    size = vec3_length(vec3_sub(max, min));
+    size = size > 0 ? size : 1;
+
+    for (i = 0; i < num_joints; i++) {
+        int depth = 1;
+        parent = source->joints[i].parent_index;
+        while (parent >= 0) {
+            float distance = vec3_length(vec3_sub(positions[i],
+                                                  positions[parent]));
+            reaches[parent] = float_max(reaches[parent], distance);
+            parent = source->joints[parent].parent_index;
+            depth += 1;
+        }
+        max_depth = depth > max_depth ? depth : max_depth;
+    }
+    for (i = 0; i < num_joints; i++) {
+        reaches[i] = float_max(reaches[i], size * MIN_REACH);
+    }
+
+    free(positions);
+    return size * CLIP_TOLERANCE / (float)(max_depth * NUM_CHANNELS);
 }
 
-static void initialize_cache(skeleton_t *skeleton) {
-    int joint_matrix_size = sizeof(mat4_t) * skeleton->num_joints;
-    int normal_matrix_size = sizeof(mat3_t) * skeleton->num_joints;
-    skeleton->joint_matrices = (mat4_t*)malloc(joint_matrix_size);
-    skeleton->normal_matrices = (mat3_t*)malloc(normal_matrix_size);
-    memset(skeleton->joint_matrices, 0, joint_matrix_size);
-    memset(skeleton->normal_matrices, 0, normal_matrix_size);
-    skeleton->last_time = -1;
+static unsigned short quantize(float value, float offset, float step,
+                               int max_code) {
+    float code = step > 0 ? (value - offset) / step : 0;
+    return (unsigned short)float_clamp(code + 0.5f, 0, (float)max_code);
 }
 
-static skeleton_t *load_ani(const char *filename) {
-    skeleton_t *skeleton;
-    FILE *file;
-    int items;
+/*
+ * smallest three, the largest component is dropped and rebuilt from the
+ * unit length, its index is kept in the top bits of the first two codes,
+ * see "Animation Compression" by Frykholm
+ */
+static void encode_rotation(vec4_t rotation, code_t code) {
+    quat_t q = quat_normalize(quat_new(rotation.x, rotation.y, rotation.z,
+                                       rotation.w));
+    float components[4];
+    float step = 2 * ROTATION_RANGE / MAX_ROTATION_CODE;
+    float sign;
+    int largest = 0;
+    int i, j;
+
+    components[0] = q.x;
+    components[1] = q.y;
+    components[2] = q.z;
+    components[3] = q.w;
+    for (i = 1; i < 4; i++) {
+        if (fabs(components[i]) > fabs(components[largest])) {
+            largest = i;
+        }
+    }
+    sign = components[largest] < 0 ? -1.0f : 1.0f;
+    for (i = 0, j = 0; i < 4; i++) {
+        if (i != largest) {
+            code[j++] = quantize(components[i] * sign, -ROTATION_RANGE, step,
+                                 MAX_ROTATION_CODE);
+        }
+    }
+    code[0] |= (unsigned short)((largest & 1) << 15);
+    code[1] |= (unsigned short)((largest >> 1) << 15);
+}
+
+static quat_t decode_rotation(code_t code) {
+    int largest = (code[0] >> 15) | ((code[1] >> 15) << 1);
+    float step = 2 * ROTATION_RANGE / MAX_ROTATION_CODE;
+    float components[4];
+    float length2 = 0;
+    int i, j;
+
+    for (i = 0, j = 0; i < 4; i++) {
+        if (i != largest) {
+            int bits = code[j++] & MAX_ROTATION_CODE;
+            components[i] = bits * step - ROTATION_RANGE;
+            length2 += components[i] * components[i];
+        }
+    }
+    components[largest] = (float)sqrt(float_max(1 - length2, 0));
+    return quat_new(components[0], components[1], components[2],
+                    components[3]);
+}
+
+static vec3_t decode_vector(track_t *track, code_t code) {
+    return vec3_new(track->offset.x + code[0] * track->step.x,
+                    track->offset.y + code[1] * track->step.y,
+                    track->offset.z + code[2] * track->step.z);
+}
+
+/* translations and scales are quantized to the bounds of their track */
+static void encode_track(source_track_t *source, int channel, track_t *track,
+                         keys_t *keys) {
+    float *times = keys->times + track->first_key;
+    code_t *values = keys->values + track->first_key;
+    vec3_t min = vec3_new(+1e6, +1e6, +1e6);
+    vec3_t max = vec3_new(-1e6, -1e6, -1e6);
     int i;
 
-    skeleton = (skeleton_t*)malloc(sizeof(skeleton_t));
+    for (i = 0; i < source->num_kept; i++) {
+        vec3_t value = vec3_from_vec4(source->values[source->kept[i]]);
+        min = vec3_min(min, value);
+        max = vec3_max(max, value);
+    }
+    if (channel == ROTATION || source->num_kept == 0) {
+        track->offset = vec3_new(0, 0, 0);
+        track->step = vec3_new(0, 0, 0);
+    } else {
+        track->offset = min;
+        track->step = vec3_div(vec3_sub(max, min), MAX_CODE);
+    }
 
-    file = fopen(filename, "rb");
-    assert(file != NULL);
+    for (i = 0; i < source->num_kept; i++) {
+        int key = source->kept[i];
+        vec4_t value = source->values[key];
+        times[i] = source->times[key];
+        if (channel == ROTATION) {
+            encode_rotation(value, values[i]);
+        } else {
+            values[i][0] = quantize(value.x, min.x, track->step.x, MAX_CODE);
+            values[i][1] = quantize(value.y, min.y, track->step.y, MAX_CODE);
+            values[i][2] = quantize(value.z, min.z, track->step.z, MAX_CODE);
+        }
+    }
+}
 
-    items = fscanf(file, " joint-size: %d", &skeleton->num_joints);
-    assert(items == 1 && skeleton->num_joints > 0);
-    items = fscanf(file, " time-range: [%f, %f]",
-                   &skeleton->min_time, &skeleton->max_time);
-    assert(items == 2 && skeleton->min_time < skeleton->max_time);
+static int is_similar(float a, float b) {
+    float scale = float_max((float)fabs(a), (float)fabs(b));
+    return fabs(a - b) <= scale * UNIFORM_TOLERANCE;
+}
 
-    skeleton->joints = (joint_t*)malloc(sizeof(joint_t) * skeleton->num_joints);
-    for (i = 0; i < skeleton->num_joints; i++) {
-        joint_t joint = load_joint(file);
-        assert(joint.joint_index == i);
-        skeleton->joints[i] = joint;
+static int has_uniform_scales(source_track_t *track) {
+    int i;
+    for (i = 0; i < track->num_keys; i++) {
+        vec4_t scale = track->values[i];
+        if (!is_similar(scale.x, scale.y) || !is_similar(scale.x, scale.z)) {
+            return 0;
+        }
     }
+    return 1;
+}
+
+/* whether the axes are orthogonal and of the same length */
+static int has_uniform_axes(mat4_t matrix) {
+    vec3_t x = vec3_new(matrix.m[0][0], matrix.m[1][0], matrix.m[2][0]);
+    vec3_t y = vec3_new(matrix.m[0][1], matrix.m[1][1], matrix.m[2][1]);
+    vec3_t z = vec3_new(matrix.m[0][2], matrix.m[1][2], matrix.m[2][2]);
+    float length2 = vec3_dot(x, x);
+    return is_similar(length2, vec3_dot(y, y))
+           && is_similar(length2, vec3_dot(z, z))
+           && is_similar(length2 + vec3_dot(x, y), length2)
+           && is_similar(length2 + vec3_dot(y, z), length2)
+           && is_similar(length2 + vec3_dot(z, x), length2);
+}
+
+/* clip caching */
+
+/*
+ * a compressed copy of the animation written next to the .ani file, the
+ * joints are stored as they are kept in memory, followed by the times and
+ * values of each channel, in native byte order, the keys are sampled
+ * straight from the memory-mapped file
+ */
 
+typedef struct {
+    int magic;
+    int version;
+    stamp_t source;  /* of the file the clip was built from */
+    int num_joints;
+    float min_time;
+    float max_time;
+    int num_keys[NUM_CHANNELS];
+} clip_header_t;
+
+/* the values are padded so that the times after them stay aligned */
+static int get_values_size(int num_keys) {
+    return ((int)sizeof(code_t) * num_keys + 3) & ~3;
+}
+
+static int get_clip_size(clip_header_t *header) {
+    int size = sizeof(clip_header_t);
+    int c;
+    size += (int)sizeof(joint_t) * header->num_joints;
+    for (c = 0; c < NUM_CHANNELS; c++) {
+        size += (int)sizeof(float) * header->num_keys[c];
+        size += get_values_size(header->num_keys[c]);
+    }
+    return size;
+}
+
+static joint_t *locate_keys(clip_header_t *header, keys_t *keys) {
+    char *data = (char*)header + sizeof(clip_header_t);
+    joint_t *joints = (joint_t*)data;
+    int c;
+    data += sizeof(joint_t) * header->num_joints;
+    for (c = 0; c < NUM_CHANNELS; c++) {
+        keys[c].times = (float*)data;
+        data += sizeof(float) * header->num_keys[c];
+        keys[c].values = (code_t*)data;
+        data += get_values_size(header->num_keys[c]);
+    }
+    return joints;
+}
+
+static clip_header_t *build_clip(source_t *source, stamp_t *stamp) {
+    float *reaches = (float*)malloc(sizeof(float) * source->num_joints);
+    float tolerance = get_tolerance(source, reaches);
+    clip_header_t header;
+    clip_header_t *clip;
+    keys_t keys[NUM_CHANNELS];
+    joint_t *joints;
+    int i, c;
+
+    header.magic = CLIP_MAGIC;
+    header.version = CLIP_VERSION;
+    header.source = *stamp;
+    header.num_joints = source->num_joints;
+    header.min_time = source->min_time;
+    header.max_time = source->max_time;
+    for (c = 0; c < NUM_CHANNELS; c++) {
+        header.num_keys[c] = 0;
+    }
+    for (i = 0; i < source->num_joints; i++) {
+        source_track_t *tracks = source->joints[i].tracks;
+        reduce_track(&tracks[TRANSLATION], get_vector_error, tolerance);
+        reduce_track(&tracks[ROTATION], get_rotation_error,
+                     tolerance / reaches[i]);
+        reduce_track(&tracks[SCALE], get_vector_error,
+                     tolerance / reaches[i]);
+        for (c = 0; c < NUM_CHANNELS; c++) {
+            header.num_keys[c] += tracks[c].num_kept;
+        }
+    }
+
+    clip = (clip_header_t*)malloc(get_clip_size(&header));
+    *clip = header;
+    joints = locate_keys(clip, keys);
+    for (c = 0; c < NUM_CHANNELS; c++) {
+        header.num_keys[c] = 0;
+    }
+    for (i = 0; i < source->num_joints; i++) {
+        source_joint_t *source_joint = &source->joints[i];
+        joint_t *joint = &joints[i];
+        memset(joint, 0, sizeof(joint_t));
+        joint->parent_index = source_joint->parent_index;
+        joint->uniform_scale =
+            has_uniform_scales(&source_joint->tracks[SCALE])
+            && has_uniform_axes(source_joint->inverse_bind)
+            && (joint->parent_index < 0
+                || joints[joint->parent_index].uniform_scale);
+        joint->inverse_bind = source_joint->inverse_bind;
+        for (c = 0; c < NUM_CHANNELS; c++) {
+            track_t *track = &joint->tracks[c];
+            track->first_key = header.num_keys[c];
+            track->num_keys = source_joint->tracks[c].num_kept;
+            encode_track(&source_joint->tracks[c], c, track, &keys[c]);
+            header.num_keys[c] += track->num_keys;
+        }
+    }
+
+    free(reaches);
+    return clip;
+}
+
+static void save_clip(clip_header_t *clip, const char *clip_path) {
+    FILE *file = fopen(clip_path, "wb");
+    if (file == NULL) {
+        return;  /* the asset directory may be read-only */
+    }
+    fwrite(clip, get_clip_size(clip), 1, file);
     fclose(file);
+}
 
-    initialize_cache(skeleton);
+static void get_clip_path(const char *filename, char *clip_path) {
+    const char *extension = private_get_extension(filename);
+    int length = (int)(extension - filename);
+    assert(length + 5 < PATH_SIZE);
+    sprintf(clip_path, "%.*sclip", length, filename);
+}
+
+/* skeleton loading/releasing */
+
+static void initialize_poses(skeleton_t *skeleton) {
+    int num_joints = skeleton->num_joints;
+    int i;
+    for (i = 0; i < NUM_POSES; i++) {
+        pose_t *pose = &skeleton->poses[i];
+        pose->tick = -1;
+        pose->lod = 0;
+        pose->last_used = 0;
+        pose->transforms = (mat4_t*)malloc(sizeof(mat4_t) * num_joints);
+        pose->joint_matrices = (mat4_t*)malloc(sizeof(mat4_t) * num_joints);
+        pose->normal_matrices = (mat3_t*)malloc(sizeof(mat3_t) * num_joints);
+        memset(pose->joint_matrices, 0, sizeof(mat4_t) * num_joints);
+        memset(pose->normal_matrices, 0, sizeof(mat3_t) * num_joints);
+    }
+    skeleton->pose = &skeleton->poses[0];
+    skeleton->clock = 0;
+    skeleton->bake = NULL;
+}
+
+/*
+ * sorts the joints by depth with a counting sort, the joints of a level
+ * keep their clip order and depend only on the levels before them
+ */
+static void initialize_levels(skeleton_t *skeleton) {
+    int num_joints = skeleton->num_joints;
+    int *depths = (int*)malloc(sizeof(int) * num_joints);
+    int *counts;
+    int num_levels = 0;
+    int i;
+
+    for (i = 0; i < num_joints; i++) {
+        int parent_index = skeleton->joints[i].parent_index;
+        depths[i] = parent_index < 0 ? 0 : depths[parent_index] + 1;
+        if (depths[i] + 1 > num_levels) {
+            num_levels = depths[i] + 1;
+        }
+    }
+    counts = (int*)malloc(sizeof(int) * (num_levels + 1));
+    memset(counts, 0, sizeof(int) * (num_levels + 1));
+    for (i = 0; i < num_joints; i++) {
+        counts[depths[i] + 1] += 1;
+    }
+    for (i = 0; i < num_levels; i++) {
+        counts[i + 1] += counts[i];
+    }
+
+    skeleton->num_levels = num_levels;
+    skeleton->order = (int*)malloc(sizeof(int) * num_joints);
+    skeleton->level_offsets = (int*)malloc(sizeof(int) * (num_levels + 1));
+    memcpy(skeleton->level_offsets, counts, sizeof(int) * (num_levels + 1));
+    for (i = 0; i < num_joints; i++) {
+        skeleton->order[counts[depths[i]]++] = i;
+    }
+    free(counts);
+    free(depths);
+
+    skeleton->extents = (float*)malloc(sizeof(float) * num_joints);
+    memset(skeleton->extents, 0, sizeof(float) * num_joints);
+    skeleton->max_extent = 0;
+    skeleton->targets = (int*)malloc(sizeof(int) * num_joints * NUM_LODS);
+    skeleton->targets_dirty = 1;
+
+    skeleton->translations = (vec3_t*)malloc(sizeof(vec3_t) * num_joints);
+    skeleton->rotations = (quat_t*)malloc(sizeof(quat_t) * num_joints);
+    skeleton->scales = (vec3_t*)malloc(sizeof(vec3_t) * num_joints);
+}
+
+/* the skeleton takes the clip, either mapped or allocated */
+static skeleton_t *create_skeleton(clip_header_t *clip, int mapped) {
+    skeleton_t *skeleton = (skeleton_t*)malloc(sizeof(skeleton_t));
+    int num_joints = clip->num_joints;
+    joint_t *joints = locate_keys(clip, skeleton->keys);
+    int i, c;
+
+    skeleton->min_time = clip->min_time;
+    skeleton->max_time = clip->max_time;
+    skeleton->num_joints = num_joints;
+    skeleton->joints = (joint_t*)malloc(sizeof(joint_t) * num_joints);
+    memcpy(skeleton->joints, joints, sizeof(joint_t) * num_joints);
+    for (i = 0; i < num_joints; i++) {
+        joint_t *joint = &skeleton->joints[i];
+        assert(joint->parent_index < i);
+        for (c = 0; c < NUM_CHANNELS; c++) {
+            track_t *track = &joint->tracks[c];
+            assert(track->first_key >= 0 && track->num_keys >= 0);
+            assert(track->first_key + track->num_keys <= clip->num_keys[c]);
+            track->cursor = 0;
+        }
+    }
+    skeleton->clip = clip;
+    skeleton->clip_size = get_clip_size(clip);
+    skeleton->clip_mapped = mapped;
+
+    initialize_levels(skeleton);
+    initialize_poses(skeleton);
 
-    UNUSED_VAR(items);
     return skeleton;
 }
 
+static skeleton_t *load_clip(const char *clip_path, const char *filename) {
+    clip_header_t *header;
+    int size;
+
+    header = (clip_header_t*)file_map(clip_path, &size);
+    if (header == NULL) {
+        return NULL;
+    }
+    if (size < (int)sizeof(clip_header_t)
+            || header->magic != CLIP_MAGIC
+            || header->version != CLIP_VERSION
+            || size != get_clip_size(header)
+            || !private_check_source(filename, &header->source, clip_path,
+                                     offsetof(clip_header_t, source))) {
+        file_unmap(header, size);
+        return NULL;  /* stale or foreign, will be rebuilt */
+    }
+    return create_skeleton(header, 1);
+}
+
 skeleton_t *skeleton_load(const char *filename) {
     const char *extension = private_get_extension(filename);
     if (strcmp(extension, "ani") == 0) {
-        return load_ani(filename);
+        char clip_path[PATH_SIZE];
+        skeleton_t *skeleton;
+
+        get_clip_path(filename, clip_path);
+        skeleton = load_clip(clip_path, filename);
+        if (skeleton == NULL) {
+            stamp_t stamp;
+            source_t source;
+            clip_header_t *clip;
+            private_stamp_source(filename, &stamp);
+            read_source(filename, &source);
+            clip = build_clip(&source, &stamp);
+            release_source(&source);
+            save_clip(clip, clip_path);
+            skeleton = create_skeleton(clip, 0);
+        }
+        return skeleton;
     } else {
         assert(0);
         return NULL;
     }
 }
 
+static void release_bake(skeleton_t *skeleton);
+
 void skeleton_release(skeleton_t *skeleton) {
     int i;
-    for (i = 0; i < skeleton->num_joints; i++) {
-        joint_t *joint = &skeleton->joints[i];
-        free(joint->translation_times);
-        free(joint->translation_values);
-        free(joint->rotation_times);
-        free(joint->rotation_values);
-        free(joint->scale_times);
-        free(joint->scale_values);
+    release_bake(skeleton);
+    if (skeleton->clip_mapped) {
+        file_unmap(skeleton->clip, skeleton->clip_size);
+    } else {
+        free(skeleton->clip);
+    }
+    for (i = 0; i < NUM_POSES; i++) {
+        free(skeleton->poses[i].transforms);
+        free(skeleton->poses[i].joint_matrices);
+        free(skeleton->poses[i].normal_matrices);
     }
+    free(skeleton->order);
+    free(skeleton->level_offsets);
+    free(skeleton->extents);
+    free(skeleton->targets);
+    free(skeleton->translations);
+    free(skeleton->rotations);
+    free(skeleton->scales);
     free(skeleton->joints);
-    free(skeleton->joint_matrices);
-    free(skeleton->normal_matrices);
     free(skeleton);
 }
 
 /* joint updating/retrieving */
 
-static vec3_t get_translation(joint_t *joint, float frame_time) {
-    int num_translations = joint->num_translations;
-    float *translation_times = joint->translation_times;
-    vec3_t *translation_values = joint->translation_values;
-
-    if (num_translations == 0) {
-        return vec3_new(0, 0, 0);
-    } else if (frame_time <= translation_times[0]) {
-        return translation_values[0];
-    } else if (frame_time >= translation_times[num_translations - 1]) {
-        return translation_values[num_translations - 1];
+/*
+ * returns the key at or before the frame time, which must lie within the
+ * track, the cursor and the key after it are tried first so that playback
+ * is constant time per track, seeking and looping fall back to a binary
+ * search
+ */
+static int find_key(track_t *track, float *times, float frame_time) {
+    int cursor = track->cursor;
+    int low = 0;
+    int high = track->num_keys - 1;
+
+    if (times[cursor] <= frame_time) {
+        if (frame_time < times[cursor + 1]) {
+            return cursor;
+        } else if (frame_time < times[cursor + 2]) {
+            track->cursor = cursor + 1;
+            return cursor + 1;
+        } else {
+            low = cursor + 2;
+        }
     } else {
-        int i;
-        for (i = 0; i < num_translations - 1; i++) {
-            float curr_time = translation_times[i];
-            float next_time = translation_times[i + 1];
-            if (frame_time >= curr_time && frame_time < next_time) {
-                float t = (frame_time - curr_time) / (next_time - curr_time);
-                vec3_t curr_translation = translation_values[i];
-                vec3_t next_translation = translation_values[i + 1];
-                return vec3_lerp(curr_translation, next_translation, t);
-            }
+        high = cursor;
+    }
+    /* times[low] <= frame_time < times[high] */
+    while (high - low > 1) {
+        int middle = (low + high) / 2;
+        if (times[middle] <= frame_time) {
+            low = middle;
+        } else {
+            high = middle;
         }
-        assert(0);
-        return vec3_new(0, 0, 0);
     }
+    track->cursor = low;
+    return low;
 }
 
-static quat_t get_rotation(joint_t *joint, float frame_time) {
-    int num_rotations = joint->num_rotations;
-    float *rotation_times = joint->rotation_times;
-    quat_t *rotation_values = joint->rotation_values;
+/*
+ * returns the key to blend from along with the factor towards the next
+ * one, or NULL for an empty track
+ */
+static code_t *find_keys(skeleton_t *skeleton, track_t *track, int channel,
+                         float frame_time, float *t) {
+    float *times = skeleton->keys[channel].times + track->first_key;
+    code_t *values = skeleton->keys[channel].values + track->first_key;
+    int num_keys = track->num_keys;
 
-    if (num_rotations == 0) {
+    *t = 0;
+    if (num_keys == 0) {
+        return NULL;
+    } else if (frame_time <= times[0]) {
+        return &values[0];
+    } else if (frame_time >= times[num_keys - 1]) {
+        return &values[num_keys - 1];
+    } else {
+        int i = find_key(track, times, frame_time);
+        *t = (frame_time - times[i]) / (times[i + 1] - times[i]);
+        return &values[i];
+    }
+}
+
+static vec3_t get_vector(skeleton_t *skeleton, joint_t *joint, int channel,
+                         float frame_time, vec3_t default_value) {
+    track_t *track = &joint->tracks[channel];
+    float t;
+    code_t *codes = find_keys(skeleton, track, channel, frame_time, &t);
+    if (codes == NULL) {
+        return default_value;
+    } else if (t == 0) {
+        return decode_vector(track, codes[0]);
+    } else {
+        return vec3_lerp(decode_vector(track, codes[0]),
+                         decode_vector(track, codes[1]), t);
+    }
+}
+
+static quat_t get_rotation(skeleton_t *skeleton, joint_t *joint,
+                           float frame_time) {
+    track_t *track = &joint->tracks[ROTATION];
+    float t;
+    code_t *codes = find_keys(skeleton, track, ROTATION, frame_time, &t);
+    if (codes == NULL) {
         return quat_new(0, 0, 0, 1);
-    } else if (frame_time <= rotation_times[0]) {
-        return rotation_values[0];
-    } else if (frame_time >= rotation_times[num_rotations - 1]) {
-        return rotation_values[num_rotations - 1];
+    } else if (t == 0) {
+        return decode_rotation(codes[0]);
     } else {
-        int i;
-        for (i = 0; i < num_rotations - 1; i++) {
-            float curr_time = rotation_times[i];
-            float next_time = rotation_times[i + 1];
-            if (frame_time >= curr_time && frame_time < next_time) {
-                float t = (frame_time - curr_time) / (next_time - curr_time);
-                quat_t curr_rotation = rotation_values[i];
-                quat_t next_rotation = rotation_values[i + 1];
-                return quat_slerp(curr_rotation, next_rotation, t);
+        return quat_slerp(decode_rotation(codes[0]),
+                          decode_rotation(codes[1]), t);
+    }
+}
+
+/*
+ * local transforms are translation times rotation times scale, converted
+ * four joints at a time with the joints spread over the simd lanes
+ */
+static void convert_local(vec3_t t, quat_t q, vec3_t s, mat4_t *matrix) {
+    float xx = q.x * q.x, xy = q.x * q.y, xz = q.x * q.z, xw = q.x * q.w;
+    float yy = q.y * q.y, yz = q.y * q.z, yw = q.y * q.w;
+    float zz = q.z * q.z, zw = q.z * q.w;
+
+    matrix->m[0][0] = (1 - 2 * (yy + zz)) * s.x;
+    matrix->m[0][1] = 2 * (xy - zw) * s.y;
+    matrix->m[0][2] = 2 * (xz + yw) * s.z;
+    matrix->m[0][3] = t.x;
+    matrix->m[1][0] = 2 * (xy + zw) * s.x;
+    matrix->m[1][1] = (1 - 2 * (xx + zz)) * s.y;
+    matrix->m[1][2] = 2 * (yz - xw) * s.z;
+    matrix->m[1][3] = t.y;
+    matrix->m[2][0] = 2 * (xz - yw) * s.x;
+    matrix->m[2][1] = 2 * (yz + xw) * s.y;
+    matrix->m[2][2] = (1 - 2 * (xx + yy)) * s.z;
+    matrix->m[2][3] = t.z;
+    matrix->m[3][0] = 0;
+    matrix->m[3][1] = 0;
+    matrix->m[3][2] = 0;
+    matrix->m[3][3] = 1;
+}
+
+#ifdef SKELETON_SSE2
+static void convert_locals(vec3_t *t, quat_t *q, vec3_t *s,
+                           mat4_t *matrices) {
+    __m128 x = _mm_loadu_ps(&q[0].x);
+    __m128 y = _mm_loadu_ps(&q[1].x);
+    __m128 z = _mm_loadu_ps(&q[2].x);
+    __m128 w = _mm_loadu_ps(&q[3].x);
+    __m128 sx = _mm_setr_ps(s[0].x, s[1].x, s[2].x, s[3].x);
+    __m128 sy = _mm_setr_ps(s[0].y, s[1].y, s[2].y, s[3].y);
+    __m128 sz = _mm_setr_ps(s[0].z, s[1].z, s[2].z, s[3].z);
+    __m128 one = _mm_set1_ps(1);
+    __m128 x2, y2, z2, xx, xy, xz, xw, yy, yz, yw, zz, zw;
+    __m128 r0, r1, r2, r3;
+    int i;
+
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    x2 = _mm_add_ps(x, x);
+    y2 = _mm_add_ps(y, y);
+    z2 = _mm_add_ps(z, z);
+    xx = _mm_mul_ps(x, x2);
+    xy = _mm_mul_ps(x, y2);
+    xz = _mm_mul_ps(x, z2);
+    xw = _mm_mul_ps(w, x2);
+    yy = _mm_mul_ps(y, y2);
+    yz = _mm_mul_ps(y, z2);
+    yw = _mm_mul_ps(w, y2);
+    zz = _mm_mul_ps(z, z2);
+    zw = _mm_mul_ps(w, z2);
+
+    r0 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+    r1 = _mm_mul_ps(_mm_sub_ps(xy, zw), sy);
+    r2 = _mm_mul_ps(_mm_add_ps(xz, yw), sz);
+    r3 = _mm_setr_ps(t[0].x, t[1].x, t[2].x, t[3].x);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(matrices[0].m[0], r0);
+    _mm_storeu_ps(matrices[1].m[0], r1);
+    _mm_storeu_ps(matrices[2].m[0], r2);
+    _mm_storeu_ps(matrices[3].m[0], r3);
+
+    r0 = _mm_mul_ps(_mm_add_ps(xy, zw), sx);
+    r1 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+    r2 = _mm_mul_ps(_mm_sub_ps(yz, xw), sz);
+    r3 = _mm_setr_ps(t[0].y, t[1].y, t[2].y, t[3].y);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(matrices[0].m[1], r0);
+    _mm_storeu_ps(matrices[1].m[1], r1);
+    _mm_storeu_ps(matrices[2].m[1], r2);
+    _mm_storeu_ps(matrices[3].m[1], r3);
+
+    r0 = _mm_mul_ps(_mm_sub_ps(xz, yw), sx);
+    r1 = _mm_mul_ps(_mm_add_ps(yz, xw), sy);
+    r2 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+    r3 = _mm_setr_ps(t[0].z, t[1].z, t[2].z, t[3].z);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(matrices[0].m[2], r0);
+    _mm_storeu_ps(matrices[1].m[2], r1);
+    _mm_storeu_ps(matrices[2].m[2], r2);
+    _mm_storeu_ps(matrices[3].m[2], r3);
+
+    for (i = 0; i < 4; i++) {
+        _mm_storeu_ps(matrices[i].m[3], _mm_setr_ps(0, 0, 0, 1));
+    }
+}
+
+/* product = a * b, the product may alias b */
+static void multiply(mat4_t *a, mat4_t *b, mat4_t *product) {
+    __m128 b0 = _mm_loadu_ps(b->m[0]);
+    __m128 b1 = _mm_loadu_ps(b->m[1]);
+    __m128 b2 = _mm_loadu_ps(b->m[2]);
+    __m128 b3 = _mm_loadu_ps(b->m[3]);
+    int r;
+    for (r = 0; r < 4; r++) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a->m[r][0]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[r][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[r][2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->m[r][3]), b3));
+        _mm_storeu_ps(product->m[r], row);
+    }
+}
+#else
+static void convert_locals(vec3_t *t, quat_t *q, vec3_t *s,
+                           mat4_t *matrices) {
+    int i;
+    for (i = 0; i < 4; i++) {
+        convert_local(t[i], q[i], s[i], &matrices[i]);
+    }
+}
+
+static void multiply(mat4_t *a, mat4_t *b, mat4_t *product) {
+    *product = mat4_mul_mat4(*a, *b);
+}
+#endif
+
+/*
+ * a joint follows its parent at a level when neither it nor any joint
+ * below it reaches farther into the meshes than the extent of the level,
+ * so whole chains of small leaves such as fingers collapse together, the
+ * joint matrix of a collapsed joint is the one of the joint it follows,
+ * which keeps its vertices as they were bound to that joint
+ */
+static void update_targets(skeleton_t *skeleton) {
+    int num_joints = skeleton->num_joints;
+    int *kept_children = (int*)malloc(sizeof(int) * num_joints);
+    int lod, i;
+
+    for (i = 0; i < num_joints; i++) {
+        skeleton->targets[i] = i;
+    }
+    for (lod = 1; lod < NUM_LODS; lod++) {
+        float extent = skeleton->max_extent * LOD_EXTENT * (1 << (lod - 1));
+        int *targets = skeleton->targets + num_joints * lod;
+        memset(kept_children, 0, sizeof(int) * num_joints);
+        for (i = num_joints - 1; i >= 0; i--) {
+            int parent_index = skeleton->joints[i].parent_index;
+            if (parent_index >= 0 && !kept_children[i]
+                    && skeleton->extents[i] < extent) {
+                targets[i] = -1;
+            } else {
+                targets[i] = i;
+                if (parent_index >= 0) {
+                    kept_children[parent_index] = 1;
+                }
             }
         }
-        assert(0);
-        return quat_new(0, 0, 0, 1);
+        for (i = 0; i < num_joints; i++) {
+            if (targets[i] < 0) {
+                targets[i] = targets[skeleton->joints[i].parent_index];
+            }
+        }
+    }
+    free(kept_children);
+    skeleton->targets_dirty = 0;
+}
+
+/*
+ * the joints are sampled, converted to local transforms in batches, then
+ * brought to the skeleton space level by level, the parents of a level
+ * are all done by then, joints collapsed at the level of detail are not
+ * sampled at all
+ *
+ * the normal matrix of a joint without non-uniform scale is the joint
+ * matrix divided by the squared scale, no inversion is needed
+ */
+static void evaluate_pose(skeleton_t *skeleton, pose_t *pose,
+                          float frame_time, int lod) {
+    int num_joints = skeleton->num_joints;
+    mat4_t *transforms = pose->transforms;
+    int *targets;
+    int i, j;
+
+    if (skeleton->targets_dirty) {
+        update_targets(skeleton);
+    }
+    targets = skeleton->targets + num_joints * lod;
+
+    for (i = 0; i < num_joints; i++) {
+        joint_t *joint = &skeleton->joints[i];
+        if (targets[i] != i) {
+            continue;
+        }
+        skeleton->translations[i] = get_vector(skeleton, joint, TRANSLATION,
+                                               frame_time, vec3_new(0, 0, 0));
+        skeleton->rotations[i] = get_rotation(skeleton, joint, frame_time);
+        skeleton->scales[i] = get_vector(skeleton, joint, SCALE, frame_time,
+                                         vec3_new(1, 1, 1));
+    }
+    for (i = 0; i + 4 <= num_joints; i += 4) {
+        convert_locals(&skeleton->translations[i], &skeleton->rotations[i],
+                       &skeleton->scales[i], &transforms[i]);
+    }
+    for (; i < num_joints; i++) {
+        convert_local(skeleton->translations[i], skeleton->rotations[i],
+                      skeleton->scales[i], &transforms[i]);
+    }
+
+    for (i = 1; i < skeleton->num_levels; i++) {
+        int first = skeleton->level_offsets[i];
+        int last = skeleton->level_offsets[i + 1];
+        for (j = first; j < last; j++) {
+            int index = skeleton->order[j];
+            int parent_index = skeleton->joints[index].parent_index;
+            if (targets[index] != index) {
+                continue;
+            }
+            multiply(&transforms[parent_index], &transforms[index],
+                     &transforms[index]);
+        }
+    }
+
+    for (i = 0; i < num_joints; i++) {
+        joint_t *joint = &skeleton->joints[i];
+        mat4_t *joint_matrix = &pose->joint_matrices[i];
+        mat3_t normal_matrix;
+
+        if (targets[i] != i) {
+            *joint_matrix = pose->joint_matrices[targets[i]];
+            pose->normal_matrices[i] = pose->normal_matrices[targets[i]];
+            continue;
+        }
+        multiply(&transforms[i], &joint->inverse_bind, joint_matrix);
+        normal_matrix = mat3_from_mat4(*joint_matrix);
+        if (joint->uniform_scale) {
+            vec3_t axis = vec3_new(normal_matrix.m[0][0],
+                                   normal_matrix.m[1][0],
+                                   normal_matrix.m[2][0]);
+            float scale2 = vec3_dot(axis, axis);
+            int r, c;
+            for (r = 0; r < 3; r++) {
+                for (c = 0; c < 3; c++) {
+                    normal_matrix.m[r][c] /= scale2;
+                }
+            }
+        } else {
+            normal_matrix = mat3_inverse_transpose(normal_matrix);
+        }
+        pose->normal_matrices[i] = normal_matrix;
     }
 }
 
-static vec3_t get_scale(joint_t *joint, float frame_time) {
-    int num_scales = joint->num_scales;
-    float *scale_times = joint->scale_times;
-    vec3_t *scale_values = joint->scale_values;
+/* palette baking */
+
+static int get_bake_size(bake_header_t *bake) {
+    int frame_size = (sizeof(mat4_t) + sizeof(mat3_t)) * bake->num_joints;
+    return (int)sizeof(bake_header_t) + frame_size * bake->num_frames;
+}
+
+static void locate_palette(bake_header_t *bake, int frame,
+                           mat4_t **joint_matrices,
+                           mat3_t **normal_matrices) {
+    int num_joints = bake->num_joints;
+    int frame_size = (sizeof(mat4_t) + sizeof(mat3_t)) * num_joints;
+    char *palette = (char*)(bake + 1) + frame_size * frame;
+    *joint_matrices = (mat4_t*)palette;
+    *normal_matrices = (mat3_t*)(palette + sizeof(mat4_t) * num_joints);
+}
+
+static int get_num_frames(skeleton_t *skeleton, int frame_rate) {
+    return (int)ceil(skeleton->max_time * frame_rate) + 1;
+}
 
-    if (num_scales == 0) {
-        return vec3_new(1, 1, 1);
-    } else if (frame_time <= scale_times[0]) {
-        return scale_values[0];
-    } else if (frame_time >= scale_times[num_scales - 1]) {
-        return scale_values[num_scales - 1];
+static bake_header_t *build_bake(skeleton_t *skeleton, int frame_rate) {
+    int num_joints = skeleton->num_joints;
+    clip_header_t *clip = (clip_header_t*)skeleton->clip;
+    bake_header_t header, *bake;
+    pose_t *pose = &skeleton->poses[0];
+    int i;
+
+    header.magic = BAKE_MAGIC;
+    header.version = BAKE_VERSION;
+    header.clip_version = clip->version;
+    header.source_size = clip->source.size;
+    header.source_hash = clip->source.hash;
+    header.num_joints = num_joints;
+    header.frame_rate = frame_rate;
+    header.num_frames = get_num_frames(skeleton, frame_rate);
+    bake = (bake_header_t*)malloc(get_bake_size(&header));
+    *bake = header;
+
+    for (i = 0; i < header.num_frames; i++) {
+        float frame_time = float_min((float)i / frame_rate,
+                                     skeleton->max_time);
+        mat4_t *joint_matrices;
+        mat3_t *normal_matrices;
+        evaluate_pose(skeleton, pose, frame_time, 0);
+        locate_palette(bake, i, &joint_matrices, &normal_matrices);
+        memcpy(joint_matrices, pose->joint_matrices,
+               sizeof(mat4_t) * num_joints);
+        memcpy(normal_matrices, pose->normal_matrices,
+               sizeof(mat3_t) * num_joints);
+    }
+    pose->tick = -1;
+
+    return bake;
+}
+
+static bake_header_t *load_bake(skeleton_t *skeleton, int frame_rate,
+                                const char *filename, int *size) {
+    clip_header_t *clip = (clip_header_t*)skeleton->clip;
+    bake_header_t *bake = (bake_header_t*)file_map(filename, size);
+    if (bake == NULL) {
+        return NULL;
+    }
+    if (*size < (int)sizeof(bake_header_t)
+            || bake->magic != BAKE_MAGIC
+            || bake->version != BAKE_VERSION
+            || bake->clip_version != clip->version
+            || bake->source_size != clip->source.size
+            || bake->source_hash != clip->source.hash
+            || bake->num_joints != skeleton->num_joints
+            || bake->frame_rate != frame_rate
+            || bake->num_frames != get_num_frames(skeleton, frame_rate)
+            || *size != get_bake_size(bake)) {
+        file_unmap(bake, *size);
+        return NULL;  /* stale or foreign, will be rebuilt */
+    }
+    return bake;
+}
+
+static void save_bake(bake_header_t *bake, const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        return;
+    }
+    fwrite(bake, get_bake_size(bake), 1, file);
+    fclose(file);
+}
+
+static void release_bake(skeleton_t *skeleton) {
+    if (skeleton->bake == NULL) {
+        return;
+    } else if (skeleton->bake_mapped) {
+        file_unmap(skeleton->bake, skeleton->bake_size);
+    } else {
+        free(skeleton->bake);
+    }
+    skeleton->bake = NULL;
+}
+
+/*
+ * samples the joint and normal matrices of the whole clip at the frame
+ * rate into one table, the table is kept in memory, or cached at the
+ * filename when there is one and memory-mapped on later runs, a frame
+ * rate of 0 goes back to evaluating the clip
+ */
+void skeleton_bake(skeleton_t *skeleton, int frame_rate,
+                   const char *filename) {
+    bake_header_t *bake = NULL;
+    int size = 0;
+    int i;
+
+    assert(frame_rate >= 0);
+    release_bake(skeleton);
+    for (i = 0; i < NUM_POSES; i++) {
+        skeleton->poses[i].tick = -1;
+    }
+    skeleton->pose = &skeleton->poses[0];
+    if (frame_rate == 0) {
+        return;
+    }
+
+    if (filename != NULL) {
+        bake = load_bake(skeleton, frame_rate, filename, &size);
+    }
+    if (bake != NULL) {
+        skeleton->bake_mapped = 1;
     } else {
-        int i;
-        for (i = 0; i < num_scales - 1; i++) {
-            float curr_time = scale_times[i];
-            float next_time = scale_times[i + 1];
-            if (frame_time >= curr_time && frame_time < next_time) {
-                float t = (frame_time - curr_time) / (next_time - curr_time);
-                vec3_t curr_scale = scale_values[i];
-                vec3_t next_scale = scale_values[i + 1];
-                return vec3_lerp(curr_scale, next_scale, t);
+        bake = build_bake(skeleton, frame_rate);
+        size = get_bake_size(bake);
+        if (filename != NULL) {
+            save_bake(bake, filename);
+        }
+        skeleton->bake_mapped = 0;
+    }
+    skeleton->bake = bake;
+    skeleton->bake_size = size;
+}
+
+/* a linear blend between two palettes */
+static void blend_matrices(pose_t *pose, int num_joints,
+                           mat4_t *joints0, mat3_t *normals0,
+                           mat4_t *joints1, mat3_t *normals1, float t) {
+    int i, r, c;
+    for (i = 0; i < num_joints; i++) {
+        mat4_t *joint_matrix = &pose->joint_matrices[i];
+        mat3_t *normal_matrix = &pose->normal_matrices[i];
+        for (r = 0; r < 4; r++) {
+            for (c = 0; c < 4; c++) {
+                float a = joints0[i].m[r][c];
+                joint_matrix->m[r][c] = a + (joints1[i].m[r][c] - a) * t;
             }
         }
-        assert(0);
-        return vec3_new(1, 1, 1);
+        for (r = 0; r < 3; r++) {
+            for (c = 0; c < 3; c++) {
+                float a = normals0[i].m[r][c];
+                normal_matrix->m[r][c] = a + (normals1[i].m[r][c] - a) * t;
+            }
+        }
+    }
+}
+
+/*
+ * blends the two palettes of the table around the time, the last frame
+ * is sampled at the end of the clip, so the last interval may be shorter
+ */
+static void blend_palettes(skeleton_t *skeleton, pose_t *pose,
+                           float position) {
+    float end = skeleton->max_time * skeleton->bake->frame_rate;
+    int frame = (int)position;
+    float span, t;
+    mat4_t *joints0, *joints1;
+    mat3_t *normals0, *normals1;
+
+    if (frame > skeleton->bake->num_frames - 2) {
+        frame = skeleton->bake->num_frames - 2;
+    }
+    span = float_min((float)(frame + 1), end) - (float)frame;
+    t = span > 0 ? float_min((position - (float)frame) / span, 1) : 1;
+    locate_palette(skeleton->bake, frame, &joints0, &normals0);
+    locate_palette(skeleton->bake, frame + 1, &joints1, &normals1);
+    blend_matrices(pose, skeleton->num_joints, joints0, normals0,
+                   joints1, normals1, t);
+}
+
+/* level of detail */
+
+/*
+ * records how far a joint reaches into a mesh using it, the largest of
+ * the extents across meshes is kept, joints without any extent follow
+ * their parents from level 1 on
+ */
+void skeleton_set_extent(skeleton_t *skeleton, int joint_index,
+                         float extent) {
+    assert(joint_index >= 0 && joint_index < skeleton->num_joints);
+    if (extent > skeleton->extents[joint_index]) {
+        skeleton->extents[joint_index] = extent;
+        skeleton->max_extent = float_max(skeleton->max_extent, extent);
+        skeleton->targets_dirty = 1;
+    }
+}
+
+/* pose caching */
+
+static int get_tick(float clip_time) {
+    return (int)(clip_time * POSE_RATE + 0.5f);
+}
+
+static pose_t *find_pose(skeleton_t *skeleton, int tick, int lod) {
+    int i;
+    for (i = 0; i < NUM_POSES; i++) {
+        pose_t *pose = &skeleton->poses[i];
+        if (pose->tick == tick && pose->lod == lod) {
+            return pose;
+        }
     }
+    return NULL;
 }
 
+static pose_t *reuse_pose(skeleton_t *skeleton) {
+    pose_t *pose = &skeleton->poses[0];
+    int i;
+    for (i = 1; i < NUM_POSES; i++) {
+        if (skeleton->poses[i].last_used < pose->last_used) {
+            pose = &skeleton->poses[i];
+        }
+    }
+    return pose;
+}
+
+static void use_pose(skeleton_t *skeleton, pose_t *pose, int tick,
+                     int lod) {
+    skeleton->clock += 1;
+    pose->tick = tick;
+    pose->lod = lod;
+    pose->last_used = skeleton->clock;
+}
+
+static pose_t *get_step_pose(skeleton_t *skeleton, float step_time,
+                             int lod) {
+    int tick = get_tick(step_time);
+    pose_t *pose = find_pose(skeleton, tick, lod);
+    if (pose == NULL) {
+        pose = reuse_pose(skeleton);
+        evaluate_pose(skeleton, pose, step_time, lod);
+    }
+    use_pose(skeleton, pose, tick, lod);
+    return pose;
+}
+
+/*
+ * models sharing the skeleton may ask for the same or a few different
+ * times in a frame, the poses are cached by time so that each of them is
+ * evaluated only once, the least recently used one is replaced, a pose is
+ * evaluated at the first time that falls in its millisecond
+ *
+ * a baked skeleton returns the palettes of the table for times on its
+ * frames and blends the two nearest palettes in between
+ */
 void skeleton_update_joints(skeleton_t *skeleton, float frame_time) {
-    frame_time = (float)fmod(frame_time, skeleton->max_time);
-    if (frame_time != skeleton->last_time) {
-        int i;
-        for (i = 0; i < skeleton->num_joints; i++) {
-            joint_t *joint = &skeleton->joints[i];
-            vec3_t translation = get_translation(joint, frame_time);
-            quat_t rotation = get_rotation(joint, frame_time);
-            vec3_t scale = get_scale(joint, frame_time);
-            mat4_t joint_matrix;
-            mat3_t normal_matrix;
-
-            joint->transform = mat4_from_trs(translation, rotation, scale);
-            if (joint->parent_index >= 0) {
-                joint_t *parent = &skeleton->joints[joint->parent_index];
-                joint->transform = mat4_mul_mat4(parent->transform,
-                                                 joint->transform);
-            }
+    skeleton_update_joints_lod(skeleton, frame_time, 0);
+}
 
-            joint_matrix = mat4_mul_mat4(joint->transform, joint->inverse_bind);
-            normal_matrix = mat3_inverse_transpose(mat3_from_mat4(joint_matrix));
-            skeleton->joint_matrices[i] = joint_matrix;
-            skeleton->normal_matrices[i] = normal_matrix;
+/*
+ * from level 1 on, poses are evaluated at a reduced rate with the small
+ * leaves collapsed, and the two poses around the time are blended, each
+ * of them is evaluated once and shared by the frames in between
+ */
+void skeleton_update_joints_lod(skeleton_t *skeleton, float frame_time,
+                                int lod) {
+    float clip_time = (float)fmod(frame_time, skeleton->max_time);
+    int tick = get_tick(clip_time);
+    pose_t *pose;
+
+    assert(lod >= 0);
+    lod = lod < NUM_LODS ? lod : NUM_LODS - 1;
+    if (skeleton->bake != NULL) {
+        float position = clip_time * skeleton->bake->frame_rate;
+        int frame = (int)(position + 0.5f);
+        if (fabs(position - frame) < BAKE_SNAP) {
+            pose = &skeleton->baked_pose;
+            locate_palette(skeleton->bake, frame, &pose->joint_matrices,
+                           &pose->normal_matrices);
+            skeleton->pose = pose;
+            return;
+        }
+        lod = 0;  /* blending the table is cheap enough */
+    }
+
+    pose = find_pose(skeleton, tick, lod);
+    if (pose == NULL) {
+        if (skeleton->bake != NULL) {
+            pose = reuse_pose(skeleton);
+            blend_palettes(skeleton, pose,
+                           clip_time * skeleton->bake->frame_rate);
+        } else if (lod == 0) {
+            pose = reuse_pose(skeleton);
+            evaluate_pose(skeleton, pose, clip_time, 0);
+        } else {
+            float rate = LOD_RATE / (float)(1 << (lod - 1));
+            float position = clip_time * rate;
+            int step = (int)position;
+            float next_time = float_min((step + 1) / rate,
+                                        skeleton->max_time);
+            pose_t *pose0 = get_step_pose(skeleton, step / rate, lod);
+            pose_t *pose1 = get_step_pose(skeleton, next_time, lod);
+            pose = reuse_pose(skeleton);
+            blend_matrices(pose, skeleton->num_joints,
+                           pose0->joint_matrices, pose0->normal_matrices,
+                           pose1->joint_matrices, pose1->normal_matrices,
+                           position - (float)step);
         }
-        skeleton->last_time = frame_time;
+    }
+    use_pose(skeleton, pose, tick, lod);
+    skeleton->pose = pose;
+}
+
+typedef struct {
+    skeleton_t **skeletons;
+    float frame_time;
+} batch_t;
+
+static void update_batch(void *batch_, int first, int last) {
+    batch_t *batch = (batch_t*)batch_;
+    int i;
+    for (i = first; i < last; i++) {
+        skeleton_update_joints(batch->skeletons[i], batch->frame_time);
     }
 }
 
+/*
+ * updates distinct skeletons in batches of about the same number of joints
+ * that are evaluated by the job system, a skeleton belongs to a single
+ * batch so its cursors and poses are never shared
+ */
+void skeleton_update_batch(skeleton_t **skeletons, int num_skeletons,
+                           float frame_time) {
+    int num_joints = 0;
+    int batch_size, i;
+    batch_t batch;
+
+    for (i = 0; i < num_skeletons; i++) {
+        num_joints += skeletons[i]->num_joints;
+    }
+    if (num_joints == 0) {
+        return;
+    }
+    batch_size = (int)((long)BATCH_JOINTS * num_skeletons / num_joints);
+    batch_size = batch_size < 1 ? 1 : batch_size;
+    batch.skeletons = skeletons;
+    batch.frame_time = frame_time;
+    job_parallel_for(update_batch, &batch, num_skeletons, batch_size);
+}
+
 mat4_t *skeleton_get_joint_matrices(skeleton_t *skeleton) {
-    return skeleton->joint_matrices;
+    return skeleton->pose->joint_matrices;
 }
 
 mat3_t *skeleton_get_normal_matrices(skeleton_t *skeleton) {
-    return skeleton->normal_matrices;
+    return skeleton->pose->normal_matrices;
+}
+
+int skeleton_get_num_joints(skeleton_t *skeleton) {
+    return skeleton->num_joints;
+}
+
+float skeleton_get_duration(skeleton_t *skeleton) {
+    return skeleton->max_time;
 }
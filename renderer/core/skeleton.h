@@ -9,9 +9,23 @@ typedef struct skeleton skeleton_t;
 skeleton_t *skeleton_load(const char *filename);
 void skeleton_release(skeleton_t *skeleton);
 
+/* level of detail */
+void skeleton_set_extent(skeleton_t *skeleton, int joint_index,
+                         float extent);
+
+/* palette baking */
+void skeleton_bake(skeleton_t *skeleton, int frame_rate,
+                   const char *filename);
+
 /* joint updating/retrieving */
 void skeleton_update_joints(skeleton_t *skeleton, float frame_time);
+void skeleton_update_joints_lod(skeleton_t *skeleton, float frame_time,
+                                int lod);
+void skeleton_update_batch(skeleton_t **skeletons, int num_skeletons,
+                           float frame_time);
 mat4_t *skeleton_get_joint_matrices(skeleton_t *skeleton);
 mat3_t *skeleton_get_normal_matrices(skeleton_t *skeleton);
+int skeleton_get_num_joints(skeleton_t *skeleton);
+float skeleton_get_duration(skeleton_t *skeleton);
 
 #endif
@@ -0,0 +1,868 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "job.h"
+#include "maths.h"
+#include "mesh.h"
+#include "skinning.h"
+
+/*
+ * skinning ahead of the draw passes, each vertex is skinned once per frame
+ * straight into world space, the streams are then read by the shadow and
+ * main passes instead of skinning every vertex inside the vertex shaders
+ *
+ * the blends keep one vertex per iteration and spread the matrix columns
+ * or the dual quaternion over the simd lanes, so no per-lane gathers from
+ * the palettes are needed, then four vertices are finished together, the
+ * blended dual quaternions (two registers each) are transposed so that the
+ * transform puts one vertex per lane, while transposing the seven blended
+ * columns of the linear blend costs more than it saves, so its results are
+ * shuffled into packed stores instead, AVX2 builds fuse the multiply-adds
+ * and blend a whole dual quaternion per instruction, builds without SSE2
+ * (or with SKINNING_NO_SIMD) fall back to scalar loops
+ */
+
+#if defined(SKINNING_NO_SIMD)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SKINNING_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define SKINNING_SSE2
+#endif
+
+#define BATCH_SIZE 4096  /* vertices skinned per job */
+#define MESHLET_BATCH 64  /* meshlets refitted per job */
+
+typedef struct {
+    int num_joints;   /* influences in use, sorted by decreasing weight */
+    int joints[4];
+    float weights[4];
+} influence_t;
+
+struct skin {
+    int num_vertices;
+    int num_joints;
+    skinning_t method;
+    /* bind pose, decoded once */
+    vec3_t *bind_positions;  /* owned by the mesh */
+    vec3_t *bind_normals;
+    vec4_t *bind_tangents;
+    influence_t *influences;
+    /* palettes of the current frame */
+    float (*joint_cols)[16];   /* columns of model times joint, w unused */
+    float (*normal_cols)[12];  /* columns of normal times joint normal */
+    float (*joint_dqs)[8];     /* real part, then dual part */
+    float model_cols[16];      /* applied after dual quaternions */
+    float model_n_cols[12];
+    int dirty;
+    /* skinned streams */
+    vec3_t *positions;
+    vec3_t *normals;
+    vec4_t *tangents;
+    /* meshlet bounds of the skinned streams */
+    int num_meshlets;
+    meshlet_t *bind_meshlets;  /* owned by the mesh */
+    meshlet_t *meshlets;
+    unsigned int *indices;
+    vec3_t *face_normals;  /* scratch, one per triangle */
+    lod_t *refitted;  /* the level whose meshlets are current */
+};
+
+/* skin creating/releasing */
+
+static void sort_influence(influence_t *influence, int num_joints) {
+    int i, j;
+    for (i = 0; i < 4; i++) {
+        if (influence->weights[i] <= 0 || influence->joints[i] >= num_joints) {
+            influence->joints[i] = 0;
+            influence->weights[i] = 0;
+        }
+    }
+    for (i = 1; i < 4; i++) {
+        for (j = i; j > 0; j--) {
+            if (influence->weights[j] > influence->weights[j - 1]) {
+                int joint = influence->joints[j];
+                float weight = influence->weights[j];
+                influence->joints[j] = influence->joints[j - 1];
+                influence->weights[j] = influence->weights[j - 1];
+                influence->joints[j - 1] = joint;
+                influence->weights[j - 1] = weight;
+            }
+        }
+    }
+    influence->num_joints = 0;
+    while (influence->num_joints < 4
+           && influence->weights[influence->num_joints] > 0) {
+        influence->num_joints += 1;
+    }
+}
+
+skin_t *skin_create(mesh_t *mesh, int with_tangents) {
+    int num_vertices = mesh_get_num_vertices(mesh);
+    int num_joints = mesh_get_num_joints(mesh);
+    int num_meshlets = mesh_get_num_meshlets(mesh);
+    meshlet_t *meshlets = mesh_get_meshlets(mesh);
+    int num_indices = 0;
+    skin_t *skin;
+    int i;
+
+    skin = (skin_t*)malloc(sizeof(skin_t));
+    skin->num_vertices = num_vertices;
+    skin->num_joints = num_joints > 0 ? num_joints : 1;
+    skin->method = SKINNING_LINEAR;
+    skin->bind_positions = mesh_get_positions(mesh);
+    skin->bind_normals = (vec3_t*)malloc(sizeof(vec3_t) * num_vertices);
+    skin->influences = (influence_t*)malloc(sizeof(influence_t)
+                                            * num_vertices);
+    skin->joint_cols = (float(*)[16])malloc(sizeof(float) * 16
+                                            * skin->num_joints);
+    skin->normal_cols = (float(*)[12])malloc(sizeof(float) * 12
+                                             * skin->num_joints);
+    skin->joint_dqs = (float(*)[8])malloc(sizeof(float) * 8
+                                          * skin->num_joints);
+    skin->dirty = 0;
+    skin->positions = (vec3_t*)malloc(sizeof(vec3_t) * num_vertices);
+    skin->normals = (vec3_t*)malloc(sizeof(vec3_t) * num_vertices);
+    if (with_tangents) {
+        skin->bind_tangents = (vec4_t*)malloc(sizeof(vec4_t) * num_vertices);
+        skin->tangents = (vec4_t*)malloc(sizeof(vec4_t) * num_vertices);
+    } else {
+        skin->bind_tangents = NULL;
+        skin->tangents = NULL;
+    }
+
+    /* the indices of all levels, widened for the bounds computation */
+    for (i = 0; i < num_meshlets; i++) {
+        int last_index = meshlets[i].first_index + meshlets[i].num_indices;
+        num_indices = last_index > num_indices ? last_index : num_indices;
+    }
+    skin->num_meshlets = num_meshlets;
+    skin->bind_meshlets = meshlets;
+    skin->meshlets = (meshlet_t*)malloc(sizeof(meshlet_t) * num_meshlets);
+    memcpy(skin->meshlets, meshlets, sizeof(meshlet_t) * num_meshlets);
+    skin->indices = (unsigned int*)malloc(sizeof(unsigned int)
+                                          * num_indices);
+    for (i = 0; i < num_indices; i++) {
+        skin->indices[i] = (unsigned int)mesh_get_index(mesh, i);
+    }
+    skin->face_normals = (vec3_t*)malloc(sizeof(vec3_t)
+                                         * (num_indices / 3 + 1));
+    skin->refitted = NULL;
+
+    for (i = 0; i < num_vertices; i++) {
+        influence_t *influence = &skin->influences[i];
+        vec4_t weight = mesh_get_weight(mesh, i);
+        mesh_get_joint(mesh, i, influence->joints);
+        influence->weights[0] = weight.x;
+        influence->weights[1] = weight.y;
+        influence->weights[2] = weight.z;
+        influence->weights[3] = weight.w;
+        sort_influence(influence, skin->num_joints);
+        skin->bind_normals[i] = mesh_get_normal(mesh, i);
+        if (with_tangents) {
+            skin->bind_tangents[i] = mesh_get_tangent(mesh, i);
+        }
+    }
+
+    return skin;
+}
+
+void skin_release(skin_t *skin) {
+    free(skin->bind_normals);
+    free(skin->bind_tangents);
+    free(skin->influences);
+    free(skin->joint_cols);
+    free(skin->normal_cols);
+    free(skin->joint_dqs);
+    free(skin->positions);
+    free(skin->normals);
+    free(skin->tangents);
+    free(skin->meshlets);
+    free(skin->indices);
+    free(skin->face_normals);
+    free(skin);
+}
+
+/* takes effect from the next update, the palettes differ per method */
+void skin_set_method(skin_t *skin, skinning_t method) {
+    if (skin->method != method) {
+        skin->method = method;
+        skin->dirty = 0;
+    }
+}
+
+/* palette building */
+
+/*
+ * the scaling of the joint is dropped, the dual part is half the
+ * translation times the rotation, see "Geometric Skinning with
+ * Approximate Dual Quaternion Blending" by Kavan et al.
+ */
+static void get_dual_quaternion(mat4_t matrix, float dq[8]) {
+    vec3_t axis_x = vec3_new(matrix.m[0][0], matrix.m[1][0], matrix.m[2][0]);
+    vec3_t axis_y = vec3_new(matrix.m[0][1], matrix.m[1][1], matrix.m[2][1]);
+    vec3_t axis_z = vec3_new(matrix.m[0][2], matrix.m[1][2], matrix.m[2][2]);
+    vec3_t t = vec3_new(matrix.m[0][3], matrix.m[1][3], matrix.m[2][3]);
+    mat3_t rotation = mat3_from_cols(vec3_normalize(axis_x),
+                                     vec3_normalize(axis_y),
+                                     vec3_normalize(axis_z));
+    quat_t r = quat_normalize(quat_from_mat3(rotation));
+
+    dq[0] = r.x;
+    dq[1] = r.y;
+    dq[2] = r.z;
+    dq[3] = r.w;
+    dq[4] = 0.5f * (r.w * t.x + t.y * r.z - t.z * r.y);
+    dq[5] = 0.5f * (r.w * t.y + t.z * r.x - t.x * r.z);
+    dq[6] = 0.5f * (r.w * t.z + t.x * r.y - t.y * r.x);
+    dq[7] = -0.5f * (t.x * r.x + t.y * r.y + t.z * r.z);
+}
+
+/* column-major, with the w row left out as zeros */
+static void get_cols(mat4_t matrix, float cols[16]) {
+    int r, c;
+    for (c = 0; c < 4; c++) {
+        for (r = 0; r < 3; r++) {
+            cols[c * 4 + r] = matrix.m[r][c];
+        }
+        cols[c * 4 + 3] = 0;
+    }
+}
+
+static void get_n_cols(mat3_t matrix, float cols[12]) {
+    int r, c;
+    for (c = 0; c < 3; c++) {
+        for (r = 0; r < 3; r++) {
+            cols[c * 4 + r] = matrix.m[r][c];
+        }
+        cols[c * 4 + 3] = 0;
+    }
+}
+
+/* the vertices are skinned by the next skin_apply */
+void skin_update(skin_t *skin, mat4_t model_matrix, mat3_t normal_matrix,
+                 mat4_t *joint_matrices, mat3_t *joint_n_matrices) {
+    int i;
+    if (skin->method == SKINNING_LINEAR) {
+        for (i = 0; i < skin->num_joints; i++) {
+            get_cols(mat4_mul_mat4(model_matrix, joint_matrices[i]),
+                     skin->joint_cols[i]);
+            get_n_cols(mat3_mul_mat3(normal_matrix, joint_n_matrices[i]),
+                       skin->normal_cols[i]);
+        }
+    } else {
+        for (i = 0; i < skin->num_joints; i++) {
+            get_dual_quaternion(joint_matrices[i], skin->joint_dqs[i]);
+        }
+        get_cols(model_matrix, skin->model_cols);
+        get_n_cols(normal_matrix, skin->model_n_cols);
+    }
+    skin->dirty = 1;
+    skin->refitted = NULL;
+}
+
+/* linear blend skinning */
+
+#if defined(SKINNING_AVX2) || defined(SKINNING_SSE2)
+
+#if defined(SKINNING_AVX2)
+#define MUL_ADD(a, b, c) _mm_fmadd_ps(a, b, c)
+#else
+#define MUL_ADD(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#endif
+
+/* the xyz of four vectors, packed into three registers */
+static void store_packed(float *packed, __m128 v[4]) {
+    __m128 t0 = _mm_shuffle_ps(v[0], v[1], _MM_SHUFFLE(0, 0, 2, 2));
+    __m128 t2 = _mm_shuffle_ps(v[2], v[3], _MM_SHUFFLE(0, 0, 2, 2));
+    _mm_storeu_ps(packed, _mm_shuffle_ps(v[0], t0, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(packed + 4,
+                  _mm_shuffle_ps(v[1], v[2], _MM_SHUFFLE(1, 0, 2, 1)));
+    _mm_storeu_ps(packed + 8,
+                  _mm_shuffle_ps(t2, v[3], _MM_SHUFFLE(2, 1, 2, 0)));
+}
+
+/*
+ * the matrices are blended and applied one vertex per iteration with the
+ * columns across the lanes, the results of four vertices are then shuffled
+ * into whole registers, so the streams are written without scalar stores
+ */
+static void skin_linear4(skin_t *skin, int first, int count) {
+    __m128 positions[4], normals[4];
+    int j, k;
+
+    for (j = 0; j < count; j++) {
+        influence_t *influence = &skin->influences[first + j];
+        vec3_t p = skin->bind_positions[first + j];
+        vec3_t n = skin->bind_normals[first + j];
+        __m128 col0 = _mm_setzero_ps();
+        __m128 col1 = _mm_setzero_ps();
+        __m128 col2 = _mm_setzero_ps();
+        __m128 col3 = _mm_setzero_ps();
+        __m128 n_col0 = _mm_setzero_ps();
+        __m128 n_col1 = _mm_setzero_ps();
+        __m128 n_col2 = _mm_setzero_ps();
+        __m128 vector;
+
+        for (k = 0; k < influence->num_joints; k++) {
+            float *cols = skin->joint_cols[influence->joints[k]];
+            float *n_cols = skin->normal_cols[influence->joints[k]];
+            __m128 weight = _mm_set1_ps(influence->weights[k]);
+            col0 = MUL_ADD(weight, _mm_loadu_ps(cols), col0);
+            col1 = MUL_ADD(weight, _mm_loadu_ps(cols + 4), col1);
+            col2 = MUL_ADD(weight, _mm_loadu_ps(cols + 8), col2);
+            col3 = MUL_ADD(weight, _mm_loadu_ps(cols + 12), col3);
+            n_col0 = MUL_ADD(weight, _mm_loadu_ps(n_cols), n_col0);
+            n_col1 = MUL_ADD(weight, _mm_loadu_ps(n_cols + 4), n_col1);
+            n_col2 = MUL_ADD(weight, _mm_loadu_ps(n_cols + 8), n_col2);
+        }
+
+        vector = MUL_ADD(col0, _mm_set1_ps(p.x), col3);
+        vector = MUL_ADD(col1, _mm_set1_ps(p.y), vector);
+        positions[j] = MUL_ADD(col2, _mm_set1_ps(p.z), vector);
+
+        vector = _mm_mul_ps(n_col0, _mm_set1_ps(n.x));
+        vector = MUL_ADD(n_col1, _mm_set1_ps(n.y), vector);
+        normals[j] = MUL_ADD(n_col2, _mm_set1_ps(n.z), vector);
+
+        if (skin->tangents) {
+            vec4_t t = skin->bind_tangents[first + j];
+            vector = _mm_mul_ps(col0, _mm_set1_ps(t.x));
+            vector = MUL_ADD(col1, _mm_set1_ps(t.y), vector);
+            vector = MUL_ADD(col2, _mm_set1_ps(t.z), vector);
+            _mm_storeu_ps((float*)&skin->tangents[first + j], vector);
+            skin->tangents[first + j].w = t.w;
+        }
+    }
+    if (count == 4) {
+        store_packed((float*)&skin->positions[first], positions);
+        store_packed((float*)&skin->normals[first], normals);
+    } else {
+        float result[4];
+        for (j = 0; j < count; j++) {
+            _mm_storeu_ps(result, positions[j]);
+            skin->positions[first + j] = vec3_new(result[0], result[1],
+                                                  result[2]);
+            _mm_storeu_ps(result, normals[j]);
+            skin->normals[first + j] = vec3_new(result[0], result[1],
+                                                result[2]);
+        }
+    }
+}
+
+static void skin_linear(skin_t *skin, int first_vertex, int last_vertex) {
+    int i;
+    for (i = first_vertex; i < last_vertex; i += 4) {
+        int remaining = last_vertex - i;
+        skin_linear4(skin, i, remaining < 4 ? remaining : 4);
+    }
+}
+
+#else
+
+static void skin_linear(skin_t *skin, int first_vertex, int last_vertex) {
+    float cols[16];
+    float n_cols[12];
+    int i, j, k;
+
+    for (i = first_vertex; i < last_vertex; i++) {
+        influence_t *influence = &skin->influences[i];
+        vec3_t p = skin->bind_positions[i];
+        vec3_t n = skin->bind_normals[i];
+
+        for (j = 0; j < 16; j++) {
+            cols[j] = 0;
+        }
+        for (j = 0; j < 12; j++) {
+            n_cols[j] = 0;
+        }
+        for (k = 0; k < influence->num_joints; k++) {
+            float *joint_cols = skin->joint_cols[influence->joints[k]];
+            float *joint_n_cols = skin->normal_cols[influence->joints[k]];
+            float weight = influence->weights[k];
+            for (j = 0; j < 16; j++) {
+                cols[j] += weight * joint_cols[j];
+            }
+            for (j = 0; j < 12; j++) {
+                n_cols[j] += weight * joint_n_cols[j];
+            }
+        }
+
+        skin->positions[i] = vec3_new(
+            cols[0] * p.x + cols[4] * p.y + cols[8] * p.z + cols[12],
+            cols[1] * p.x + cols[5] * p.y + cols[9] * p.z + cols[13],
+            cols[2] * p.x + cols[6] * p.y + cols[10] * p.z + cols[14]);
+        skin->normals[i] = vec3_new(
+            n_cols[0] * n.x + n_cols[4] * n.y + n_cols[8] * n.z,
+            n_cols[1] * n.x + n_cols[5] * n.y + n_cols[9] * n.z,
+            n_cols[2] * n.x + n_cols[6] * n.y + n_cols[10] * n.z);
+        if (skin->tangents) {
+            vec4_t t = skin->bind_tangents[i];
+            skin->tangents[i] = vec4_new(
+                cols[0] * t.x + cols[4] * t.y + cols[8] * t.z,
+                cols[1] * t.x + cols[5] * t.y + cols[9] * t.z,
+                cols[2] * t.x + cols[6] * t.y + cols[10] * t.z,
+                t.w);
+        }
+    }
+}
+
+#endif
+
+/* dual quaternion skinning */
+
+/*
+ * the influences are flipped into the hemisphere of the heaviest one, so
+ * that blending takes the shortest path between the rotations
+ */
+static float get_sign(float *dq, float *first_dq) {
+    float dot = dq[0] * first_dq[0] + dq[1] * first_dq[1]
+                + dq[2] * first_dq[2] + dq[3] * first_dq[3];
+    return dot < 0 ? -1.0f : 1.0f;
+}
+
+#if defined(SKINNING_AVX2)
+
+static void blend_dual_quaternion(skin_t *skin, influence_t *influence,
+                                  float blended[8]) {
+    float *first_dq = skin->joint_dqs[influence->joints[0]];
+    __m256 sum = _mm256_setzero_ps();
+    int k;
+    for (k = 0; k < influence->num_joints; k++) {
+        float *dq = skin->joint_dqs[influence->joints[k]];
+        float weight = influence->weights[k] * get_sign(dq, first_dq);
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weight),
+                                               _mm256_loadu_ps(dq)));
+    }
+    _mm256_storeu_ps(blended, sum);
+}
+
+#elif defined(SKINNING_SSE2)
+
+static void blend_dual_quaternion(skin_t *skin, influence_t *influence,
+                                  float blended[8]) {
+    float *first_dq = skin->joint_dqs[influence->joints[0]];
+    __m128 real = _mm_setzero_ps();
+    __m128 dual = _mm_setzero_ps();
+    int k;
+    for (k = 0; k < influence->num_joints; k++) {
+        float *dq = skin->joint_dqs[influence->joints[k]];
+        float weight = influence->weights[k] * get_sign(dq, first_dq);
+        __m128 weights = _mm_set1_ps(weight);
+        real = _mm_add_ps(real, _mm_mul_ps(weights, _mm_loadu_ps(dq)));
+        dual = _mm_add_ps(dual, _mm_mul_ps(weights, _mm_loadu_ps(dq + 4)));
+    }
+    _mm_storeu_ps(blended, real);
+    _mm_storeu_ps(blended + 4, dual);
+}
+
+#else
+
+static void blend_dual_quaternion(skin_t *skin, influence_t *influence,
+                                  float blended[8]) {
+    float *first_dq = skin->joint_dqs[influence->joints[0]];
+    int j, k;
+    for (j = 0; j < 8; j++) {
+        blended[j] = 0;
+    }
+    for (k = 0; k < influence->num_joints; k++) {
+        float *dq = skin->joint_dqs[influence->joints[k]];
+        float weight = influence->weights[k] * get_sign(dq, first_dq);
+        for (j = 0; j < 8; j++) {
+            blended[j] += weight * dq[j];
+        }
+    }
+}
+
+#endif
+
+/* v + 2 * cross(r.xyz, cross(r.xyz, v) + r.w * v) */
+static vec3_t rotate_vector(const float r[4], vec3_t v) {
+    float x = r[1] * v.z - r[2] * v.y + r[3] * v.x;
+    float y = r[2] * v.x - r[0] * v.z + r[3] * v.y;
+    float z = r[0] * v.y - r[1] * v.x + r[3] * v.z;
+    v.x += 2 * (r[1] * z - r[2] * y);
+    v.y += 2 * (r[2] * x - r[0] * z);
+    v.z += 2 * (r[0] * y - r[1] * x);
+    return v;
+}
+
+static vec3_t transform_vector(float *cols, vec3_t v) {
+    return vec3_new(cols[0] * v.x + cols[4] * v.y + cols[8] * v.z,
+                    cols[1] * v.x + cols[5] * v.y + cols[9] * v.z,
+                    cols[2] * v.x + cols[6] * v.y + cols[10] * v.z);
+}
+
+static vec3_t transform_point(float *cols, vec3_t p) {
+    vec3_t v = transform_vector(cols, p);
+    v.x += cols[12];
+    v.y += cols[13];
+    v.z += cols[14];
+    return v;
+}
+
+/* the blended dual quaternion, not yet normalized */
+static void get_blended(skin_t *skin, influence_t *influence, float dq[8]) {
+    if (influence->num_joints == 0) {
+        dq[0] = dq[1] = dq[2] = 0;
+        dq[3] = 1;
+        dq[4] = dq[5] = dq[6] = dq[7] = 0;
+    } else {
+        blend_dual_quaternion(skin, influence, dq);
+    }
+}
+
+static void skin_dual_quaternion1(skin_t *skin, int i) {
+    float *model_cols = skin->model_cols;
+    float *normal_cols = skin->model_n_cols;
+    vec3_t p = skin->bind_positions[i];
+    vec3_t n = skin->bind_normals[i];
+    float dq[8];
+    float length2, factor;
+    int j;
+
+    get_blended(skin, &skin->influences[i], dq);
+    length2 = dq[0] * dq[0] + dq[1] * dq[1] + dq[2] * dq[2] + dq[3] * dq[3];
+    factor = 1 / (float)sqrt(length2);
+    for (j = 0; j < 8; j++) {
+        dq[j] *= factor;
+    }
+
+    /* 2 * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz)) */
+    p = rotate_vector(dq, p);
+    p.x += 2 * (dq[3] * dq[4] - dq[7] * dq[0]
+                + dq[1] * dq[6] - dq[2] * dq[5]);
+    p.y += 2 * (dq[3] * dq[5] - dq[7] * dq[1]
+                + dq[2] * dq[4] - dq[0] * dq[6]);
+    p.z += 2 * (dq[3] * dq[6] - dq[7] * dq[2]
+                + dq[0] * dq[5] - dq[1] * dq[4]);
+
+    skin->positions[i] = transform_point(model_cols, p);
+    skin->normals[i] = transform_vector(normal_cols, rotate_vector(dq, n));
+    if (skin->tangents) {
+        vec4_t t = skin->bind_tangents[i];
+        vec3_t tangent = rotate_vector(dq, vec3_new(t.x, t.y, t.z));
+        tangent = transform_vector(model_cols, tangent);
+        skin->tangents[i] = vec4_new(tangent.x, tangent.y, tangent.z, t.w);
+    }
+}
+
+#if defined(SKINNING_AVX2) || defined(SKINNING_SSE2)
+
+/*
+ * after the blend, four vertices are transformed at once with one vertex
+ * per lane, the same steps as skin_dual_quaternion1
+ */
+
+typedef struct {__m128 x, y, z;} vec3x4_t;
+
+static vec3x4_t load_vec3x4(vec3_t a, vec3_t b, vec3_t c, vec3_t d) {
+    vec3x4_t v;
+    v.x = _mm_setr_ps(a.x, b.x, c.x, d.x);
+    v.y = _mm_setr_ps(a.y, b.y, c.y, d.y);
+    v.z = _mm_setr_ps(a.z, b.z, c.z, d.z);
+    return v;
+}
+
+static void store_vec3x4(vec3x4_t v, float x[4], float y[4], float z[4]) {
+    _mm_storeu_ps(x, v.x);
+    _mm_storeu_ps(y, v.y);
+    _mm_storeu_ps(z, v.z);
+}
+
+static vec3x4_t rotate_vector4(__m128 r[4], vec3x4_t v) {
+    __m128 two = _mm_set1_ps(2);
+    __m128 x = MUL_ADD(r[3], v.x, _mm_sub_ps(_mm_mul_ps(r[1], v.z),
+                                             _mm_mul_ps(r[2], v.y)));
+    __m128 y = MUL_ADD(r[3], v.y, _mm_sub_ps(_mm_mul_ps(r[2], v.x),
+                                             _mm_mul_ps(r[0], v.z)));
+    __m128 z = MUL_ADD(r[3], v.z, _mm_sub_ps(_mm_mul_ps(r[0], v.y),
+                                             _mm_mul_ps(r[1], v.x)));
+    v.x = MUL_ADD(two, _mm_sub_ps(_mm_mul_ps(r[1], z), _mm_mul_ps(r[2], y)),
+                  v.x);
+    v.y = MUL_ADD(two, _mm_sub_ps(_mm_mul_ps(r[2], x), _mm_mul_ps(r[0], z)),
+                  v.y);
+    v.z = MUL_ADD(two, _mm_sub_ps(_mm_mul_ps(r[0], y), _mm_mul_ps(r[1], x)),
+                  v.z);
+    return v;
+}
+
+static vec3x4_t transform_vector4(float *cols, vec3x4_t v) {
+    vec3x4_t result;
+    result.x = _mm_mul_ps(_mm_set1_ps(cols[0]), v.x);
+    result.x = MUL_ADD(_mm_set1_ps(cols[4]), v.y, result.x);
+    result.x = MUL_ADD(_mm_set1_ps(cols[8]), v.z, result.x);
+    result.y = _mm_mul_ps(_mm_set1_ps(cols[1]), v.x);
+    result.y = MUL_ADD(_mm_set1_ps(cols[5]), v.y, result.y);
+    result.y = MUL_ADD(_mm_set1_ps(cols[9]), v.z, result.y);
+    result.z = _mm_mul_ps(_mm_set1_ps(cols[2]), v.x);
+    result.z = MUL_ADD(_mm_set1_ps(cols[6]), v.y, result.z);
+    result.z = MUL_ADD(_mm_set1_ps(cols[10]), v.z, result.z);
+    return result;
+}
+
+static void skin_dual_quaternion4(skin_t *skin, int first) {
+    float *model_cols = skin->model_cols;
+    float *normal_cols = skin->model_n_cols;
+    vec3_t *positions = &skin->bind_positions[first];
+    vec3_t *normals = &skin->bind_normals[first];
+    float dqs[4][8];
+    float x[4], y[4], z[4];
+    __m128 r[4], d[4];
+    __m128 factor, cross;
+    vec3x4_t v;
+    int j;
+
+    for (j = 0; j < 4; j++) {
+        get_blended(skin, &skin->influences[first + j], dqs[j]);
+    }
+    for (j = 0; j < 4; j++) {
+        r[j] = _mm_loadu_ps(dqs[j]);
+        d[j] = _mm_loadu_ps(dqs[j] + 4);
+    }
+    _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+    _MM_TRANSPOSE4_PS(d[0], d[1], d[2], d[3]);
+
+    factor = _mm_mul_ps(r[0], r[0]);
+    factor = MUL_ADD(r[1], r[1], factor);
+    factor = MUL_ADD(r[2], r[2], factor);
+    factor = MUL_ADD(r[3], r[3], factor);
+    factor = _mm_div_ps(_mm_set1_ps(1), _mm_sqrt_ps(factor));
+    for (j = 0; j < 4; j++) {
+        r[j] = _mm_mul_ps(r[j], factor);
+        d[j] = _mm_mul_ps(d[j], factor);
+    }
+
+    /* 2 * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz)) */
+    v = load_vec3x4(positions[0], positions[1], positions[2], positions[3]);
+    v = rotate_vector4(r, v);
+    cross = _mm_sub_ps(_mm_mul_ps(r[1], d[2]), _mm_mul_ps(r[2], d[1]));
+    cross = _mm_add_ps(cross, _mm_sub_ps(_mm_mul_ps(r[3], d[0]),
+                                         _mm_mul_ps(d[3], r[0])));
+    v.x = MUL_ADD(_mm_set1_ps(2), cross, v.x);
+    cross = _mm_sub_ps(_mm_mul_ps(r[2], d[0]), _mm_mul_ps(r[0], d[2]));
+    cross = _mm_add_ps(cross, _mm_sub_ps(_mm_mul_ps(r[3], d[1]),
+                                         _mm_mul_ps(d[3], r[1])));
+    v.y = MUL_ADD(_mm_set1_ps(2), cross, v.y);
+    cross = _mm_sub_ps(_mm_mul_ps(r[0], d[1]), _mm_mul_ps(r[1], d[0]));
+    cross = _mm_add_ps(cross, _mm_sub_ps(_mm_mul_ps(r[3], d[2]),
+                                         _mm_mul_ps(d[3], r[2])));
+    v.z = MUL_ADD(_mm_set1_ps(2), cross, v.z);
+    v = transform_vector4(model_cols, v);
+    v.x = _mm_add_ps(v.x, _mm_set1_ps(model_cols[12]));
+    v.y = _mm_add_ps(v.y, _mm_set1_ps(model_cols[13]));
+    v.z = _mm_add_ps(v.z, _mm_set1_ps(model_cols[14]));
+    store_vec3x4(v, x, y, z);
+    for (j = 0; j < 4; j++) {
+        skin->positions[first + j] = vec3_new(x[j], y[j], z[j]);
+    }
+
+    v = load_vec3x4(normals[0], normals[1], normals[2], normals[3]);
+    v = transform_vector4(normal_cols, rotate_vector4(r, v));
+    store_vec3x4(v, x, y, z);
+    for (j = 0; j < 4; j++) {
+        skin->normals[first + j] = vec3_new(x[j], y[j], z[j]);
+    }
+
+    if (skin->tangents) {
+        vec4_t *tangents = &skin->bind_tangents[first];
+        v.x = _mm_setr_ps(tangents[0].x, tangents[1].x,
+                          tangents[2].x, tangents[3].x);
+        v.y = _mm_setr_ps(tangents[0].y, tangents[1].y,
+                          tangents[2].y, tangents[3].y);
+        v.z = _mm_setr_ps(tangents[0].z, tangents[1].z,
+                          tangents[2].z, tangents[3].z);
+        v = transform_vector4(model_cols, rotate_vector4(r, v));
+        store_vec3x4(v, x, y, z);
+        for (j = 0; j < 4; j++) {
+            skin->tangents[first + j] = vec4_new(x[j], y[j], z[j],
+                                                 tangents[j].w);
+        }
+    }
+}
+
+#endif
+
+static void skin_dual_quaternion(skin_t *skin, int first_vertex,
+                                 int last_vertex) {
+    int i = first_vertex;
+#if defined(SKINNING_AVX2) || defined(SKINNING_SSE2)
+    for (; i + 4 <= last_vertex; i += 4) {
+        skin_dual_quaternion4(skin, i);
+    }
+#endif
+    for (; i < last_vertex; i++) {
+        skin_dual_quaternion1(skin, i);
+    }
+}
+
+/* skinning */
+
+static void skin_range(void *skin_, int first_vertex, int last_vertex) {
+    skin_t *skin = (skin_t*)skin_;
+    if (skin->method == SKINNING_LINEAR) {
+        skin_linear(skin, first_vertex, last_vertex);
+    } else {
+        skin_dual_quaternion(skin, first_vertex, last_vertex);
+    }
+}
+
+/*
+ * skins the vertices once after each update, later calls return at once,
+ * so a model culled by every pass is never skinned, large meshes are split
+ * into batches skinned by the job system
+ */
+void skin_apply(skin_t *skin) {
+    if (!skin->dirty) {
+        return;
+    }
+    job_parallel_for(skin_range, skin, skin->num_vertices, BATCH_SIZE);
+    skin->dirty = 0;
+}
+
+/* skinned streams */
+
+int skin_get_num_vertices(skin_t *skin) {
+    return skin->num_vertices;
+}
+
+vec3_t *skin_get_positions(skin_t *skin) {
+    assert(!skin->dirty);
+    return skin->positions;
+}
+
+vec3_t *skin_get_normals(skin_t *skin) {
+    assert(!skin->dirty);
+    return skin->normals;
+}
+
+vec4_t *skin_get_tangents(skin_t *skin) {
+    assert(!skin->dirty && skin->tangents != NULL);
+    return skin->tangents;
+}
+
+/* meshlet bounds */
+
+/*
+ * gives the same bounds as meshopt_compute_meshlet_bounds, but the face
+ * normals are computed once and the math is kept inline, a meshlet whose
+ * bind pose cone already spans a hemisphere only gets its sphere refitted
+ */
+static void refit_meshlet(skin_t *skin, meshlet_t *meshlet,
+                          meshlet_t *bind_meshlet) {
+    unsigned int *indices = skin->indices + meshlet->first_index;
+    vec3_t *normals = skin->face_normals + meshlet->first_index / 3;
+    vec3_t *positions = skin->positions;
+    int num_triangles = meshlet->num_indices / 3;
+    float min_x = +1e6f, min_y = +1e6f, min_z = +1e6f;
+    float max_x = -1e6f, max_y = -1e6f, max_z = -1e6f;
+    float axis_x = 0, axis_y = 0, axis_z = 0;
+    float center_x, center_y, center_z;
+    float max_distance2 = 0;
+    float axis_length;
+    float min_dot = 1;
+    int num_normals = 0;
+    int i;
+
+    for (i = 0; i < meshlet->num_indices; i++) {
+        vec3_t p = positions[indices[i]];
+        min_x = p.x < min_x ? p.x : min_x;
+        min_y = p.y < min_y ? p.y : min_y;
+        min_z = p.z < min_z ? p.z : min_z;
+        max_x = p.x > max_x ? p.x : max_x;
+        max_y = p.y > max_y ? p.y : max_y;
+        max_z = p.z > max_z ? p.z : max_z;
+    }
+    center_x = (min_x + max_x) / 2;
+    center_y = (min_y + max_y) / 2;
+    center_z = (min_z + max_z) / 2;
+    for (i = 0; i < meshlet->num_indices; i++) {
+        vec3_t p = positions[indices[i]];
+        float d_x = p.x - center_x, d_y = p.y - center_y, d_z = p.z - center_z;
+        float distance2 = d_x * d_x + d_y * d_y + d_z * d_z;
+        max_distance2 = distance2 > max_distance2 ? distance2 : max_distance2;
+    }
+    meshlet->center.x = center_x;
+    meshlet->center.y = center_y;
+    meshlet->center.z = center_z;
+    meshlet->radius = (float)sqrt(max_distance2);
+    if (bind_meshlet->cone_cutoff >= 1) {
+        meshlet->cone_cutoff = 1;
+        return;
+    }
+
+    for (i = 0; i < num_triangles; i++) {
+        vec3_t a = positions[indices[i * 3 + 0]];
+        vec3_t b = positions[indices[i * 3 + 1]];
+        vec3_t c = positions[indices[i * 3 + 2]];
+        float ab_x = b.x - a.x, ab_y = b.y - a.y, ab_z = b.z - a.z;
+        float ac_x = c.x - a.x, ac_y = c.y - a.y, ac_z = c.z - a.z;
+        float n_x = ab_y * ac_z - ab_z * ac_y;
+        float n_y = ab_z * ac_x - ab_x * ac_z;
+        float n_z = ab_x * ac_y - ab_y * ac_x;
+        float length = (float)sqrt(n_x * n_x + n_y * n_y + n_z * n_z);
+        if (length > 0) {
+            n_x /= length;
+            n_y /= length;
+            n_z /= length;
+        }
+        normals[i].x = n_x;
+        normals[i].y = n_y;
+        normals[i].z = n_z;
+        axis_x += n_x;
+        axis_y += n_y;
+        axis_z += n_z;
+    }
+    axis_length = (float)sqrt(axis_x * axis_x + axis_y * axis_y
+                              + axis_z * axis_z);
+    if (axis_length > 0) {
+        axis_x /= axis_length;
+        axis_y /= axis_length;
+        axis_z /= axis_length;
+        for (i = 0; i < num_triangles; i++) {
+            vec3_t n = normals[i];
+            if (n.x != 0 || n.y != 0 || n.z != 0) {
+                float dot = n.x * axis_x + n.y * axis_y + n.z * axis_z;
+                min_dot = dot < min_dot ? dot : min_dot;
+                num_normals += 1;
+            }
+        }
+    }
+    meshlet->cone_axis.x = axis_x;
+    meshlet->cone_axis.y = axis_y;
+    meshlet->cone_axis.z = axis_z;
+    if (num_normals == 0 || min_dot <= 0) {
+        meshlet->cone_cutoff = 1;  /* spans a hemisphere, never culled */
+    } else {
+        meshlet->cone_cutoff = (float)sqrt(1 - min_dot * min_dot);
+    }
+}
+
+static void refit_range(void *skin_, int first_meshlet, int last_meshlet) {
+    skin_t *skin = (skin_t*)skin_;
+    meshlet_t *meshlets = skin->meshlets + skin->refitted->first_meshlet;
+    meshlet_t *bind_meshlets = skin->bind_meshlets
+                               + skin->refitted->first_meshlet;
+    int i;
+    for (i = first_meshlet; i < last_meshlet; i++) {
+        refit_meshlet(skin, &meshlets[i], &bind_meshlets[i]);
+    }
+}
+
+/*
+ * the bind pose spheres and cones no longer hold once the vertices move,
+ * so the meshlets of the drawn level are refitted to the skinned positions
+ * once per update, the shadow and main passes then cull them in world space
+ */
+meshlet_t *skin_get_meshlets(skin_t *skin, lod_t *lod) {
+    assert(!skin->dirty);
+    assert(lod->first_meshlet + lod->num_meshlets <= skin->num_meshlets);
+    if (skin->refitted != lod) {
+        skin->refitted = lod;
+        job_parallel_for(refit_range, skin, lod->num_meshlets,
+                         MESHLET_BATCH);
+    }
+    return skin->meshlets + lod->first_meshlet;
+}
@@ -0,0 +1,31 @@
+#ifndef SKINNING_H
+#define SKINNING_H
+
+#include "maths.h"
+#include "mesh.h"
+
+typedef struct skin skin_t;
+
+typedef enum {
+    SKINNING_LINEAR,          /* linear blend of the joint matrices */
+    SKINNING_DUAL_QUATERNION  /* no volume loss, ignores joint scaling */
+} skinning_t;
+
+/* skin creating/releasing */
+skin_t *skin_create(mesh_t *mesh, int with_tangents);
+void skin_release(skin_t *skin);
+void skin_set_method(skin_t *skin, skinning_t method);
+
+/* skinning */
+void skin_update(skin_t *skin, mat4_t model_matrix, mat3_t normal_matrix,
+                 mat4_t *joint_matrices, mat3_t *joint_n_matrices);
+void skin_apply(skin_t *skin);
+
+/* skinned streams, in world space */
+int skin_get_num_vertices(skin_t *skin);
+vec3_t *skin_get_positions(skin_t *skin);
+vec3_t *skin_get_normals(skin_t *skin);
+vec4_t *skin_get_tangents(skin_t *skin);
+meshlet_t *skin_get_meshlets(skin_t *skin, lod_t *lod);
+
+#endif
@@ -4,9 +4,18 @@
 #include <string.h>
 #include "graphics.h"
 #include "image.h"
+#include "macro.h"
 #include "maths.h"
 #include "texture.h"
 
+#if defined(TEXTURE_NO_SIMD)
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define TEXTURE_SSE2
+#endif
+
+#define POISSON_RADIUS 1.5f  /* in texels */
+
 /* texture related functions */
 
 texture_t *texture_create(int width, int height) {
@@ -271,3 +280,233 @@ vec4_t cubemap_clamp_sample(cubemap_t *cubemap, vec3_t direction) {
 vec4_t cubemap_sample(cubemap_t *cubemap, vec3_t direction) {
     return cubemap_repeat_sample(cubemap, direction);
 }
+
+/* depthmap related functions */
+
+/*
+ * the depthmap is a view of the depth plane, so a shadow pass can be
+ * sampled directly without copying the depth into a texture every frame
+ */
+depthmap_t *depthmap_from_depthbuffer(framebuffer_t *framebuffer) {
+    depthmap_t *depthmap = (depthmap_t*)malloc(sizeof(depthmap_t));
+    depthmap->width = framebuffer->width;
+    depthmap->height = framebuffer->height;
+    depthmap->buffer = framebuffer->depth_buffer;
+    return depthmap;
+}
+
+void depthmap_release(depthmap_t *depthmap) {
+    free(depthmap);
+}
+
+/*
+ * for percentage-closer filtering, see
+ * https://developer.nvidia.com/gpugems/gpugems/part-ii-lighting-and-shadows/chapter-11-shadow-map-antialiasing
+ */
+
+static int clamp_index(int index, int size) {
+    return index < 0 ? 0 : (index >= size ? size - 1 : index);
+}
+
+/*
+ * compares the four nearest texels against depth and filters the results
+ * bilinearly (like a hardware shadow sampler), returns the lit fraction,
+ * with SSE2 the four compares and the weighting take one register
+ */
+float depthmap_compare_sample(depthmap_t *depthmap, vec2_t texcoord,
+                              float depth) {
+    int width = depthmap->width;
+    int height = depthmap->height;
+    float x = texcoord.x * (float)width - 0.5f;
+    float y = texcoord.y * (float)height - 0.5f;
+    int c = (int)floor(x);
+    int r = (int)floor(y);
+    float tx = x - (float)c;
+    float ty = y - (float)r;
+    int c0 = clamp_index(c, width);
+    int c1 = clamp_index(c + 1, width);
+    float *row0 = depthmap->buffer + clamp_index(r, height) * width;
+    float *row1 = depthmap->buffer + clamp_index(r + 1, height) * width;
+#if defined(TEXTURE_SSE2)
+    __m128 texels = _mm_setr_ps(row0[c0], row0[c1], row1[c0], row1[c1]);
+    __m128 lit = _mm_and_ps(_mm_cmple_ps(_mm_set1_ps(depth), texels),
+                            _mm_set1_ps(1));
+    __m128 weights = _mm_mul_ps(_mm_setr_ps(1 - tx, tx, 1 - tx, tx),
+                                _mm_setr_ps(1 - ty, 1 - ty, ty, ty));
+    __m128 sum = _mm_mul_ps(lit, weights);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(sum);
+#else
+    float lit00 = depth <= row0[c0] ? 1.0f : 0;
+    float lit01 = depth <= row0[c1] ? 1.0f : 0;
+    float lit10 = depth <= row1[c0] ? 1.0f : 0;
+    float lit11 = depth <= row1[c1] ? 1.0f : 0;
+    float top = float_lerp(lit00, lit01, tx);
+    float bottom = float_lerp(lit10, lit11, tx);
+    return float_lerp(top, bottom, ty);
+#endif
+}
+
+/* four bilinear compares half a texel around texcoord, a 3x3 tent */
+float depthmap_compare_2x2(depthmap_t *depthmap, vec2_t texcoord,
+                           float depth) {
+    float offset_u = 0.5f / (float)depthmap->width;
+    float offset_v = 0.5f / (float)depthmap->height;
+    float lit = 0;
+    lit += depthmap_compare_sample(
+        depthmap, vec2_new(texcoord.x - offset_u, texcoord.y - offset_v),
+        depth);
+    lit += depthmap_compare_sample(
+        depthmap, vec2_new(texcoord.x + offset_u, texcoord.y - offset_v),
+        depth);
+    lit += depthmap_compare_sample(
+        depthmap, vec2_new(texcoord.x - offset_u, texcoord.y + offset_v),
+        depth);
+    lit += depthmap_compare_sample(
+        depthmap, vec2_new(texcoord.x + offset_u, texcoord.y + offset_v),
+        depth);
+    return lit / 4;
+}
+
+static const float POISSON_DISK[8][2] = {
+    {-0.942016f, -0.399062f}, {0.945586f, -0.768907f},
+    {-0.094184f, -0.929389f}, {0.344959f, 0.293878f},
+    {-0.915886f, 0.457714f}, {-0.815442f, -0.879125f},
+    {-0.382775f, 0.276768f}, {0.974844f, 0.756484f},
+};
+
+/*
+ * poisson disk of bilinear compare taps, radius is in texels, the disk is
+ * rotated by a hash of texcoord to turn banding into noise
+ */
+float depthmap_compare_filter(depthmap_t *depthmap, vec2_t texcoord,
+                              float depth, float radius) {
+    float hash = (float)sin(texcoord.x * 12.9898f + texcoord.y * 78.233f);
+    float noise = hash * 43758.545f;
+    float angle = (noise - (float)floor(noise)) * 2 * PI;
+    float cos_angle = (float)cos(angle);
+    float sin_angle = (float)sin(angle);
+    float scale_u = radius / (float)depthmap->width;
+    float scale_v = radius / (float)depthmap->height;
+    float lit = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        float x = POISSON_DISK[i][0];
+        float y = POISSON_DISK[i][1];
+        float u = texcoord.x + (x * cos_angle - y * sin_angle) * scale_u;
+        float v = texcoord.y + (x * sin_angle + y * cos_angle) * scale_v;
+        lit += depthmap_compare_sample(depthmap, vec2_new(u, v), depth);
+    }
+    return lit / 8;
+}
+
+/* the lit fraction with the filter of the scene */
+float depthmap_compare(depthmap_t *depthmap, shadow_filter_t filter,
+                       vec2_t texcoord, float depth) {
+    if (filter == SHADOW_FILTER_SAMPLE) {
+        return depthmap_compare_sample(depthmap, texcoord, depth);
+    } else if (filter == SHADOW_FILTER_2X2) {
+        return depthmap_compare_2x2(depthmap, texcoord, depth);
+    } else {
+        assert(filter == SHADOW_FILTER_POISSON);
+        return depthmap_compare_filter(depthmap, texcoord, depth,
+                                       POISSON_RADIUS);
+    }
+}
+
+/* mipcube related functions */
+
+mipcube_t *mipcube_create(int num_levels, int sizes[]) {
+    int num_texels = 0;
+    mipcube_t *mipcube;
+    int i;
+
+    assert(num_levels > 0 && num_levels <= MAX_MIP_LEVELS);
+
+    mipcube = (mipcube_t*)malloc(sizeof(mipcube_t));
+    mipcube->num_levels = num_levels;
+    for (i = 0; i < num_levels; i++) {
+        assert(sizes[i] > 0);
+        mipcube->sizes[i] = sizes[i];
+        num_texels += sizes[i] * sizes[i] * 6;
+    }
+    mipcube->buffer = (vec4_t*)malloc(sizeof(vec4_t) * num_texels);
+    memset(mipcube->buffer, 0, sizeof(vec4_t) * num_texels);
+
+    num_texels = 0;
+    for (i = 0; i < num_levels; i++) {
+        mipcube->levels[i] = mipcube->buffer + num_texels;
+        num_texels += sizes[i] * sizes[i] * 6;
+    }
+
+    return mipcube;
+}
+
+void mipcube_release(mipcube_t *mipcube) {
+    free(mipcube->buffer);
+    free(mipcube);
+}
+
+void mipcube_set_level(mipcube_t *mipcube, int level, cubemap_t *cubemap) {
+    int size, i;
+
+    assert(level >= 0 && level < mipcube->num_levels);
+    size = mipcube->sizes[level];
+    for (i = 0; i < 6; i++) {
+        texture_t *face = cubemap->faces[i];
+        vec4_t *target = mipcube->levels[level] + size * size * i;
+        assert(face->width == size && face->height == size);
+        memcpy(target, face->buffer, sizeof(vec4_t) * size * size);
+    }
+}
+
+static vec4_t bilinear_sample(vec4_t *texels, int size, vec2_t texcoord) {
+    float x = float_saturate(texcoord.x) * (float)size - 0.5f;
+    float y = float_saturate(texcoord.y) * (float)size - 0.5f;
+    int x0 = (int)floor(x);
+    int y0 = (int)floor(y);
+    float tx = x - (float)x0;
+    float ty = y - (float)y0;
+    int x1 = x0 + 1 < size ? x0 + 1 : size - 1;
+    int y1 = y0 + 1 < size ? y0 + 1 : size - 1;
+    vec4_t top, bottom;
+
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    top = vec4_lerp(texels[y0 * size + x0], texels[y0 * size + x1], tx);
+    bottom = vec4_lerp(texels[y1 * size + x0], texels[y1 * size + x1], tx);
+    return vec4_lerp(top, bottom, ty);
+}
+
+static vec4_t sample_level(mipcube_t *mipcube, int level,
+                           int face_index, vec2_t texcoord) {
+    int size = mipcube->sizes[level];
+    vec4_t *texels = mipcube->levels[level] + size * size * face_index;
+    return bilinear_sample(texels, size, texcoord);
+}
+
+/*
+ * trilinear filtering, bilinear within the two nearest levels and
+ * linear across them, edges are clamped within each face
+ */
+vec4_t mipcube_sample(mipcube_t *mipcube, vec3_t direction, float lod) {
+    float max_lod = (float)(mipcube->num_levels - 1);
+    vec2_t texcoord;
+    int face_index = select_cubemap_face(direction, &texcoord);
+    int level;
+    float t;
+
+    texcoord.y = 1 - texcoord.y;
+    lod = float_clamp(lod, 0, max_lod);
+    level = (int)lod;
+    t = lod - (float)level;
+    if (t > 0 && level + 1 < mipcube->num_levels) {
+        vec4_t curr = sample_level(mipcube, level, face_index, texcoord);
+        vec4_t next = sample_level(mipcube, level + 1, face_index, texcoord);
+        return vec4_lerp(curr, next, t);
+    } else {
+        return sample_level(mipcube, level, face_index, texcoord);
+    }
+}
@@ -20,6 +20,26 @@ typedef struct {
     texture_t *faces[6];
 } cubemap_t;
 
+typedef struct {
+    int width, height;
+    float *buffer;  /* not owned, usually the depth plane of a framebuffer */
+} depthmap_t;
+
+typedef enum {
+    SHADOW_FILTER_SAMPLE,   /* one bilinear compare */
+    SHADOW_FILTER_2X2,      /* a 2x2 grid of them, the default */
+    SHADOW_FILTER_POISSON   /* eight on a rotated poisson disk */
+} shadow_filter_t;
+
+#define MAX_MIP_LEVELS 16
+
+typedef struct {
+    int num_levels;
+    int sizes[MAX_MIP_LEVELS];      /* face size of each level */
+    vec4_t *levels[MAX_MIP_LEVELS]; /* six faces of each level in a row */
+    vec4_t *buffer;                 /* all levels in a single allocation */
+} mipcube_t;
+
 /* texture related functions */
 texture_t *texture_create(int width, int height);
 void texture_release(texture_t *texture);
@@ -40,4 +60,22 @@ vec4_t cubemap_repeat_sample(cubemap_t *cubemap, vec3_t direction);
 vec4_t cubemap_clamp_sample(cubemap_t *cubemap, vec3_t direction);
 vec4_t cubemap_sample(cubemap_t *cubemap, vec3_t direction);
 
+/* depthmap related functions */
+depthmap_t *depthmap_from_depthbuffer(framebuffer_t *framebuffer);
+void depthmap_release(depthmap_t *depthmap);
+float depthmap_compare_sample(depthmap_t *depthmap, vec2_t texcoord,
+                              float depth);
+float depthmap_compare_2x2(depthmap_t *depthmap, vec2_t texcoord,
+                           float depth);
+float depthmap_compare_filter(depthmap_t *depthmap, vec2_t texcoord,
+                              float depth, float radius);
+float depthmap_compare(depthmap_t *depthmap, shadow_filter_t filter,
+                       vec2_t texcoord, float depth);
+
+/* mipcube related functions */
+mipcube_t *mipcube_create(int num_levels, int sizes[]);
+void mipcube_release(mipcube_t *mipcube);
+void mipcube_set_level(mipcube_t *mipcube, int level, cubemap_t *cubemap);
+vec4_t mipcube_sample(mipcube_t *mipcube, vec3_t direction, float lod);
+
 #endif
@@ -4,8 +4,12 @@
 #include <time.h>
 #include "core/api.h"
 #include "shaders/cache_helper.h"
+#include "tests/test_bake.h"
 #include "tests/test_blinn.h"
+#include "tests/test_meshopt.h"
+#include "tests/test_palette.h"
 #include "tests/test_pbr.h"
+#include "tests/test_skinning.h"
 
 typedef void testfunc_t(int argc, char *argv[]);
 /* 定义结构体：包含  测试项名称 和 测试函数指针 */
@@ -15,8 +19,15 @@ static testcase_t g_testcases[] = {
     /*渲染方式, 对应函数*/   
     {"blinn", test_blinn},
     {"pbr", test_pbr},
+    /* tools rather than demos, keep them last */
+    {"skinning", test_skinning},
+    {"bake", test_bake},
+    {"palette", test_palette},
+    {"meshopt", test_meshopt},
 };
 
+#define NUM_TOOLS 4
+
 int main(int argc, char *argv[]) {
     int num_testcases = ARRAY_SIZE(g_testcases);
     const char *testname = NULL;  /*测试项名称*/ 
@@ -25,6 +36,7 @@ int main(int argc, char *argv[]) {
 
     srand((unsigned int)time(NULL));
     platform_initialize();
+    job_initialize(0, 0);
 
     /*解析命令行参数*/
     if (argc > 1) {
@@ -36,7 +48,7 @@ int main(int argc, char *argv[]) {
             }
         }
     } else {
-        i = rand() % num_testcases;  /*随机一个类型*/
+        i = rand() % (num_testcases - NUM_TOOLS);  /*随机一个类型*/
         testname = g_testcases[i].testname;
         testfunc = g_testcases[i].testfunc;
     }
@@ -57,6 +69,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    job_terminate();
     platform_terminate();
     cache_cleanup();
 
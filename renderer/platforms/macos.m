@@ -1,9 +1,13 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <Cocoa/Cocoa.h>
 #include <mach-o/dyld.h>
 #include <mach/mach_time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include "../core/graphics.h"
 #include "../core/image.h"
@@ -336,6 +340,153 @@ void input_set_callbacks(window_t *window, callbacks_t callbacks) {
     window->callbacks = callbacks;
 }
 
+/* thread related functions */
+
+struct thread {
+    pthread_t handle;
+    threadfunc_t *threadfunc;
+    void *userdata;
+};
+
+static void *thread_entry(void *thread_) {
+    thread_t *thread = (thread_t*)thread_;
+    thread->threadfunc(thread->userdata);
+    return NULL;
+}
+
+thread_t *thread_create(threadfunc_t *threadfunc, void *userdata) {
+    thread_t *thread = (thread_t*)malloc(sizeof(thread_t));
+    int error;
+    thread->threadfunc = threadfunc;
+    thread->userdata = userdata;
+    error = pthread_create(&thread->handle, NULL, thread_entry, thread);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    return thread;
+}
+
+void thread_join(thread_t *thread) {
+    pthread_join(thread->handle, NULL);
+    free(thread);
+}
+
+/* threads can only be given affinity tags on macos, not pinned */
+int thread_set_affinity(thread_t *thread, int core) {
+    UNUSED_VAR(thread);
+    UNUSED_VAR(core);
+    return 0;
+}
+
+static pthread_key_t g_local_key;
+static pthread_once_t g_local_once = PTHREAD_ONCE_INIT;
+
+static void create_local_key(void) {
+    int error = pthread_key_create(&g_local_key, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+}
+
+void thread_set_local(void *value) {
+    pthread_once(&g_local_once, create_local_key);
+    pthread_setspecific(g_local_key, value);
+}
+
+void *thread_get_local(void) {
+    pthread_once(&g_local_once, create_local_key);
+    return pthread_getspecific(g_local_key);
+}
+
+/* synchronization functions */
+
+struct mutex {
+    pthread_mutex_t handle;
+};
+
+struct condition {
+    pthread_cond_t handle;
+};
+
+mutex_t *mutex_create(void) {
+    mutex_t *mutex = (mutex_t*)malloc(sizeof(mutex_t));
+    int error = pthread_mutex_init(&mutex->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    return mutex;
+}
+
+void mutex_destroy(mutex_t *mutex) {
+    pthread_mutex_destroy(&mutex->handle);
+    free(mutex);
+}
+
+void mutex_lock(mutex_t *mutex) {
+    pthread_mutex_lock(&mutex->handle);
+}
+
+void mutex_unlock(mutex_t *mutex) {
+    pthread_mutex_unlock(&mutex->handle);
+}
+
+condition_t *condition_create(void) {
+    condition_t *condition = (condition_t*)malloc(sizeof(condition_t));
+    int error = pthread_cond_init(&condition->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    return condition;
+}
+
+void condition_destroy(condition_t *condition) {
+    pthread_cond_destroy(&condition->handle);
+    free(condition);
+}
+
+void condition_wait(condition_t *condition, mutex_t *mutex) {
+    pthread_cond_wait(&condition->handle, &mutex->handle);
+}
+
+void condition_broadcast(condition_t *condition) {
+    pthread_cond_broadcast(&condition->handle);
+}
+
+/* file mapping functions */
+
+void *file_map(const char *filename, int *size) {
+    struct stat status;
+    void *data;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (int)status.st_size;
+    return data;
+}
+
+void file_unmap(void *data, int size) {
+    munmap(data, (size_t)size);
+}
+
+/* the size and the modification time in seconds, 0 if there is no file */
+int file_get_status(const char *filename, long *size, double *mtime) {
+    struct stat status;
+    if (stat(filename, &status) != 0) {
+        return 0;
+    }
+    *size = (long)status.st_size;
+    *mtime = (double)status.st_mtimespec.tv_sec + (double)status.st_mtimespec.tv_nsec / 1e9;
+    return 1;
+}
+
 /* misc platform functions */
 
 static double get_native_time(void) {
@@ -355,3 +506,8 @@ float platform_get_time(void) {
     }
     return (float)(get_native_time() - initial);
 }
+
+int platform_get_num_cores(void) {
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return num_cores > 0 ? (int)num_cores : 1;
+}
@@ -317,6 +317,159 @@ void input_set_callbacks(window_t *window, callbacks_t callbacks) {
     window->callbacks = callbacks;
 }
 
+/* thread related functions */
+
+struct thread {
+    HANDLE handle;
+    threadfunc_t *threadfunc;
+    void *userdata;
+};
+
+static DWORD WINAPI thread_entry(LPVOID thread_) {
+    thread_t *thread = (thread_t*)thread_;
+    thread->threadfunc(thread->userdata);
+    return 0;
+}
+
+thread_t *thread_create(threadfunc_t *threadfunc, void *userdata) {
+    thread_t *thread = (thread_t*)malloc(sizeof(thread_t));
+    thread->threadfunc = threadfunc;
+    thread->userdata = userdata;
+    thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+    assert(thread->handle != NULL);
+    return thread;
+}
+
+void thread_join(thread_t *thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    free(thread);
+}
+
+/* pins the thread to a core, returns whether the platform supports it */
+int thread_set_affinity(thread_t *thread, int core) {
+    DWORD_PTR mask = (DWORD_PTR)1 << (core % (int)(sizeof(DWORD_PTR) * 8));
+    return SetThreadAffinityMask(thread->handle, mask) != 0;
+}
+
+/*
+ * the slot is allocated on first use, which must happen on one thread
+ * before any other thread gets to it
+ */
+static DWORD g_local_index = TLS_OUT_OF_INDEXES;
+
+void thread_set_local(void *value) {
+    if (g_local_index == TLS_OUT_OF_INDEXES) {
+        g_local_index = TlsAlloc();
+        assert(g_local_index != TLS_OUT_OF_INDEXES);
+    }
+    TlsSetValue(g_local_index, value);
+}
+
+void *thread_get_local(void) {
+    if (g_local_index == TLS_OUT_OF_INDEXES) {
+        return NULL;
+    }
+    return TlsGetValue(g_local_index);
+}
+
+/* synchronization functions, condition variables need windows vista */
+
+struct mutex {
+    CRITICAL_SECTION handle;
+};
+
+struct condition {
+    CONDITION_VARIABLE handle;
+};
+
+mutex_t *mutex_create(void) {
+    mutex_t *mutex = (mutex_t*)malloc(sizeof(mutex_t));
+    InitializeCriticalSection(&mutex->handle);
+    return mutex;
+}
+
+void mutex_destroy(mutex_t *mutex) {
+    DeleteCriticalSection(&mutex->handle);
+    free(mutex);
+}
+
+void mutex_lock(mutex_t *mutex) {
+    EnterCriticalSection(&mutex->handle);
+}
+
+void mutex_unlock(mutex_t *mutex) {
+    LeaveCriticalSection(&mutex->handle);
+}
+
+condition_t *condition_create(void) {
+    condition_t *condition = (condition_t*)malloc(sizeof(condition_t));
+    InitializeConditionVariable(&condition->handle);
+    return condition;
+}
+
+void condition_destroy(condition_t *condition) {
+    free(condition);
+}
+
+void condition_wait(condition_t *condition, mutex_t *mutex) {
+    SleepConditionVariableCS(&condition->handle, &mutex->handle, INFINITE);
+}
+
+void condition_broadcast(condition_t *condition) {
+    WakeAllConditionVariable(&condition->handle);
+}
+
+/* file mapping functions */
+
+void *file_map(const char *filename, int *size) {
+    HANDLE file, mapping;
+    DWORD high_size, low_size;
+    void *data;
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    low_size = GetFileSize(file, &high_size);
+    if (low_size == 0 || high_size != 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) {
+        return NULL;
+    }
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == NULL) {
+        return NULL;
+    }
+    *size = (int)low_size;
+    return data;
+}
+
+void file_unmap(void *data, int size) {
+    UnmapViewOfFile(data);
+    UNUSED_VAR(size);
+}
+
+/* the size and the modification time in seconds, 0 if there is no file */
+int file_get_status(const char *filename, long *size, double *mtime) {
+    WIN32_FILE_ATTRIBUTE_DATA status;
+    ULARGE_INTEGER ticks;  /* of 100 nanoseconds */
+    if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &status)) {
+        return 0;
+    }
+    ticks.LowPart = status.ftLastWriteTime.dwLowDateTime;
+    ticks.HighPart = status.ftLastWriteTime.dwHighDateTime;
+    *size = (long)status.nFileSizeLow;
+    *mtime = (double)ticks.QuadPart / 1e7;
+    return 1;
+}
+
 /* misc platform functions */
 
 static double get_native_time(void) {
@@ -338,3 +491,9 @@ float platform_get_time(void) {
     }
     return (float)(get_native_time() - initial);
 }
+
+int platform_get_num_cores(void) {
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return (int)system_info.dwNumberOfProcessors;
+}
@@ -12,6 +12,7 @@ typedef struct {
     char environment[LINE_SIZE];
     char skybox[LINE_SIZE];
     char shadow[LINE_SIZE];
+    char shadow_filter[LINE_SIZE];
     float ambient;
     float punctual;
 } scene_light_t;
@@ -69,6 +70,7 @@ typedef struct {
     int index;
     char mesh[LINE_SIZE];
     char skeleton[LINE_SIZE];
+    char skinning[LINE_SIZE];
     int attached;
     int material;
     int transform;
@@ -95,6 +97,26 @@ static int wrap_knob(const char *knob) {
     }
 }
 
+static skinning_t wrap_skinning(const char *skinning) {
+    if (equals_to(skinning, "dual_quaternion")) {
+        return SKINNING_DUAL_QUATERNION;
+    } else {
+        assert(equals_to(skinning, "linear"));
+        return SKINNING_LINEAR;
+    }
+}
+
+static shadow_filter_t wrap_shadow_filter(const char *shadow_filter) {
+    if (equals_to(shadow_filter, "sample")) {
+        return SHADOW_FILTER_SAMPLE;
+    } else if (equals_to(shadow_filter, "poisson")) {
+        return SHADOW_FILTER_POISSON;
+    } else {
+        assert(equals_to(shadow_filter, "2x2"));
+        return SHADOW_FILTER_2X2;
+    }
+}
+
 static scene_light_t read_light(FILE *file) {
     scene_light_t light;
     char header[LINE_SIZE];
@@ -113,6 +135,11 @@ static scene_light_t read_light(FILE *file) {
     assert(items == 1);
     items = fscanf(file, " shadow: %s", light.shadow);
     assert(items == 1);
+    /* optional, a 2x2 grid of bilinear compares when left out */
+    items = fscanf(file, " shadow_filter: %s", light.shadow_filter);
+    if (items != 1) {
+        strcpy(light.shadow_filter, "2x2");
+    }
     items = fscanf(file, " ambient: %f", &light.ambient);
     assert(items == 1);
     items = fscanf(file, " punctual: %f", &light.punctual);
@@ -332,6 +359,11 @@ static scene_model_t read_model(FILE *file) {
     assert(items == 1);
     items = fscanf(file, " skeleton: %s", model.skeleton);
     assert(items == 1);
+    /* optional, linear blend skinning when left out */
+    items = fscanf(file, " skinning: %s", model.skinning);
+    if (items != 1) {
+        strcpy(model.skinning, "linear");
+    }
     items = fscanf(file, " attached: %d", &model.attached);
     assert(items == 1);
     items = fscanf(file, " material: %d", &model.material);
@@ -360,8 +392,15 @@ static scene_model_t *read_models(FILE *file) {
     return models;
 }
 
+static void set_skinning(model_t *model, scene_model_t *scene_model) {
+    if (model->skin) {
+        skin_set_method(model->skin, wrap_skinning(scene_model->skinning));
+    }
+}
+
 static scene_t *create_scene(scene_light_t *light, model_t **models) {
     model_t *skybox;
+    scene_t *scene;
     int shadow_width;
     int shadow_height;
 
@@ -398,9 +437,11 @@ static scene_t *create_scene(scene_light_t *light, model_t **models) {
         }
     }
 
-    return scene_create(light->background, skybox, models,
-                        light->ambient, light->punctual,
-                        shadow_width, shadow_height);
+    scene = scene_create(light->background, skybox, models,
+                         light->ambient, light->punctual,
+                         shadow_width, shadow_height);
+    scene->shadow_filter = wrap_shadow_filter(light->shadow_filter);
+    return scene;
 }
 
 /*用blinn渲染管线，创建scene*/
@@ -459,6 +500,7 @@ static scene_t *create_blinn_scene(scene_light_t *scene_light,
 
         model = blinn_create_model(mesh, transform, skeleton, attached,
                                    &material);
+        set_skinning(model, &scene_model);
         darray_push(models, model);
     }
 
@@ -517,6 +559,7 @@ static scene_t *create_pbrm_scene(scene_light_t *scene_light,
 
         model = pbrm_create_model(mesh, transform, skeleton, attached,
                                   &material, env_name);
+        set_skinning(model, &scene_model);
         darray_push(models, model);
     }
 
@@ -575,6 +618,7 @@ static scene_t *create_pbrs_scene(scene_light_t *scene_light,
 
         model = pbrs_create_model(mesh, transform, skeleton, attached,
                                   &material, env_name);
+        set_skinning(model, &scene_model);
         darray_push(models, model);
     }
 
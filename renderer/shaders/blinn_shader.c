@@ -6,46 +6,10 @@
 
 /* low-level api */
 
-static mat4_t get_model_matrix(blinn_attribs_t *attribs,
-                               blinn_uniforms_t *uniforms) {
-    if (uniforms->joint_matrices) {
-        mat4_t joint_matrices[4];
-        mat4_t skin_matrix;
-
-        joint_matrices[0] = uniforms->joint_matrices[(int)attribs->joint.x];
-        joint_matrices[1] = uniforms->joint_matrices[(int)attribs->joint.y];
-        joint_matrices[2] = uniforms->joint_matrices[(int)attribs->joint.z];
-        joint_matrices[3] = uniforms->joint_matrices[(int)attribs->joint.w];
-
-        skin_matrix = mat4_combine(joint_matrices, attribs->weight);
-        return mat4_mul_mat4(uniforms->model_matrix, skin_matrix);
-    } else {
-        return uniforms->model_matrix;
-    }
-}
-
-static mat3_t get_normal_matrix(blinn_attribs_t *attribs,
-                                blinn_uniforms_t *uniforms) {
-    if (uniforms->joint_n_matrices) {
-        mat3_t joint_n_matrices[4];
-        mat3_t skin_n_matrix;
-
-        joint_n_matrices[0] = uniforms->joint_n_matrices[(int)attribs->joint.x];
-        joint_n_matrices[1] = uniforms->joint_n_matrices[(int)attribs->joint.y];
-        joint_n_matrices[2] = uniforms->joint_n_matrices[(int)attribs->joint.z];
-        joint_n_matrices[3] = uniforms->joint_n_matrices[(int)attribs->joint.w];
-
-        skin_n_matrix = mat3_combine(joint_n_matrices, attribs->weight);
-        return mat3_mul_mat3(uniforms->normal_matrix, skin_n_matrix);
-    } else {
-        return uniforms->normal_matrix;
-    }
-}
-
 static vec4_t shadow_vertex_shader(blinn_attribs_t *attribs,
                                    blinn_varyings_t *varyings,
                                    blinn_uniforms_t *uniforms) {
-    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
+    mat4_t model_matrix = uniforms->model_matrix;
     mat4_t light_vp_matrix = uniforms->light_vp_matrix;
 
     vec4_t input_position = vec4_from_vec3(attribs->position, 1);
@@ -60,8 +24,8 @@ static vec4_t common_vertex_shader(blinn_attribs_t *attribs,
                                    blinn_varyings_t *varyings,
                                    blinn_uniforms_t *uniforms) {
     /*总的说：将顶点位置，从模型空间变换到 裁减空间 --- 返回的是裁减空间中的坐标*/
-    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
-    mat3_t normal_matrix = get_normal_matrix(attribs, uniforms);
+    mat4_t model_matrix = uniforms->model_matrix;
+    mat3_t normal_matrix = uniforms->normal_matrix;
     mat4_t camera_vp_matrix = uniforms->camera_vp_matrix;
     mat4_t light_vp_matrix = uniforms->light_vp_matrix;
 
@@ -175,9 +139,10 @@ static vec3_t get_view_dir(blinn_varyings_t *varyings,
     return vec3_normalize(vec3_sub(camera_pos, world_pos));
 }
 
-static int is_in_shadow(blinn_varyings_t *varyings,
-                        blinn_uniforms_t *uniforms,
-                        float n_dot_l) {
+/* returns the lit fraction, filtered to soften the shadow edges */
+static float get_shadow_visibility(blinn_varyings_t *varyings,
+                                   blinn_uniforms_t *uniforms,
+                                   float n_dot_l) {
     if (uniforms->shadow_map) {
         float u = (varyings->depth_position.x + 1) * 0.5f;
         float v = (varyings->depth_position.y + 1) * 0.5f;
@@ -186,11 +151,11 @@ static int is_in_shadow(blinn_varyings_t *varyings,
         float depth_bias = float_max(0.05f * (1 - n_dot_l), 0.005f);
         float current_depth = d - depth_bias;
         vec2_t texcoord = vec2_new(u, v);
-        float closest_depth = texture_sample(uniforms->shadow_map, texcoord).x;
 
-        return current_depth > closest_depth;
+        return depthmap_compare(uniforms->shadow_map, uniforms->shadow_filter,
+                                texcoord, current_depth);
     } else {
-        return 0;
+        return 1;
     }
 }
 
@@ -232,12 +197,17 @@ static vec4_t common_fragment_shader(blinn_varyings_t *varyings,
         if (uniforms->punctual_intensity > 0) {
             vec3_t light_dir = vec3_negate(uniforms->light_dir);
             float n_dot_l = vec3_dot(material.normal, light_dir);
-            if (n_dot_l > 0 && !is_in_shadow(varyings, uniforms, n_dot_l)) {
+            float visibility = 0;
+            if (n_dot_l > 0) {
+                visibility = get_shadow_visibility(varyings, uniforms,
+                                                   n_dot_l);
+            }
+            if (visibility > 0) {
                 vec3_t view_dir = get_view_dir(varyings, uniforms);
                 vec3_t specular = get_specular(light_dir, view_dir, material);
                 vec3_t diffuse = vec3_mul(material.diffuse, n_dot_l);
                 vec3_t punctual = vec3_add(diffuse, specular);
-                float intensity = uniforms->punctual_intensity;
+                float intensity = uniforms->punctual_intensity * visibility;
                 color = vec3_add(color, vec3_mul(punctual, intensity));
             }
         }
@@ -271,8 +241,12 @@ static void update_model(model_t *model, perframe_t *perframe) {
     mat3_t *joint_n_matrices;
     blinn_uniforms_t *uniforms;
 
+    if (skeleton && model->anim_lod < 0) {
+        return;  /*两个视锥之外, 保留上一次的姿态, 包围盒和蒙皮*/
+    }
     if (skeleton) {
-        skeleton_update_joints(skeleton, perframe->frame_time);
+        skeleton_update_joints_lod(skeleton, perframe->frame_time,
+                                   model->anim_lod);
         joint_matrices = skeleton_get_joint_matrices(skeleton);
         joint_n_matrices = skeleton_get_normal_matrices(skeleton);
         if (model->attached >= 0) {
@@ -286,6 +260,14 @@ static void update_model(model_t *model, perframe_t *perframe) {
         joint_n_matrices = NULL;
     }
     normal_matrix = mat3_inverse_transpose(mat3_from_mat4(model_matrix));
+    model_update_bounds(model, model_matrix, joint_matrices);
+    if (joint_matrices) {
+        /*蒙皮顶点直接变换到世界空间, 阴影pass和主pass共用*/
+        skin_update(model->skin, model_matrix, normal_matrix,
+                    joint_matrices, joint_n_matrices);
+        model_matrix = mat4_identity();
+        normal_matrix = mat3_identity();
+    }
 
     uniforms = (blinn_uniforms_t*)program_get_uniforms(model->program);
     uniforms->light_dir = perframe->light_dir;
@@ -296,11 +278,25 @@ static void update_model(model_t *model, perframe_t *perframe) {
                                               perframe->light_view_matrix);
     uniforms->camera_vp_matrix = mat4_mul_mat4(perframe->camera_proj_matrix,
                                                perframe->camera_view_matrix);
-    uniforms->joint_matrices = joint_matrices;
-    uniforms->joint_n_matrices = joint_n_matrices;
     uniforms->ambient_intensity = float_clamp(ambient_intensity, 0, 5);
     uniforms->punctual_intensity = float_clamp(punctual_intensity, 0, 5);
     uniforms->shadow_map = perframe->shadow_map;
+    uniforms->shadow_filter = perframe->shadow_filter;
+}
+
+/*
+ * the meshlets of skinned models are refitted in world space, where their
+ * model matrix is the identity, so both kinds go through the same culler
+ */
+static culler_t setup_culler(model_t *model) {
+    program_t *program = model->program;
+    blinn_uniforms_t *uniforms;
+    mat4_t vp_matrix;
+    uniforms = (blinn_uniforms_t*)program_get_uniforms(program);
+    vp_matrix = uniforms->shadow_pass ? uniforms->light_vp_matrix
+                                      : uniforms->camera_vp_matrix;
+    return culler_from_matrices(vp_matrix, uniforms->model_matrix,
+                                !program_is_double_sided(program));
 }
 
 static void draw_model(model_t *model, 
@@ -308,36 +304,62 @@ static void draw_model(model_t *model,
     int shadow_pass) {
     /*获得这个模型的mesh列表*/
     mesh_t *mesh = model->mesh;
-    /*获得面个数*/
-    int num_faces = mesh_get_num_faces(mesh);
-    /*获得顶点列表*/
-    vertex_t *vertices = mesh_get_vertices(mesh);
+    /*获得当前细节层级(lod)的簇(meshlet)列表*/
+    lod_t *lod = mesh_get_lod(mesh, model->lod);
+    meshlet_t *meshlets = mesh_get_meshlets(mesh) + lod->first_meshlet;
+    /*获得顶点坐标流, 其余属性按需解码*/
+    vec3_t *positions = mesh_get_positions(mesh);
+    vec3_t *normals = NULL;
     program_t *program = model->program;  /*该model 挂在的 渲染管线program*/
     blinn_uniforms_t *uniforms;
     blinn_attribs_t *attribs;
-    int i, j;
+    culler_t culler;
+    int i, j, k;
 
     /*获得该program上挂载的几个uniform参数*/
     uniforms = (blinn_uniforms_t*)program_get_uniforms(model->program);
     uniforms->shadow_pass = shadow_pass;
-    for (i = 0; i < num_faces; i++) {  /*这里的model个数*face面数 就是GPU 可以直接并行的最大并行数量*/
-        /*逐个面进行绘制： 准备该三角面的顶点数据*/
-        for (j = 0; j < 3; j++) {
-            vertex_t vertex = vertices[i * 3 + j];
-            /*
-            将这些要绘制的点信息，借助指针，写入program的shader_attribs属性上，
-            你看该program的一次循环只负责绘制一个三角形，这种解耦方式，使得非常容易并行
-            */
-            /*将三个顶点的信息，填充到该program的attribs属性列表中*/
-            attribs = (blinn_attribs_t*)program_get_attribs(program, j);
-            attribs->position = vertex.position;
-            attribs->texcoord = vertex.texcoord;
-            attribs->normal = vertex.normal;
-            attribs->joint = vertex.joint;
-            attribs->weight = vertex.weight;
+    if (model->skin) {
+        /*每帧只在第一次绘制时蒙皮, 之后的pass直接读取*/
+        skin_apply(model->skin);
+        positions = skin_get_positions(model->skin);
+        normals = skin_get_normals(model->skin);
+        meshlets = skin_get_meshlets(model->skin, lod);
+    }
+    culler = setup_culler(model);
+    program_clear_cache(program);
+    for (i = 0; i < lod->num_meshlets; i++) {
+        meshlet_t *meshlet = &meshlets[i];
+        /*整簇位于视锥外或背向相机时，跳过顶点着色*/
+        if (culler_cull_meshlet(&culler, meshlet)) {
+            continue;
+        }
+        for (j = 0; j < meshlet->num_indices; j += 3) {  /*这里的model个数*face面数 就是GPU 可以直接并行的最大并行数量*/
+            /*逐个面进行绘制： 准备该三角面的顶点数据*/
+            for (k = 0; k < 3; k++) {
+                int index = mesh_get_index(mesh, meshlet->first_index + j + k);
+                /*已经着色过的顶点，直接复用其结果*/
+                program_set_index(program, k, index);
+                if (program_is_cached(program, index)) {
+                    continue;
+                }
+                /*
+                将这些要绘制的点信息，借助指针，写入program的shader_attribs属性上，
+                你看该program的一次循环只负责绘制一个三角形，这种解耦方式，使得非常容易并行
+                */
+                /*将三个顶点的信息，填充到该program的attribs属性列表中*/
+                attribs = (blinn_attribs_t*)program_get_attribs(program, k);
+                attribs->position = positions[index];
+                attribs->texcoord = mesh_get_texcoord(mesh, index);
+                if (normals) {
+                    attribs->normal = normals[index];
+                } else {
+                    attribs->normal = mesh_get_normal(mesh, index);
+                }
+            }
+            /*该三角形，要绘制的数据，都在 program的shader_attribs上*/
+            graphics_draw_triangle(framebuffer, program);
         }
-        /*该三角形，要绘制的数据，都在 program的shader_attribs上*/
-        graphics_draw_triangle(framebuffer, program);
     }
 }
 
@@ -349,6 +371,9 @@ static void release_model(model_t *model) {
     cache_release_texture(uniforms->emission_map);
     program_release(model->program);
     cache_release_skeleton(model->skeleton);
+    if (model->skin) {
+        skin_release(model->skin);
+    }
     cache_release_mesh(model->mesh);
     free(model);
 }
@@ -396,8 +421,18 @@ model_t *blinn_create_model(const char *mesh, mat4_t transform,
     model->transform = transform;
     model->skeleton = cache_acquire_skeleton(skeleton); /*骨骼数据*/
     model->attached = attached;
+    if (model->skeleton && attached < 0) {
+        model->skin = skin_create(model->mesh, 0);  /*蒙皮后的顶点流*/
+    } else {
+        model->skin = NULL;
+    }
+    model_set_joint_extents(model);
     model->opaque = !material->enable_blend; 
     model->distance = 0;
+    model->lod = 0;
+    model->anim_lod = 0;
+    model->pose_time = -1;
+    model->bounds_valid = 0;
     /*这是三个很重要的函数*/
     model->update = update_model;  /*更新模型*/
     model->draw = draw_model;   /*绘制模型*/
@@ -9,8 +9,6 @@ typedef struct {
     vec3_t position;
     vec2_t texcoord;
     vec3_t normal;
-    vec4_t joint;
-    vec4_t weight;
 } blinn_attribs_t;
 
 typedef struct {
@@ -27,11 +25,10 @@ typedef struct {
     mat3_t normal_matrix; 
     mat4_t light_vp_matrix;
     mat4_t camera_vp_matrix;
-    mat4_t *joint_matrices;
-    mat3_t *joint_n_matrices;
     float ambient_intensity;
     float punctual_intensity;
-    texture_t *shadow_map;
+    depthmap_t *shadow_map;
+    shadow_filter_t shadow_filter;
     /* surface parameters */
     vec4_t basecolor;   /*基础色*/
     float shininess;    /*光滑度*/
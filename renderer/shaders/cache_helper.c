@@ -4,6 +4,7 @@
 #include <string.h>
 #include "../core/api.h"
 #include "cache_helper.h"
+#include "ibl_helper.h"
 #include "pbr_shader.h"
 
 static char *duplicate_string(const char *source) {
@@ -130,6 +131,26 @@ void cache_release_skeleton(skeleton_t *skeleton) {
     }
 }
 
+/*
+ * bakes the palettes of the skeletons in use at the frame rate, each table
+ * is cached next to its clip, a frame rate of 0 goes back to evaluating
+ */
+void cache_bake_skeletons(int frame_rate) {
+    int num_skeletons = darray_size(g_skeletons);
+    int i;
+    for (i = 0; i < num_skeletons; i++) {
+        if (g_skeletons[i].references > 0) {
+            const char *filename = g_skeletons[i].filename;
+            const char *extension = strrchr(filename, '.');
+            int length = extension ? (int)(extension - filename)
+                                   : (int)strlen(filename);
+            char bake_path[PATH_SIZE];
+            sprintf(bake_path, "%.*s.bake", length, filename);
+            skeleton_bake(g_skeletons[i].skeleton, frame_rate, bake_path);
+        }
+    }
+}
+
 /* texture related functions */
 
 typedef struct {
@@ -303,32 +324,37 @@ static cached_ibldata_t g_ibldata[] = {
 };
 
 static ibldata_t *load_ibldata(const char *env_name, int mip_levels) {
-    const char *faces[6] = {"px", "nx", "py", "ny", "pz", "nz"};
-    char paths[6][PATH_SIZE];
+    char prefix[PATH_SIZE];
+    cubemap_t *specular_maps[MAX_MIP_LEVELS];
+    int specular_sizes[MAX_MIP_LEVELS];
+    cubemap_t *diffuse_map;
     ibldata_t *ibldata;
-    int i, j;
+    int i;
 
+    assert(mip_levels > 0 && mip_levels <= MAX_MIP_LEVELS);
     ibldata = (ibldata_t*)malloc(sizeof(ibldata_t));
     memset(ibldata, 0, sizeof(ibldata_t));
     ibldata->mip_levels = mip_levels;
 
-    /* diffuse environment map */
-    for (j = 0; j < 6; j++) {
-        sprintf(paths[j], "%s/i_%s.hdr", env_name, faces[j]);
-    }
-    ibldata->diffuse_map = cubemap_from_files(paths[0], paths[1], paths[2],
-                                              paths[3], paths[4], paths[5],
-                                              USAGE_HDR_COLOR);
+    /*
+     * diffuse environment map, only its projection is kept, the map is
+     * already cosine convolved so no band attenuation is applied
+     */
+    sprintf(prefix, "%s/i", env_name);
+    diffuse_map = ibl_load_environment(prefix, 0);
+    ibl_project_sh(diffuse_map, ibldata->diffuse_coeffs);
+    cubemap_release(diffuse_map);
 
-    /* specular environment maps */
+    /* specular environment maps, packed into one mip chain */
     for (i = 0; i < mip_levels; i++) {
-        for (j = 0; j < 6; j++) {
-            sprintf(paths[j], "%s/m%d_%s.hdr", env_name, i, faces[j]);
-        }
-        ibldata->specular_maps[i] = cubemap_from_files(paths[0], paths[1],
-                                                       paths[2], paths[3],
-                                                       paths[4], paths[5],
-                                                       USAGE_HDR_COLOR);
+        sprintf(prefix, "%s/m%d", env_name, i);
+        specular_maps[i] = ibl_load_environment(prefix, 0);
+        specular_sizes[i] = specular_maps[i]->faces[0]->width;
+    }
+    ibldata->specular_map = mipcube_create(mip_levels, specular_sizes);
+    for (i = 0; i < mip_levels; i++) {
+        mipcube_set_level(ibldata->specular_map, i, specular_maps[i]);
+        cubemap_release(specular_maps[i]);
     }
 
     /* brdf lookup texture */
@@ -339,11 +365,7 @@ static ibldata_t *load_ibldata(const char *env_name, int mip_levels) {
 }
 
 static void free_ibldata(ibldata_t *ibldata) {
-    int i;
-    cubemap_release(ibldata->diffuse_map);
-    for (i = 0; i < ibldata->mip_levels; i++) {
-        cubemap_release(ibldata->specular_maps[i]);
-    }
+    mipcube_release(ibldata->specular_map);
     cache_release_texture(ibldata->brdf_lut);
     free(ibldata);
 }
@@ -12,6 +12,7 @@ void cache_release_mesh(mesh_t *mesh);
 /* skeleton related functions */
 skeleton_t *cache_acquire_skeleton(const char *filename);
 void cache_release_skeleton(skeleton_t *skeleton);
+void cache_bake_skeletons(int frame_rate);
 
 /* texture related functions */
 texture_t *cache_acquire_texture(const char *filename, usage_t usage);
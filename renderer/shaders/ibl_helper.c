@@ -0,0 +1,599 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/api.h"
+#include "ibl_helper.h"
+
+/*
+ * for image-based lighting precomputation, see
+ * https://blog.selfshadow.com/publications/s2013-shading-course/karis/s2013_pbs_epic_notes_v2.pdf
+ * https://google.github.io/filament/Filament.html#lighting/imagebasedlights
+ */
+
+static const char *const FACE_NAMES[6] = {"px", "nx", "py", "ny", "pz", "nz"};
+
+/* parallel helpers */
+
+typedef void rowfunc_t(void *context, int row);
+
+typedef struct {
+    rowfunc_t *rowfunc;
+    void *context;
+} rows_t;
+
+static void run_rows(void *rows_, int first, int last) {
+    rows_t *rows = (rows_t*)rows_;
+    int row;
+    for (row = first; row < last; row++) {
+        rows->rowfunc(rows->context, row);
+    }
+}
+
+/*
+ * rows are handed out one at a time by the job system, so that rows of
+ * different cost (e.g. different faces or levels) are spread evenly
+ */
+static void parallel_for_rows(rowfunc_t *rowfunc, void *context,
+                              int num_rows) {
+    rows_t rows;
+    rows.rowfunc = rowfunc;
+    rows.context = context;
+    job_parallel_for(run_rows, &rows, num_rows, 1);
+}
+
+/* direction helpers */
+
+/*
+ * inverse of the face selection in cubemap sampling, maps texcoord
+ * (as used to index the face texture) back to a direction
+ */
+static vec3_t get_texel_direction(int face_index, vec2_t texcoord) {
+    float sc = texcoord.x * 2 - 1;
+    float tc = 1 - texcoord.y * 2;
+    switch (face_index) {
+        case 0:  return vec3_new(1, -tc, -sc);   /* positive x */
+        case 1:  return vec3_new(-1, -tc, sc);   /* negative x */
+        case 2:  return vec3_new(sc, 1, tc);     /* positive y */
+        case 3:  return vec3_new(sc, -1, -tc);   /* negative y */
+        case 4:  return vec3_new(sc, -tc, 1);    /* positive z */
+        default: return vec3_new(-sc, -tc, -1);  /* negative z */
+    }
+}
+
+static vec3_t get_face_direction(int face_index, int size, int row, int col) {
+    float u = ((float)col + 0.5f) / (float)size;
+    float v = ((float)row + 0.5f) / (float)size;
+    return get_texel_direction(face_index, vec2_new(u, v));
+}
+
+/* environment loading */
+
+static vec4_t get_panorama_texel(texture_t *panorama, int row, int col) {
+    col = (col % panorama->width + panorama->width) % panorama->width;
+    row = row < 0 ? 0 : (row >= panorama->height ? panorama->height - 1 : row);
+    return panorama->buffer[row * panorama->width + col];
+}
+
+static vec4_t sample_panorama(texture_t *panorama, vec3_t direction) {
+    float u = (float)atan2(direction.x, -direction.z) / (2 * PI) + 0.5f;
+    float v = (float)asin(float_clamp(direction.y, -1, 1)) / PI + 0.5f;
+    float x = u * (float)panorama->width - 0.5f;
+    float y = v * (float)panorama->height - 0.5f;
+    int x0 = (int)floor(x);
+    int y0 = (int)floor(y);
+    float tx = x - (float)x0;
+    float ty = y - (float)y0;
+    vec4_t top = vec4_lerp(get_panorama_texel(panorama, y0, x0),
+                           get_panorama_texel(panorama, y0, x0 + 1), tx);
+    vec4_t bottom = vec4_lerp(get_panorama_texel(panorama, y0 + 1, x0),
+                              get_panorama_texel(panorama, y0 + 1, x0 + 1),
+                              tx);
+    return vec4_lerp(top, bottom, ty);
+}
+
+typedef struct {
+    texture_t *panorama;
+    cubemap_t *cubemap;
+    int size;
+} unwrap_t;
+
+static void unwrap_row(void *context, int row) {
+    unwrap_t *unwrap = (unwrap_t*)context;
+    int size = unwrap->size;
+    int face_index = row / size;
+    texture_t *face = unwrap->cubemap->faces[face_index];
+    int r = row % size;
+    int c;
+    for (c = 0; c < size; c++) {
+        vec3_t direction = get_face_direction(face_index, size, r, c);
+        vec3_t normalized = vec3_normalize(direction);
+        face->buffer[r * size + c] = sample_panorama(unwrap->panorama,
+                                                     normalized);
+    }
+}
+
+/*
+ * the source is either an equirectangular panorama (a .hdr file), which
+ * is resampled to faces of face_size, or the common prefix of six cubemap
+ * faces named <source>_px.hdr, <source>_nx.hdr, and so on
+ */
+cubemap_t *ibl_load_environment(const char *source, int face_size) {
+    const char *extension = strrchr(source, '.');
+    cubemap_t *cubemap;
+    int i;
+
+    if (extension != NULL && strcmp(extension, ".hdr") == 0) {
+        unwrap_t unwrap;
+        assert(face_size > 0);
+        cubemap = (cubemap_t*)malloc(sizeof(cubemap_t));
+        for (i = 0; i < 6; i++) {
+            cubemap->faces[i] = texture_create(face_size, face_size);
+        }
+        unwrap.panorama = texture_from_file(source, USAGE_HDR_COLOR);
+        unwrap.cubemap = cubemap;
+        unwrap.size = face_size;
+        parallel_for_rows(unwrap_row, &unwrap, face_size * 6);
+        texture_release(unwrap.panorama);
+    } else {
+        char paths[6][PATH_SIZE];
+        for (i = 0; i < 6; i++) {
+            sprintf(paths[i], "%s_%s.hdr", source, FACE_NAMES[i]);
+        }
+        cubemap = cubemap_from_files(paths[0], paths[1], paths[2],
+                                     paths[3], paths[4], paths[5],
+                                     USAGE_HDR_COLOR);
+    }
+    return cubemap;
+}
+
+/* spherical harmonics */
+
+/*
+ * for spherical harmonics, see
+ * An Efficient Representation for Irradiance Environment Maps
+ * https://www.ppsloan.org/publications/StupidSH36.pdf
+ */
+static void get_sh_basis(vec3_t n, float basis[9]) {
+    basis[0] = 0.282095f;
+    basis[1] = 0.488603f * n.y;
+    basis[2] = 0.488603f * n.z;
+    basis[3] = 0.488603f * n.x;
+    basis[4] = 1.092548f * n.x * n.y;
+    basis[5] = 1.092548f * n.y * n.z;
+    basis[6] = 0.315392f * (3 * n.z * n.z - 1);
+    basis[7] = 1.092548f * n.x * n.z;
+    basis[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+}
+
+void ibl_project_sh(cubemap_t *cubemap, vec3_t coeffs[9]) {
+    float total_weight = 0;
+    int face_index, r, c, k;
+
+    for (k = 0; k < 9; k++) {
+        coeffs[k] = vec3_new(0, 0, 0);
+    }
+    for (face_index = 0; face_index < 6; face_index++) {
+        texture_t *face = cubemap->faces[face_index];
+        assert(face->width == face->height);
+        for (r = 0; r < face->height; r++) {
+            for (c = 0; c < face->width; c++) {
+                vec3_t direction = get_face_direction(face_index, face->width,
+                                                      r, c);
+                float length2 = vec3_dot(direction, direction);
+                float length = (float)sqrt(length2);
+                float weight = 1 / (length2 * length);  /* solid angle */
+                vec3_t n = vec3_div(direction, length);
+                vec4_t texel = face->buffer[r * face->width + c];
+                vec3_t color = vec3_from_vec4(texel);
+                float basis[9];
+
+                get_sh_basis(n, basis);
+                for (k = 0; k < 9; k++) {
+                    vec3_t term = vec3_mul(color, basis[k] * weight);
+                    coeffs[k] = vec3_add(coeffs[k], term);
+                }
+                total_weight += weight;
+            }
+        }
+    }
+    /* normalize the texel solid angles so that they sum up to 4 * pi */
+    for (k = 0; k < 9; k++) {
+        coeffs[k] = vec3_mul(coeffs[k], 4 * PI / total_weight);
+    }
+}
+
+/*
+ * turns radiance coefficients into irradiance coefficients, the result
+ * is divided by pi so that it is multiplied by the diffuse color directly
+ */
+void ibl_convolve_sh(vec3_t coeffs[9]) {
+    float bands[3] = {1, 2 / 3.0f, 1 / 4.0f};
+    coeffs[0] = vec3_mul(coeffs[0], bands[0]);
+    coeffs[1] = vec3_mul(coeffs[1], bands[1]);
+    coeffs[2] = vec3_mul(coeffs[2], bands[1]);
+    coeffs[3] = vec3_mul(coeffs[3], bands[1]);
+    coeffs[4] = vec3_mul(coeffs[4], bands[2]);
+    coeffs[5] = vec3_mul(coeffs[5], bands[2]);
+    coeffs[6] = vec3_mul(coeffs[6], bands[2]);
+    coeffs[7] = vec3_mul(coeffs[7], bands[2]);
+    coeffs[8] = vec3_mul(coeffs[8], bands[2]);
+}
+
+vec3_t ibl_evaluate_sh(vec3_t coeffs[9], vec3_t direction) {
+    vec3_t result = vec3_new(0, 0, 0);
+    float basis[9];
+    int k;
+    get_sh_basis(direction, basis);
+    for (k = 0; k < 9; k++) {
+        result = vec3_add(result, vec3_mul(coeffs[k], basis[k]));
+    }
+    return result;
+}
+
+/* prefiltering */
+
+static vec2_t get_hammersley(int index, int num_samples) {
+    unsigned long bits = (unsigned long)index;
+    bits = ((bits << 16) | (bits >> 16)) & 0xFFFFFFFFUL;
+    bits = ((bits & 0x55555555UL) << 1) | ((bits & 0xAAAAAAAAUL) >> 1);
+    bits = ((bits & 0x33333333UL) << 2) | ((bits & 0xCCCCCCCCUL) >> 2);
+    bits = ((bits & 0x0F0F0F0FUL) << 4) | ((bits & 0xF0F0F0F0UL) >> 4);
+    bits = ((bits & 0x00FF00FFUL) << 8) | ((bits & 0xFF00FF00UL) >> 8);
+    return vec2_new((float)index / (float)num_samples,
+                    (float)bits * 2.3283064365386963e-10f);
+}
+
+/* returns a half vector in tangent space, where the normal is +z */
+static vec3_t importance_sample_ggx(vec2_t xi, float alpha) {
+    float alpha2 = alpha * alpha;
+    float phi = 2 * PI * xi.x;
+    float cos_theta = (float)sqrt((1 - xi.y) / (1 + (alpha2 - 1) * xi.y));
+    float sin_theta = (float)sqrt(1 - cos_theta * cos_theta);
+    return vec3_new(sin_theta * (float)cos(phi),
+                    sin_theta * (float)sin(phi),
+                    cos_theta);
+}
+
+static float get_distribution(float n_dot_h, float alpha) {
+    float alpha2 = alpha * alpha;
+    float factor = n_dot_h * n_dot_h * (alpha2 - 1) + 1;
+    return alpha2 / (PI * factor * factor);
+}
+
+static mipcube_t *create_source_chain(cubemap_t *environment) {
+    int size = environment->faces[0]->width;
+    int sizes[MAX_MIP_LEVELS];
+    int num_levels = 0;
+    mipcube_t *source;
+    int level, face_index, r, c;
+
+    while (num_levels < MAX_MIP_LEVELS) {
+        sizes[num_levels++] = size;
+        if (size == 1) {
+            break;
+        }
+        size = size > 1 ? size / 2 : 1;
+    }
+
+    source = mipcube_create(num_levels, sizes);
+    mipcube_set_level(source, 0, environment);
+    for (level = 1; level < num_levels; level++) {
+        int prev_size = sizes[level - 1];
+        int curr_size = sizes[level];
+        for (face_index = 0; face_index < 6; face_index++) {
+            vec4_t *prev = source->levels[level - 1]
+                           + prev_size * prev_size * face_index;
+            vec4_t *curr = source->levels[level]
+                           + curr_size * curr_size * face_index;
+            for (r = 0; r < curr_size; r++) {
+                for (c = 0; c < curr_size; c++) {
+                    vec4_t a = prev[(r * 2 + 0) * prev_size + (c * 2 + 0)];
+                    vec4_t b = prev[(r * 2 + 0) * prev_size + (c * 2 + 1)];
+                    vec4_t d = prev[(r * 2 + 1) * prev_size + (c * 2 + 0)];
+                    vec4_t e = prev[(r * 2 + 1) * prev_size + (c * 2 + 1)];
+                    vec4_t sum = vec4_add(vec4_add(a, b), vec4_add(d, e));
+                    curr[r * curr_size + c] = vec4_mul(sum, 0.25f);
+                }
+            }
+        }
+    }
+    return source;
+}
+
+typedef struct {
+    vec3_t direction;  /* light direction in tangent space */
+    float n_dot_l;
+    float lod;         /* source level to fetch from */
+} ggx_sample_t;
+
+typedef struct {
+    mipcube_t *source;
+    mipcube_t *target;
+    int level;
+    ggx_sample_t *samples;
+    int num_samples;
+} prefilter_t;
+
+/*
+ * with the n = v = r assumption the sample directions in tangent space
+ * only depend on the roughness, they are computed once per level, and
+ * each sample fetches from a blurrier source level depending on its pdf
+ * (filtered importance sampling) to keep the noise down
+ */
+static ggx_sample_t *create_ggx_samples(float roughness, int num_samples,
+                                        int source_size, int *num_valid) {
+    float alpha = roughness * roughness;
+    float texel_solid_angle = 4 * PI / (6 * (float)source_size
+                                           * (float)source_size);
+    ggx_sample_t *samples;
+    int i;
+
+    samples = (ggx_sample_t*)malloc(sizeof(ggx_sample_t) * num_samples);
+    *num_valid = 0;
+    for (i = 0; i < num_samples; i++) {
+        vec2_t xi = get_hammersley(i, num_samples);
+        vec3_t half_dir = importance_sample_ggx(xi, alpha);
+        float n_dot_h = half_dir.z;
+        vec3_t light_dir = vec3_new(2 * n_dot_h * half_dir.x,
+                                    2 * n_dot_h * half_dir.y,
+                                    2 * n_dot_h * half_dir.z - 1);
+        if (light_dir.z > 0) {
+            float pdf = get_distribution(n_dot_h, alpha) * 0.25f;
+            float sample_solid_angle = 1 / ((float)num_samples * pdf + EPSILON);
+            float lod = 0.5f * (float)(log(sample_solid_angle
+                                           / texel_solid_angle) / log(2)) + 1;
+            ggx_sample_t *sample = &samples[(*num_valid)++];
+            sample->direction = light_dir;
+            sample->n_dot_l = light_dir.z;
+            sample->lod = float_max(lod, 0);
+        }
+    }
+    return samples;
+}
+
+static void prefilter_row(void *context, int row) {
+    prefilter_t *prefilter = (prefilter_t*)context;
+    int size = prefilter->target->sizes[prefilter->level];
+    int face_index = row / size;
+    int r = row % size;
+    vec4_t *texels = prefilter->target->levels[prefilter->level]
+                     + size * size * face_index + r * size;
+    int c, i;
+
+    for (c = 0; c < size; c++) {
+        vec3_t normal = get_face_direction(face_index, size, r, c);
+        vec3_t up, tangent, bitangent;
+        vec3_t color = vec3_new(0, 0, 0);
+        float total_weight = 0;
+
+        normal = vec3_normalize(normal);
+        up = fabs(normal.z) < 0.999f ? vec3_new(0, 0, 1) : vec3_new(1, 0, 0);
+        tangent = vec3_normalize(vec3_cross(up, normal));
+        bitangent = vec3_cross(normal, tangent);
+
+        for (i = 0; i < prefilter->num_samples; i++) {
+            ggx_sample_t *sample = &prefilter->samples[i];
+            vec3_t local = sample->direction;
+            vec3_t world = vec3_add(vec3_add(vec3_mul(tangent, local.x),
+                                             vec3_mul(bitangent, local.y)),
+                                    vec3_mul(normal, local.z));
+            vec4_t texel = mipcube_sample(prefilter->source, world,
+                                          sample->lod);
+            color = vec3_add(color, vec3_mul(vec3_from_vec4(texel),
+                                             sample->n_dot_l));
+            total_weight += sample->n_dot_l;
+        }
+        texels[c] = vec4_from_vec3(vec3_div(color, total_weight), 1);
+    }
+}
+
+static void copy_row(void *context, int row) {
+    prefilter_t *prefilter = (prefilter_t*)context;
+    int size = prefilter->target->sizes[prefilter->level];
+    int face_index = row / size;
+    int r = row % size;
+    vec4_t *texels = prefilter->target->levels[prefilter->level]
+                     + size * size * face_index + r * size;
+    int c;
+    for (c = 0; c < size; c++) {
+        vec3_t direction = get_face_direction(face_index, size, r, c);
+        texels[c] = mipcube_sample(prefilter->source, direction, 0);
+    }
+}
+
+/*
+ * level i is prefiltered for perceptual roughness i / (num_levels - 1),
+ * matching the lod selection in the pbr shader
+ */
+mipcube_t *ibl_prefilter_specular(cubemap_t *environment, int num_levels,
+                                  int sizes[], int num_samples) {
+    prefilter_t prefilter;
+    int level;
+
+    assert(num_levels > 1 && num_samples > 0);
+
+    prefilter.source = create_source_chain(environment);
+    prefilter.target = mipcube_create(num_levels, sizes);
+    for (level = 0; level < num_levels; level++) {
+        int num_rows = sizes[level] * 6;
+        prefilter.level = level;
+        if (level == 0) {
+            parallel_for_rows(copy_row, &prefilter, num_rows);
+        } else {
+            float roughness = (float)level / (float)(num_levels - 1);
+            int source_size = prefilter.source->sizes[0];
+            prefilter.samples = create_ggx_samples(roughness, num_samples,
+                                                   source_size,
+                                                   &prefilter.num_samples);
+            parallel_for_rows(prefilter_row, &prefilter, num_rows);
+            free(prefilter.samples);
+        }
+    }
+    mipcube_release(prefilter.source);
+
+    return prefilter.target;
+}
+
+typedef struct {
+    texture_t *lut;
+    int num_samples;
+} integrate_t;
+
+/*
+ * height-correlated smith visibility, matching the shipped lookup texture, see
+ * https://google.github.io/filament/Filament.html#materialsystem/specularbrdf
+ */
+static float get_visibility(float n_dot_v, float n_dot_l, float alpha) {
+    float alpha2 = alpha * alpha;
+    float term_v = n_dot_v * n_dot_v * (1 - alpha2) + alpha2;
+    float term_l = n_dot_l * n_dot_l * (1 - alpha2) + alpha2;
+    float ggx_v = n_dot_l * (float)sqrt(term_v);
+    float ggx_l = n_dot_v * (float)sqrt(term_l);
+    return 0.5f / (ggx_v + ggx_l);
+}
+
+static void integrate_row(void *context, int row) {
+    integrate_t *integrate = (integrate_t*)context;
+    texture_t *lut = integrate->lut;
+    float roughness = ((float)row + 0.5f) / (float)lut->height;
+    float alpha = roughness * roughness;
+    int c, i;
+
+    for (c = 0; c < lut->width; c++) {
+        float n_dot_v = ((float)c + 0.5f) / (float)lut->width;
+        vec3_t view_dir = vec3_new((float)sqrt(1 - n_dot_v * n_dot_v),
+                                   0, n_dot_v);
+        float scale = 0;
+        float bias = 0;
+
+        for (i = 0; i < integrate->num_samples; i++) {
+            vec2_t xi = get_hammersley(i, integrate->num_samples);
+            vec3_t half_dir = importance_sample_ggx(xi, alpha);
+            float v_dot_h = vec3_dot(view_dir, half_dir);
+            vec3_t light_dir = vec3_sub(vec3_mul(half_dir, 2 * v_dot_h),
+                                        view_dir);
+            float n_dot_l = light_dir.z;
+            float n_dot_h = half_dir.z;
+            if (n_dot_l > 0) {
+                float visibility = get_visibility(n_dot_v, n_dot_l, alpha);
+                float weight = visibility * 4 * v_dot_h * n_dot_l / n_dot_h;
+                float fresnel = (float)pow(1 - v_dot_h, 5);
+                scale += (1 - fresnel) * weight;
+                bias += fresnel * weight;
+            }
+        }
+        scale /= (float)integrate->num_samples;
+        bias /= (float)integrate->num_samples;
+        lut->buffer[row * lut->width + c] = vec4_new(scale, bias, 0, 1);
+    }
+}
+
+/* rows are indexed by roughness and columns by n_dot_v */
+texture_t *ibl_integrate_brdf(int size, int num_samples) {
+    integrate_t integrate;
+    integrate.lut = texture_create(size, size);
+    integrate.num_samples = num_samples;
+    parallel_for_rows(integrate_row, &integrate, size);
+    return integrate.lut;
+}
+
+/* baking */
+
+#define BAKE_FACE_SIZE 512
+#define BAKE_IRRADIANCE_SIZE 128
+#define BAKE_MIN_SIZE 64
+#define BAKE_NUM_LEVELS 10
+#define BAKE_NUM_SAMPLES 128
+#define BAKE_LUT_SIZE 128
+#define BAKE_LUT_SAMPLES 1024
+
+static void save_texels(vec4_t *texels, int size, const char *filename) {
+    image_t *image = image_create(size, size, 3, FORMAT_HDR);
+    int i;
+    for (i = 0; i < size * size; i++) {
+        image->hdr_buffer[i * 3 + 0] = texels[i].x;
+        image->hdr_buffer[i * 3 + 1] = texels[i].y;
+        image->hdr_buffer[i * 3 + 2] = texels[i].z;
+    }
+    image_save(image, filename);
+    image_release(image);
+}
+
+static void save_irradiance(vec3_t coeffs[9], const char *env_name) {
+    int size = BAKE_IRRADIANCE_SIZE;
+    vec4_t *texels = (vec4_t*)malloc(sizeof(vec4_t) * size * size);
+    char path[PATH_SIZE];
+    int face_index, r, c;
+
+    for (face_index = 0; face_index < 6; face_index++) {
+        for (r = 0; r < size; r++) {
+            for (c = 0; c < size; c++) {
+                vec3_t direction = get_face_direction(face_index, size, r, c);
+                vec3_t normal = vec3_normalize(direction);
+                vec3_t irradiance = ibl_evaluate_sh(coeffs, normal);
+                irradiance = vec3_max(irradiance, vec3_new(0, 0, 0));
+                texels[r * size + c] = vec4_from_vec3(irradiance, 1);
+            }
+        }
+        sprintf(path, "%s/i_%s.hdr", env_name, FACE_NAMES[face_index]);
+        save_texels(texels, size, path);
+    }
+    free(texels);
+}
+
+static void save_specular(mipcube_t *specular, const char *env_name) {
+    char path[PATH_SIZE];
+    int level, face_index;
+    for (level = 0; level < specular->num_levels; level++) {
+        int size = specular->sizes[level];
+        for (face_index = 0; face_index < 6; face_index++) {
+            vec4_t *texels = specular->levels[level]
+                             + size * size * face_index;
+            sprintf(path, "%s/m%d_%s.hdr",
+                    env_name, level, FACE_NAMES[face_index]);
+            save_texels(texels, size, path);
+        }
+    }
+}
+
+/*
+ * writes i_*.hdr and m*_*.hdr into the (existing) directory env_name,
+ * the same layout the external cmgen tool used to produce
+ */
+void ibl_bake_environment(const char *source, const char *env_name) {
+    int sizes[BAKE_NUM_LEVELS];
+    cubemap_t *environment;
+    mipcube_t *specular;
+    vec3_t coeffs[9];
+    float start_time;
+    int face_size;
+    int i;
+
+    start_time = platform_get_time();
+    environment = ibl_load_environment(source, BAKE_FACE_SIZE);
+    face_size = environment->faces[0]->width;
+    for (i = 0; i < BAKE_NUM_LEVELS; i++) {
+        int size = face_size >> i;
+        sizes[i] = size > BAKE_MIN_SIZE ? size : BAKE_MIN_SIZE;
+    }
+
+    ibl_project_sh(environment, coeffs);
+    ibl_convolve_sh(coeffs);
+    save_irradiance(coeffs, env_name);
+
+    specular = ibl_prefilter_specular(environment, BAKE_NUM_LEVELS, sizes,
+                                      BAKE_NUM_SAMPLES);
+    save_specular(specular, env_name);
+
+    mipcube_release(specular);
+    cubemap_release(environment);
+    printf("baked %s in %.3f s\n", env_name, platform_get_time() - start_time);
+}
+
+void ibl_bake_brdf_lut(const char *filename) {
+    texture_t *lut = ibl_integrate_brdf(BAKE_LUT_SIZE, BAKE_LUT_SAMPLES);
+    save_texels(lut->buffer, BAKE_LUT_SIZE, filename);
+    texture_release(lut);
+}
@@ -0,0 +1,23 @@
+#ifndef IBL_HELPER_H
+#define IBL_HELPER_H
+
+#include "../core/api.h"
+
+/* environment loading */
+cubemap_t *ibl_load_environment(const char *source, int face_size);
+
+/* spherical harmonics */
+void ibl_project_sh(cubemap_t *cubemap, vec3_t coeffs[9]);
+void ibl_convolve_sh(vec3_t coeffs[9]);
+vec3_t ibl_evaluate_sh(vec3_t coeffs[9], vec3_t direction);
+
+/* prefiltering */
+mipcube_t *ibl_prefilter_specular(cubemap_t *environment, int num_levels,
+                                  int sizes[], int num_samples);
+texture_t *ibl_integrate_brdf(int size, int num_samples);
+
+/* baking */
+void ibl_bake_environment(const char *source, const char *env_name);
+void ibl_bake_brdf_lut(const char *filename);
+
+#endif
@@ -3,50 +3,15 @@
 #include <string.h>
 #include "../core/api.h"
 #include "cache_helper.h"
+#include "ibl_helper.h"
 #include "pbr_shader.h"
 
 /* low-level api */
 
-static mat4_t get_model_matrix(pbr_attribs_t *attribs,
-                               pbr_uniforms_t *uniforms) {
-    if (uniforms->joint_matrices) {
-        mat4_t joint_matrices[4];
-        mat4_t skin_matrix;
-
-        joint_matrices[0] = uniforms->joint_matrices[(int)attribs->joint.x];
-        joint_matrices[1] = uniforms->joint_matrices[(int)attribs->joint.y];
-        joint_matrices[2] = uniforms->joint_matrices[(int)attribs->joint.z];
-        joint_matrices[3] = uniforms->joint_matrices[(int)attribs->joint.w];
-
-        skin_matrix = mat4_combine(joint_matrices, attribs->weight);
-        return mat4_mul_mat4(uniforms->model_matrix, skin_matrix);
-    } else {
-        return uniforms->model_matrix;
-    }
-}
-
-static mat3_t get_normal_matrix(pbr_attribs_t *attribs,
-                                pbr_uniforms_t *uniforms) {
-    if (uniforms->joint_n_matrices) {
-        mat3_t joint_n_matrices[4];
-        mat3_t skin_n_matrix;
-
-        joint_n_matrices[0] = uniforms->joint_n_matrices[(int)attribs->joint.x];
-        joint_n_matrices[1] = uniforms->joint_n_matrices[(int)attribs->joint.y];
-        joint_n_matrices[2] = uniforms->joint_n_matrices[(int)attribs->joint.z];
-        joint_n_matrices[3] = uniforms->joint_n_matrices[(int)attribs->joint.w];
-
-        skin_n_matrix = mat3_combine(joint_n_matrices, attribs->weight);
-        return mat3_mul_mat3(uniforms->normal_matrix, skin_n_matrix);
-    } else {
-        return uniforms->normal_matrix;
-    }
-}
-
 static vec4_t shadow_vertex_shader(pbr_attribs_t *attribs,
                                    pbr_varyings_t *varyings,
                                    pbr_uniforms_t *uniforms) {
-    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
+    mat4_t model_matrix = uniforms->model_matrix;
     mat4_t light_vp_matrix = uniforms->light_vp_matrix;
 
     vec4_t input_position = vec4_from_vec3(attribs->position, 1);
@@ -60,8 +25,8 @@ static vec4_t shadow_vertex_shader(pbr_attribs_t *attribs,
 static vec4_t common_vertex_shader(pbr_attribs_t *attribs,
                                    pbr_varyings_t *varyings,
                                    pbr_uniforms_t *uniforms) {
-    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
-    mat3_t normal_matrix = get_normal_matrix(attribs, uniforms);
+    mat4_t model_matrix = uniforms->model_matrix;
+    mat3_t normal_matrix = uniforms->normal_matrix;
     mat4_t camera_vp_matrix = uniforms->camera_vp_matrix;
     mat4_t light_vp_matrix = uniforms->light_vp_matrix;
 
@@ -281,9 +246,9 @@ static vec3_t get_incident_dir(vec3_t normal_dir, vec3_t view_dir) {
 static vec3_t get_ibl_shade(material_t material, ibldata_t *ibldata,
                             vec3_t normal_dir, vec3_t view_dir) {
     vec3_t diffuse_color = vec3_mul(material.diffuse, material.occlusion);
-    cubemap_t *diffuse_map = ibldata->diffuse_map;
-    vec4_t diffuse_sample = cubemap_clamp_sample(diffuse_map, normal_dir);
-    vec3_t diffuse_light = vec3_from_vec4(diffuse_sample);
+    vec3_t diffuse_light = vec3_max(ibl_evaluate_sh(ibldata->diffuse_coeffs,
+                                                    normal_dir),
+                                    vec3_new(0, 0, 0));
     vec3_t diffuse_shade = vec3_modulate(diffuse_light, diffuse_color);
 
     float n_dot_v = vec3_dot(normal_dir, view_dir);
@@ -299,18 +264,20 @@ static vec3_t get_ibl_shade(material_t material, ibldata_t *ibldata,
 
     vec3_t incident_dir = get_incident_dir(normal_dir, view_dir);
     float max_mip_level = (float)(ibldata->mip_levels - 1);
-    int specular_lod = (int)(material.roughness * max_mip_level + 0.5f);
-    cubemap_t *specular_map = ibldata->specular_maps[specular_lod];
-    vec4_t specular_sample = cubemap_clamp_sample(specular_map, incident_dir);
+    float specular_lod = material.roughness * max_mip_level;
+    mipcube_t *specular_map = ibldata->specular_map;
+    vec4_t specular_sample = mipcube_sample(specular_map, incident_dir,
+                                            specular_lod);
     vec3_t specular_light = vec3_from_vec4(specular_sample);
     vec3_t specular_shade = vec3_modulate(specular_light, specular_color);
 
     return vec3_add(diffuse_shade, specular_shade);
 }
 
-static int is_in_shadow(pbr_varyings_t *varyings,
-                        pbr_uniforms_t *uniforms,
-                        float n_dot_l) {
+/* returns the lit fraction, filtered to soften the shadow edges */
+static float get_shadow_visibility(pbr_varyings_t *varyings,
+                                   pbr_uniforms_t *uniforms,
+                                   float n_dot_l) {
     if (uniforms->shadow_map) {
         float u = (varyings->depth_position.x + 1) * 0.5f;
         float v = (varyings->depth_position.y + 1) * 0.5f;
@@ -319,11 +286,11 @@ static int is_in_shadow(pbr_varyings_t *varyings,
         float depth_bias = float_max(0.05f * (1 - n_dot_l), 0.005f);
         float current_depth = d - depth_bias;
         vec2_t texcoord = vec2_new(u, v);
-        float closest_depth = texture_sample(uniforms->shadow_map, texcoord).x;
 
-        return current_depth > closest_depth;
+        return depthmap_compare(uniforms->shadow_map, uniforms->shadow_filter,
+                                texcoord, current_depth);
     } else {
-        return 0;
+        return 1;
     }
 }
 
@@ -477,8 +444,10 @@ static vec4_t common_fragment_shader(pbr_varyings_t *varyings,
         }
 
         if (uniforms->punctual_intensity > 0 && n_dot_l > 0) {
-            float intensity = uniforms->punctual_intensity;
-            if (!is_in_shadow(varyings, uniforms, n_dot_l)) {
+            float visibility = get_shadow_visibility(varyings, uniforms,
+                                                     n_dot_l);
+            if (visibility > 0) {
+                float intensity = uniforms->punctual_intensity * visibility;
                 vec3_t shade = get_dir_shade(material, light_dir,
                                              normal_dir, view_dir);
                 color = vec3_add(color, vec3_mul(shade, intensity));
@@ -513,8 +482,12 @@ static void update_model(model_t *model, perframe_t *perframe) {
     mat3_t *joint_n_matrices;
     pbr_uniforms_t *uniforms;
 
+    if (skeleton && model->anim_lod < 0) {
+        return;  /*两个视锥之外, 保留上一次的姿态, 包围盒和蒙皮*/
+    }
     if (skeleton) {
-        skeleton_update_joints(skeleton, perframe->frame_time);
+        skeleton_update_joints_lod(skeleton, perframe->frame_time,
+                                   model->anim_lod);
         joint_matrices = skeleton_get_joint_matrices(skeleton);
         joint_n_matrices = skeleton_get_normal_matrices(skeleton);
         if (model->attached >= 0) {
@@ -528,6 +501,14 @@ static void update_model(model_t *model, perframe_t *perframe) {
         joint_n_matrices = NULL;
     }
     normal_matrix = mat3_inverse_transpose(mat3_from_mat4(model_matrix));
+    model_update_bounds(model, model_matrix, joint_matrices);
+    if (joint_matrices) {
+        /*蒙皮顶点直接变换到世界空间, 阴影pass和主pass共用*/
+        skin_update(model->skin, model_matrix, normal_matrix,
+                    joint_matrices, joint_n_matrices);
+        model_matrix = mat4_identity();
+        normal_matrix = mat3_identity();
+    }
 
     uniforms = (pbr_uniforms_t*)program_get_uniforms(model->program);
     uniforms->light_dir = perframe->light_dir;
@@ -538,42 +519,89 @@ static void update_model(model_t *model, perframe_t *perframe) {
                                               perframe->light_view_matrix);
     uniforms->camera_vp_matrix = mat4_mul_mat4(perframe->camera_proj_matrix,
                                                perframe->camera_view_matrix);
-    uniforms->joint_matrices = joint_matrices;
-    uniforms->joint_n_matrices = joint_n_matrices;
     uniforms->ambient_intensity = float_clamp(ambient_intensity, 0, 5);
     uniforms->punctual_intensity = float_clamp(punctual_intensity, 0, 5);
     uniforms->shadow_map = perframe->shadow_map;
+    uniforms->shadow_filter = perframe->shadow_filter;
     uniforms->layer_view = perframe->layer_view;
 }
 
+/*
+ * the meshlets of skinned models are refitted in world space, where their
+ * model matrix is the identity, so both kinds go through the same culler
+ */
+static culler_t setup_culler(model_t *model) {
+    program_t *program = model->program;
+    pbr_uniforms_t *uniforms;
+    mat4_t vp_matrix;
+    uniforms = (pbr_uniforms_t*)program_get_uniforms(program);
+    vp_matrix = uniforms->shadow_pass ? uniforms->light_vp_matrix
+                                      : uniforms->camera_vp_matrix;
+    return culler_from_matrices(vp_matrix, uniforms->model_matrix,
+                                !program_is_double_sided(program));
+}
+
 static void draw_model(model_t *model, framebuffer_t *framebuffer,
                        int shadow_pass) {
     mesh_t *mesh = model->mesh;
-    int num_faces = mesh_get_num_faces(mesh);
-    vertex_t *vertices = mesh_get_vertices(mesh);
+    lod_t *lod = mesh_get_lod(mesh, model->lod);
+    meshlet_t *meshlets = mesh_get_meshlets(mesh) + lod->first_meshlet;
+    vec3_t *positions = mesh_get_positions(mesh);
+    vec3_t *normals = NULL;
+    vec4_t *tangents = NULL;
     program_t *program = model->program;
     pbr_uniforms_t *uniforms;
     pbr_attribs_t *attribs;
-    int i, j;
+    culler_t culler;
+    int i, j, k;
 
     uniforms = (pbr_uniforms_t*)program_get_uniforms(model->program);
     uniforms->shadow_pass = shadow_pass;
-    for (i = 0; i < num_faces; i++) {
-        /*渲染三角面*/
-        /*准备面数据*/
-        for (j = 0; j < 3; j++) {
-            vertex_t vertex = vertices[i * 3 + j];
-            attribs = (pbr_attribs_t*)program_get_attribs(program, j);
-            attribs->position = vertex.position;
-            attribs->texcoord = vertex.texcoord;
-            attribs->normal = vertex.normal;
-            attribs->tangent = vertex.tangent;
-            attribs->joint = vertex.joint;
-            attribs->weight = vertex.weight;
+    if (model->skin) {
+        /*每帧只在第一次绘制时蒙皮*/
+        skin_apply(model->skin);
+        positions = skin_get_positions(model->skin);
+        normals = skin_get_normals(model->skin);
+        meshlets = skin_get_meshlets(model->skin, lod);
+        if (uniforms->normal_map) {
+            tangents = skin_get_tangents(model->skin);
+        }
+    }
+    culler = setup_culler(model);
+    program_clear_cache(program);
+    for (i = 0; i < lod->num_meshlets; i++) {
+        meshlet_t *meshlet = &meshlets[i];
+        /*整簇位于视锥外或背向相机时，跳过顶点着色*/
+        if (culler_cull_meshlet(&culler, meshlet)) {
+            continue;
+        }
+        for (j = 0; j < meshlet->num_indices; j += 3) {
+            /*渲染三角面*/
+            /*准备面数据*/
+            for (k = 0; k < 3; k++) {
+                int index = mesh_get_index(mesh, meshlet->first_index + j + k);
+                program_set_index(program, k, index);
+                if (program_is_cached(program, index)) {
+                    continue;
+                }
+                attribs = (pbr_attribs_t*)program_get_attribs(program, k);
+                attribs->position = positions[index];
+                attribs->texcoord = mesh_get_texcoord(mesh, index);
+                if (normals) {
+                    attribs->normal = normals[index];
+                } else {
+                    attribs->normal = mesh_get_normal(mesh, index);
+                }
+                if (tangents) {
+                    attribs->tangent = tangents[index];
+                } else {
+                    attribs->tangent = mesh_get_tangent(mesh, index);
+                }
+            }
+            /*开始渲染*/
+            /*本项目的几种渲染算法，起始只有 顶点shader和着色shader有区别，其他模块都是共用的*/
+            graphics_draw_triangle(framebuffer, program);
         }
-        /*开始渲染*/
-        /*本项目的几种渲染算法，起始只有 顶点shader和着色shader有区别，其他模块都是共用的*/
-        graphics_draw_triangle(framebuffer, program);
     }
 }
 
@@ -592,13 +620,17 @@ static void release_model(model_t *model) {
     cache_release_ibldata(uniforms->ibldata);
     program_release(model->program);
     cache_release_skeleton(model->skeleton);
+    if (model->skin) {
+        skin_release(model->skin);
+    }
     cache_release_mesh(model->mesh);
     free(model);
 }
 
 static model_t *create_model(const char *mesh, mat4_t transform,
                              const char *skeleton, int attached,
-                             int double_sided, int enable_blend) {
+                             int double_sided, int enable_blend,
+                             int normal_mapped) {
     int sizeof_attribs = sizeof(pbr_attribs_t);
     int sizeof_varyings = sizeof(pbr_varyings_t);
     int sizeof_uniforms = sizeof(pbr_uniforms_t);
@@ -616,8 +648,19 @@ static model_t *create_model(const char *mesh, mat4_t transform,
     model->transform = transform;
     model->skeleton = cache_acquire_skeleton(skeleton);
     model->attached = attached;
+    if (model->skeleton && attached < 0) {
+        /*法线贴图需要切线, 切线随顶点一起蒙皮*/
+        model->skin = skin_create(model->mesh, normal_mapped);
+    } else {
+        model->skin = NULL;
+    }
+    model_set_joint_extents(model);
     model->opaque = !enable_blend;
     model->distance = 0;
+    model->lod = 0;
+    model->anim_lod = 0;
+    model->pose_time = -1;
+    model->bounds_valid = 0;
     model->update = update_model;
     model->draw = draw_model;  /*render入口*/
     model->release = release_model;
@@ -640,7 +683,8 @@ model_t *pbrm_create_model(const char *mesh, mat4_t transform,
     model_t *model;
 
     model = create_model(mesh, transform, skeleton, attached,
-                         material->double_sided, material->enable_blend);
+                         material->double_sided, material->enable_blend,
+                         material->normal_map != NULL);
 
     uniforms = (pbr_uniforms_t*)program_get_uniforms(model->program);
     uniforms->basecolor_factor = material->basecolor_factor;
@@ -667,7 +711,8 @@ model_t *pbrs_create_model(const char *mesh, mat4_t transform,
     model_t *model;
 
     model = create_model(mesh, transform, skeleton, attached,
-                         material->double_sided, material->enable_blend);
+                         material->double_sided, material->enable_blend,
+                         material->normal_map != NULL);
 
     uniforms = (pbr_uniforms_t*)program_get_uniforms(model->program);
     uniforms->diffuse_factor = material->diffuse_factor;
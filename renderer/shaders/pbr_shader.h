@@ -12,8 +12,8 @@ typedef enum {
 
 typedef struct ibldata {
     int mip_levels;
-    cubemap_t *diffuse_map;
-    cubemap_t *specular_maps[15];
+    vec3_t diffuse_coeffs[9];
+    mipcube_t *specular_map;
     texture_t *brdf_lut;
 } ibldata_t;
 
@@ -22,8 +22,6 @@ typedef struct {
     vec2_t texcoord;
     vec3_t normal;
     vec4_t tangent;
-    vec4_t joint;
-    vec4_t weight;
 } pbr_attribs_t;
 
 typedef struct {
@@ -43,11 +41,10 @@ typedef struct {
     mat3_t normal_matrix;
     mat4_t light_vp_matrix;
     mat4_t camera_vp_matrix;
-    mat4_t *joint_matrices;
-    mat3_t *joint_n_matrices;
     float ambient_intensity;
     float punctual_intensity;
-    texture_t *shadow_map;
+    depthmap_t *shadow_map;
+    shadow_filter_t shadow_filter;
     /* metalness workflow */
     vec4_t basecolor_factor;
     float metalness_factor;
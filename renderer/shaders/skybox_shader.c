@@ -49,16 +49,16 @@ static void draw_model(model_t *model, framebuffer_t *framebuffer,
     if (!shadow_pass) {
         mesh_t *mesh = model->mesh;
         int num_faces = mesh_get_num_faces(mesh);
-        vertex_t *vertices = mesh_get_vertices(mesh);
+        vec3_t *positions = mesh_get_positions(mesh);
         program_t *program = model->program;
         skybox_attribs_t *attribs;
         int i, j;
 
         for (i = 0; i < num_faces; i++) {
             for (j = 0; j < 3; j++) {
-                vertex_t vertex = vertices[i * 3 + j];
+                int index = mesh_get_index(mesh, i * 3 + j);
                 attribs = (skybox_attribs_t*)program_get_attribs(program, j);
-                attribs->position = vertex.position;
+                attribs->position = positions[index];
             }
             graphics_draw_triangle(framebuffer, program);
         }
@@ -95,8 +95,13 @@ model_t *skybox_create_model(const char *skybox_name, int blur_level) {
     model->transform = mat4_identity();
     model->skeleton = NULL;
     model->attached = -1;
+    model->skin = NULL;
     model->opaque = 1;
     model->distance = 0;
+    model->lod = 0;
+    model->anim_lod = 0;
+    model->pose_time = -1;
+    model->bounds_valid = 0;
     model->update = update_model;
     model->draw = draw_model;
     model->release = release_model;
@@ -0,0 +1,22 @@
+#include <stdio.h>
+#include <string.h>
+#include "../core/api.h"
+#include "../shaders/ibl_helper.h"
+#include "test_bake.h"
+
+/*
+ * precomputes the image-based lighting data, run from the assets directory
+ *     Viewer bake <source> <env_name>  -- source is a .hdr panorama or the
+ *                                         prefix of six cubemap faces
+ *     Viewer bake lut <filename>       -- the brdf lookup texture
+ */
+void test_bake(int argc, char *argv[]) {
+    if (argc == 4 && strcmp(argv[2], "lut") == 0) {
+        ibl_bake_brdf_lut(argv[3]);
+    } else if (argc == 4) {
+        ibl_bake_environment(argv[2], argv[3]);
+    } else {
+        printf("usage: %s bake <source> <env_name>\n", argv[0]);
+        printf("       %s bake lut <filename>\n", argv[0]);
+    }
+}
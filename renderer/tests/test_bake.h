@@ -0,0 +1,6 @@
+#ifndef TEST_BAKE_H
+#define TEST_BAKE_H
+
+void test_bake(int argc, char *argv[]);
+
+#endif
@@ -1,6 +1,8 @@
 #include <stddef.h>
+#include <stdlib.h>
 #include "../core/api.h"
 #include "../scenes/blinn_scenes.h"
+#include "../shaders/cache_helper.h"
 #include "test_blinn.h"
 #include "test_helper.h"
 
@@ -33,15 +35,25 @@ static void tick_function(context_t *context, void *userdata) {
     /*构建当前帧： 光线方向，camera方向 */
     perframe_t perframe = test_build_perframe(scene, context);
     test_draw_scene(scene, context->framebuffer, &perframe);
+    if (context->single_click) {
+        test_focus_camera(scene, context, &perframe);
+    }
+    context->num_culled = perframe.num_culled;
+    context->num_shadow_culled = perframe.num_shadow_culled;
 }
 
 /*冯氏光照模型*/
 void test_blinn(int argc, char *argv[]) {
     /*获得入参中的场景名称*/
     const char *scene_name = argc > 2 ? argv[2] : NULL;
+    /*可选的烘焙帧率，骨骼动画按该帧率预先计算*/
+    int bake_rate = argc > 3 ? atoi(argv[3]) : 0;
     /*创建scene，并设置好 场景中各个modle的 mesh-材质-render方式，*/
     scene_t *scene = test_create_scene(g_creators, scene_name);
     if (scene) {
+        if (bake_rate > 0) {
+            cache_bake_skeletons(bake_rate);
+        }
         /*进入主循环----里面设置窗口和输入，然后调用核心tick循环：tick_function*/
         test_enter_mainloop(tick_function, scene);
         /*释放场景资源*/
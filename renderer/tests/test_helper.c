@@ -182,6 +182,8 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
     float prev_time;
     float print_time;
     int num_frames;
+    int sum_culled;
+    int sum_shadow_culled;
 
     /*创建一个窗口*/
     window = window_create(WINDOW_TITLE, WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -208,6 +210,8 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
     input_set_callbacks(window, callbacks);
 
     num_frames = 0;
+    sum_culled = 0;
+    sum_shadow_culled = 0;
     prev_time = platform_get_time();
     print_time = prev_time;
     while (!window_should_close(window)) {
@@ -225,6 +229,8 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
         context.double_click = record.double_click;
         context.frame_time = curr_time;
         context.delta_time = delta_time;
+        context.num_culled = 0;
+        context.num_shadow_culled = 0;
         /*
         每个tick周期，调用一次这个用户函数
         这才是真正的渲染函数
@@ -234,13 +240,19 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
         /*绘制窗体之类*/
         window_draw_buffer(window, framebuffer);
         num_frames += 1;
+        sum_culled += context.num_culled;
+        sum_shadow_culled += context.num_shadow_culled;
 
         /*帧率计算*/
         if (curr_time - print_time >= 1) {
             int sum_millis = (int)((curr_time - print_time) * 1000);
             int avg_millis = sum_millis / num_frames;
-            printf("fps: %3d, avg: %3d ms\n", num_frames, avg_millis);
+            printf("fps: %3d, avg: %3d ms, culled: %d, shadow culled: %d\n",
+                   num_frames, avg_millis, sum_culled / num_frames,
+                   sum_shadow_culled / num_frames);
             num_frames = 0;
+            sum_culled = 0;
+            sum_shadow_culled = 0;
             print_time = curr_time;
         }
         prev_time = curr_time;
@@ -261,37 +273,22 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
 
 /* scene related functions */
 
-typedef struct {vec3_t min; vec3_t max;} bbox_t;
-
 static bbox_t get_model_bbox(model_t *model) {
-    mesh_t *mesh = model->mesh;
-    int num_faces = mesh_get_num_faces(mesh);
-    vertex_t *vertices = mesh_get_vertices(mesh);
     mat4_t model_matrix = model->transform;
-    bbox_t bbox;
-    int i, j;
+    mat4_t *joint_matrices = NULL;
 
-    if (model->skeleton && model->attached >= 0) {
-        mat4_t *joint_matrices;
-        mat4_t node_matrix;
+    if (model->skeleton) {
         skeleton_update_joints(model->skeleton, 0);
         joint_matrices = skeleton_get_joint_matrices(model->skeleton);
-        node_matrix = joint_matrices[model->attached];
-        model_matrix = mat4_mul_mat4(model_matrix, node_matrix);
-    }
-
-    bbox.min = vec3_new(+1e6, +1e6, +1e6);
-    bbox.max = vec3_new(-1e6, -1e6, -1e6);
-    for (i = 0; i < num_faces; i++) {
-        for (j = 0; j < 3; j++) {
-            vertex_t vertex = vertices[i * 3 + j];
-            vec4_t local_pos = vec4_from_vec3(vertex.position, 1);
-            vec4_t world_pos = mat4_mul_vec4(model_matrix, local_pos);
-            bbox.min = vec3_min(bbox.min, vec3_from_vec4(world_pos));
-            bbox.max = vec3_max(bbox.max, vec3_from_vec4(world_pos));
+        if (model->attached >= 0) {
+            mat4_t node_matrix = joint_matrices[model->attached];
+            model_matrix = mat4_mul_mat4(model_matrix, node_matrix);
+            joint_matrices = NULL;
         }
     }
-    return bbox;
+
+    model_update_bounds(model, model_matrix, joint_matrices);
+    return model->world_bbox;
 }
 
 static bbox_t get_scene_bbox(scene_t *scene) {
@@ -323,6 +320,7 @@ static int count_num_faces(scene_t *scene) {
 }
 
 scene_t *test_create_scene(creator_t creators[], const char *scene_name) {
+    float start_time = platform_get_time();
     scene_t *scene = NULL;
     if (scene_name == NULL) {
         int num_creators = 0;
@@ -347,7 +345,7 @@ scene_t *test_create_scene(creator_t creators[], const char *scene_name) {
         }
     }
     if (scene) {
-        printf("打印该场景的详细信息\n");
+        float load_time = platform_get_time() - start_time;
         int num_faces = count_num_faces(scene);
         bbox_t bbox = get_scene_bbox(scene);
         vec3_t center = vec3_div(vec3_add(bbox.min, bbox.max), 2);
@@ -357,6 +355,8 @@ scene_t *test_create_scene(creator_t creators[], const char *scene_name) {
         int with_ambient = scene->ambient_intensity > 0;
         int with_punctual = scene->punctual_intensity > 0;
 
+        printf("打印该场景的详细信息\n");
+        printf("load time: %.3f s\n", load_time);
         printf("faces: %d\n", num_faces);
         printf("center: [%.3f, %.3f, %.3f]\n", center.x, center.y, center.z);
         printf("extent: [%.3f, %.3f, %.3f]\n", extent.x, extent.y, extent.z);
@@ -409,7 +409,10 @@ perframe_t test_build_perframe(scene_t *scene, context_t *context) {
     perframe.ambient_intensity = scene->ambient_intensity;
     perframe.punctual_intensity = scene->punctual_intensity;
     perframe.shadow_map = scene->shadow_map;
+    perframe.shadow_filter = scene->shadow_filter;
     perframe.layer_view = -1;
+    perframe.num_culled = 0;
+    perframe.num_shadow_culled = 0;
 
     return perframe;
 }
@@ -429,79 +432,165 @@ static int compare_models(const void *model1p, const void *model2p) {
     }
 }
 
-static void sort_models(model_t **models, mat4_t view_matrix) {
-    int num_models = darray_size(models);
+static void sort_models(model_t **models, int num_models,
+                        mat4_t view_matrix) {
     int i;
+    for (i = 0; i < num_models; i++) {
+        model_t *model = models[i];
+        vec4_t world_pos = vec4_from_vec3(model->world_center, 1);
+        vec4_t view_pos = mat4_mul_vec4(view_matrix, world_pos);
+        model->distance = -view_pos.z;
+    }
     if (num_models > 1) {
-        for (i = 0; i < num_models; i++) {
-            model_t *model = models[i];
-            vec3_t center = mesh_get_center(model->mesh);
-            vec4_t local_pos = vec4_from_vec3(center, 1);
-            vec4_t world_pos = mat4_mul_vec4(model->transform, local_pos);
-            vec4_t view_pos = mat4_mul_vec4(view_matrix, world_pos);
-            model->distance = -view_pos.z;
-        }
         qsort(models, num_models, sizeof(model_t*), compare_models);
     }
 }
 
+/*
+ * the coarsest level whose error, projected at the distance of the model,
+ * stays under LOD_PIXEL_ERROR pixels, the world scale of the model brings
+ * the error of the mesh into world space
+ */
+
+#define LOD_PIXEL_ERROR 1.0f
+
+static void select_lods(model_t **models, int num_models,
+                        perframe_t *perframe, int height) {
+    /* pixels covered by a unit length at unit distance */
+    float pixel_scale = perframe->camera_proj_matrix.m[1][1] * height / 2;
+    int i;
+    for (i = 0; i < num_models; i++) {
+        model_t *model = models[i];
+        float scale = model->world_scale * pixel_scale;
+        if (model->distance > 0 && scale > 0) {
+            float max_error = LOD_PIXEL_ERROR * model->distance / scale;
+            model->lod = mesh_select_lod(model->mesh, max_error);
+        } else {
+            model->lod = 0;
+        }
+    }
+}
+
+static void draw_models(model_t **models, int num_models,
+                        framebuffer_t *framebuffer, int shadow_pass) {
+    int i;
+    for (i = 0; i < num_models; i++) {
+        model_t *model = models[i];
+        /*每个model调用自己draw命令*/
+        model->draw(model, framebuffer, shadow_pass);
+    }
+}
+
+/*
+ * each pass draws only the models its frustum query on the bvh of the
+ * scene returns, sorted by distance, so the cost of culling and sorting
+ * grows with the visible models rather than with the whole scene
+ */
 void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
                      perframe_t *perframe) {
     model_t *skybox = scene->skybox;
     model_t **models = scene->models; /*该场景的modle列表*/
     int num_models = darray_size(models); 
+    model_t **visible = (model_t**)malloc(sizeof(model_t*) * num_models);
+    int num_visible;
+    int num_opaques = 0;
+    frustum_t frustum;
     int i;
 
+    /*先并行求出各骨骼的姿态, 共享骨骼的模型只求一次*/
+    scene_update_skeletons(scene, perframe);
     /*逐个操作模型*/
     for (i = 0; i < num_models; i++) {
         model_t *model = models[i];
         model->update(model, perframe);  /*将modle更新到【当前帧】中*/
+        if (model->opaque) {
+            num_opaques += 1;
+        }
     }
     if (skybox != NULL) {
         skybox->update(skybox, perframe);  /*将 skybox更新到[当前帧]中*/
     }
+    /*按模型的世界包围盒更新BVH*/
+    scene_update_bvh(scene);
 
+    perframe->num_culled = 0;
+    perframe->num_shadow_culled = 0;
     if (scene->shadow_buffer && scene->shadow_map) {
-        sort_models(models, perframe->light_view_matrix);
-        framebuffer_clear_depth(scene->shadow_buffer, 1);
-        for (i = 0; i < num_models; i++) {
-            model_t *model = models[i];
-            if (model->opaque) {
-                model->draw(model, scene->shadow_buffer, 1);
+        int num_casters = 0;
+        frustum = frustum_from_matrix(
+            mat4_mul_mat4(perframe->light_proj_matrix,
+                          perframe->light_view_matrix));
+        num_visible = scene_cull_models(scene, &frustum, visible);
+        for (i = 0; i < num_visible; i++) {
+            if (visible[i]->opaque) {
+                visible[num_casters++] = visible[i];
             }
         }
-        texture_from_depthbuffer(scene->shadow_map, scene->shadow_buffer);
+        /*按相机距离选择细节层级, 与主pass一致*/
+        sort_models(visible, num_casters, perframe->camera_view_matrix);
+        select_lods(visible, num_casters, perframe, framebuffer->height);
+        sort_models(visible, num_casters, perframe->light_view_matrix);
+        framebuffer_clear_depth(scene->shadow_buffer, 1);
+        draw_models(visible, num_casters, scene->shadow_buffer, 1);
+        perframe->num_shadow_culled = num_opaques - num_casters;
     }
 
-    sort_models(models, perframe->camera_view_matrix);
+    frustum = frustum_from_matrix(
+        mat4_mul_mat4(perframe->camera_proj_matrix,
+                      perframe->camera_view_matrix));
+    num_visible = scene_cull_models(scene, &frustum, visible);
+    perframe->num_culled = num_models - num_visible;
+    sort_models(visible, num_visible, perframe->camera_view_matrix);
+    select_lods(visible, num_visible, perframe, framebuffer->height);
     /*清除framebuffer的color和depth*/
     framebuffer_clear_color(framebuffer, scene->background);
     framebuffer_clear_depth(framebuffer, 1);
     if (skybox == NULL || perframe->layer_view >= 0) {
-        for (i = 0; i < num_models; i++) {
-            model_t *model = models[i];
-            /*每个model调用自己draw命令*/
-            model->draw(model, framebuffer, 0);
-        }
+        draw_models(visible, num_visible, framebuffer, 0);
     } else {
-        int num_opaques = 0;
-        for (i = 0; i < num_models; i++) {
-            model_t *model = models[i];
-            if (model->opaque) {
-                num_opaques += 1;
+        int num_visible_opaques = 0;
+        for (i = 0; i < num_visible; i++) {
+            if (visible[i]->opaque) {
+                num_visible_opaques += 1;
             } else {
                 break;
             }
         }
 
-        for (i = 0; i < num_opaques; i++) {
-            model_t *model = models[i];
-            model->draw(model, framebuffer, 0);
-        }
+        draw_models(visible, num_visible_opaques, framebuffer, 0);
         skybox->draw(skybox, framebuffer, 0);
-        for (i = num_opaques; i < num_models; i++) {
-            model_t *model = models[i];
-            model->draw(model, framebuffer, 0);
-        }
+        draw_models(visible + num_visible_opaques,
+                    num_visible - num_visible_opaques, framebuffer, 0);
+    }
+    free(visible);
+}
+
+/*
+ * casts the ray through the clicked point, from the near plane to the far
+ * plane of the camera, against the bvh of the scene drawn last, and pans
+ * the camera so that it orbits the point hit, a miss leaves it unchanged
+ */
+void test_focus_camera(scene_t *scene, context_t *context,
+                       perframe_t *perframe) {
+    vec2_t click_pos = context->click_pos;
+    mat4_t inverse = mat4_inverse(
+        mat4_mul_mat4(perframe->camera_proj_matrix,
+                      perframe->camera_view_matrix));
+    float ndc_x = click_pos.x * 2 - 1;
+    float ndc_y = click_pos.y * 2 - 1;
+    vec4_t near_pos = mat4_mul_vec4(inverse, vec4_new(ndc_x, ndc_y, -1, 1));
+    vec4_t far_pos = mat4_mul_vec4(inverse, vec4_new(ndc_x, ndc_y, 1, 1));
+    vec3_t origin = vec3_div(vec3_from_vec4(near_pos), near_pos.w);
+    vec3_t target = vec3_div(vec3_from_vec4(far_pos), far_pos.w);
+    vec3_t direction = vec3_normalize(vec3_sub(target, origin));
+    float distance;
+
+    if (scene_pick_model(scene, origin, direction, &distance)) {
+        camera_t *camera = context->camera;
+        vec3_t focus = vec3_add(origin, vec3_mul(direction, distance));
+        vec3_t offset = vec3_sub(focus, camera_get_target(camera));
+        camera_set_transform(camera,
+                             vec3_add(camera_get_position(camera), offset),
+                             focus);
     }
 }
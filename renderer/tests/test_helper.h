@@ -12,6 +12,9 @@ typedef struct {
     int double_click;
     float frame_time;
     float delta_time;
+    /* reported back by the tick function */
+    int num_culled;
+    int num_shadow_culled;
 } context_t;
 
 typedef struct {
@@ -26,5 +29,7 @@ scene_t *test_create_scene(creator_t creators[], const char *scene_name);
 perframe_t test_build_perframe(scene_t *scene, context_t *context);
 void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
                      perframe_t *perframe);
+void test_focus_camera(scene_t *scene, context_t *context,
+                       perframe_t *perframe);
 
 #endif
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include "../core/api.h"
+#include "test_meshopt.h"
+
+/*
+ * reports the post-transform cache statistics of the full meshes in the
+ * order of the source and in the stored order, the numbers are taken when
+ * the mesh is built and kept in its cache, run from the assets directory
+ *     Viewer meshopt [mesh.obj ...]
+ */
+
+static const char *const MESH_NAMES[] = {
+    "assassin/body.obj",
+    "azura/hair.obj",
+    "dieselpunk/mech.obj",
+    "helmet/helmet.obj",
+    "kgirl/body.obj",
+    "junkrat/junkrat6.obj",
+};
+
+static void report_mesh(const char *mesh_name) {
+    mesh_t *mesh = mesh_load(mesh_name);
+    vcache_stats_t stats = mesh_get_vcache_stats(mesh);
+    printf("%s: %d faces, %d vertices, acmr %.3f -> %.3f, "
+           "atvr %.3f -> %.3f\n",
+           mesh_name, mesh_get_num_faces(mesh), mesh_get_num_vertices(mesh),
+           stats.input_acmr, stats.acmr, stats.input_atvr, stats.atvr);
+    mesh_release(mesh);
+}
+
+void test_meshopt(int argc, char *argv[]) {
+    int num_meshes = ARRAY_SIZE(MESH_NAMES);
+    int i;
+    if (argc > 2) {
+        for (i = 2; i < argc; i++) {
+            report_mesh(argv[i]);
+        }
+    } else {
+        for (i = 0; i < num_meshes; i++) {
+            report_mesh(MESH_NAMES[i]);
+        }
+    }
+}
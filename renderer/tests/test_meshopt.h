@@ -0,0 +1,6 @@
+#ifndef TEST_MESHOPT_H
+#define TEST_MESHOPT_H
+
+void test_meshopt(int argc, char *argv[]);
+
+#endif
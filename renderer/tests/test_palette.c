@@ -0,0 +1,119 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../core/api.h"
+#include "../shaders/cache_helper.h"
+#include "test_palette.h"
+
+/*
+ * checks the baked palettes against the evaluated ones on every frame of
+ * the clips and measures the cost per update, the tables are cached the
+ * same way as for the demos, run from the assets directory
+ *     Viewer palette [frame_rate]
+ */
+
+#define DEFAULT_RATE 30
+#define NUM_UPDATES 30000
+#define UPDATE_STEP 0.0171f  /* off the frames of the usual rates */
+#define TOLERANCE 1e-4f
+
+static const char *const CLIP_NAMES[] = {
+    "assassin/assassin.ani",
+    "buster/buster.ani",
+    "crab/crab.ani",
+    "drone/drone.ani",
+    "horse/horse.ani",
+    "junkrat/junkrat.ani",
+    "kgirl/kgirl.ani",
+    "phoenix/phoenix.ani",
+    "whip/whip.ani",
+};
+
+static float compare_palettes(skeleton_t *evaluated, skeleton_t *baked) {
+    mat4_t *joints0 = skeleton_get_joint_matrices(evaluated);
+    mat4_t *joints1 = skeleton_get_joint_matrices(baked);
+    mat3_t *normals0 = skeleton_get_normal_matrices(evaluated);
+    mat3_t *normals1 = skeleton_get_normal_matrices(baked);
+    int num_joints = skeleton_get_num_joints(evaluated);
+    float error = 0;
+    int i, r, c;
+
+    for (i = 0; i < num_joints; i++) {
+        for (r = 0; r < 4; r++) {
+            for (c = 0; c < 4; c++) {
+                float diff = joints0[i].m[r][c] - joints1[i].m[r][c];
+                error = float_max(error, (float)fabs(diff));
+            }
+        }
+        for (r = 0; r < 3; r++) {
+            for (c = 0; c < 3; c++) {
+                float diff = normals0[i].m[r][c] - normals1[i].m[r][c];
+                error = float_max(error, (float)fabs(diff));
+            }
+        }
+    }
+    return error;
+}
+
+static float time_updates(skeleton_t *skeleton, float step, int num_steps) {
+    float start_time = platform_get_time();
+    int i;
+    for (i = 0; i < NUM_UPDATES; i++) {
+        skeleton_update_joints(skeleton, (i % num_steps) * step);
+    }
+    return (platform_get_time() - start_time) / NUM_UPDATES;
+}
+
+static int check_clip(const char *clip_name, int frame_rate) {
+    skeleton_t *evaluated = skeleton_load(clip_name);
+    skeleton_t *baked = cache_acquire_skeleton(clip_name);
+    int num_frames = (int)ceil(skeleton_get_duration(baked) * frame_rate);
+    float frame_error = 0;
+    float blend_error = 0;
+    float evaluate_time, blend_time, index_time;
+    int frame;
+
+    cache_bake_skeletons(frame_rate);
+    for (frame = 0; frame < num_frames; frame++) {
+        float frame_time = (float)frame / frame_rate;
+        float between_time = (frame + 0.5f) / frame_rate;
+        skeleton_update_joints(evaluated, frame_time);
+        skeleton_update_joints(baked, frame_time);
+        frame_error = float_max(frame_error,
+                                compare_palettes(evaluated, baked));
+        skeleton_update_joints(evaluated, between_time);
+        skeleton_update_joints(baked, between_time);
+        blend_error = float_max(blend_error,
+                                compare_palettes(evaluated, baked));
+    }
+
+    evaluate_time = time_updates(evaluated, UPDATE_STEP, NUM_UPDATES);
+    blend_time = time_updates(baked, UPDATE_STEP, NUM_UPDATES);
+    index_time = time_updates(baked, 1.0f / frame_rate, num_frames);
+    printf("%s: %d frames, frame error %g (%s), blend error %g, "
+           "evaluate %.2f us, blend %.2f us, index %.3f us\n",
+           clip_name, num_frames, frame_error,
+           frame_error <= TOLERANCE ? "ok" : "MISMATCH", blend_error,
+           evaluate_time * 1e6f, blend_time * 1e6f, index_time * 1e6f);
+
+    cache_release_skeleton(baked);
+    skeleton_release(evaluated);
+    return frame_error <= TOLERANCE;
+}
+
+void test_palette(int argc, char *argv[]) {
+    int frame_rate = argc > 2 ? atoi(argv[2]) : DEFAULT_RATE;
+    int num_clips = ARRAY_SIZE(CLIP_NAMES);
+    int num_passed = 0;
+    int i;
+
+    if (frame_rate <= 0) {
+        printf("usage: %s palette [frame_rate]\n", argv[0]);
+        return;
+    }
+    for (i = 0; i < num_clips; i++) {
+        num_passed += check_clip(CLIP_NAMES[i], frame_rate);
+    }
+    printf("%d of %d clips match at %d fps\n",
+           num_passed, num_clips, frame_rate);
+}
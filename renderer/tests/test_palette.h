@@ -0,0 +1,6 @@
+#ifndef TEST_PALETTE_H
+#define TEST_PALETTE_H
+
+void test_palette(int argc, char *argv[]);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdlib.h>
 #include "../core/api.h"
 #include "../scenes/pbr_scenes.h"
 #include "../shaders/cache_helper.h"
@@ -108,9 +109,16 @@ static void draw_layer_view(framebuffer_t *framebuffer, userdata_t *userdata) {
 static void tick_function(context_t *context, void *userdata_) {
     userdata_t *userdata = (userdata_t*)userdata_;
     perframe_t perframe = test_build_perframe(userdata->scene, context);
-    userdata->layer = query_curr_layer(context, userdata->layer);
+    int prev_layer = userdata->layer;
+    userdata->layer = query_curr_layer(context, prev_layer);
     perframe.layer_view = userdata->layer;
     test_draw_scene(userdata->scene, context->framebuffer, &perframe);
+    /* clicks in the layer view pick layers instead */
+    if (context->single_click && prev_layer < 0) {
+        test_focus_camera(userdata->scene, context, &perframe);
+    }
+    context->num_culled = perframe.num_culled;
+    context->num_shadow_culled = perframe.num_shadow_culled;
     draw_layer_view(context->framebuffer, userdata);
 }
 
@@ -120,9 +128,13 @@ static texture_t *acquire_label_texture(const char *filename) {
 
 void test_pbr(int argc, char *argv[]) {
     const char *scene_name = argc > 2 ? argv[2] : NULL;
+    int bake_rate = argc > 3 ? atoi(argv[3]) : 0;
     scene_t *scene = test_create_scene(g_creators, scene_name);
     if (scene) {
         userdata_t userdata;
+        if (bake_rate > 0) {
+            cache_bake_skeletons(bake_rate);
+        }
         userdata.scene = scene;
         userdata.layer = -1;
         userdata.labels[0] = acquire_label_texture("common/diffuse.tga");
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include "../core/api.h"
+#include "../scenes/blinn_scenes.h"
+#include "../scenes/pbr_scenes.h"
+#include "test_skinning.h"
+
+/*
+ * measures the per-vertex cost of the skinning kernels on the animated
+ * models of two scenes, run from the assets directory
+ *     Viewer skinning
+ */
+
+#define NUM_FRAMES 200
+#define FRAME_RATE 30.0f
+
+static const char *const METHOD_NAMES[2] = {"linear", "dual quaternion"};
+
+/* only the skinning is timed, the joints are evaluated outside */
+static float time_skinning(model_t *model, skinning_t method) {
+    mat4_t model_matrix = model->transform;
+    mat3_t normal_matrix = mat3_inverse_transpose(mat3_from_mat4(model_matrix));
+    float elapsed = 0;
+    int i;
+
+    skin_set_method(model->skin, method);
+    for (i = 0; i < NUM_FRAMES; i++) {
+        mat4_t *joint_matrices;
+        mat3_t *joint_n_matrices;
+        float start_time;
+
+        skeleton_update_joints(model->skeleton, (float)i / FRAME_RATE);
+        joint_matrices = skeleton_get_joint_matrices(model->skeleton);
+        joint_n_matrices = skeleton_get_normal_matrices(model->skeleton);
+        start_time = platform_get_time();
+        skin_update(model->skin, model_matrix, normal_matrix,
+                    joint_matrices, joint_n_matrices);
+        skin_apply(model->skin);
+        elapsed += platform_get_time() - start_time;
+    }
+    skin_set_method(model->skin, SKINNING_LINEAR);
+    return elapsed;
+}
+
+static void benchmark_scene(const char *scene_name, scene_t *scene) {
+    int num_models = darray_size(scene->models);
+    int method, i;
+
+    for (method = 0; method < 2; method++) {
+        float elapsed = 0;
+        int num_vertices = 0;
+        for (i = 0; i < num_models; i++) {
+            model_t *model = scene->models[i];
+            if (model->skin) {
+                elapsed += time_skinning(model, (skinning_t)method);
+                num_vertices += skin_get_num_vertices(model->skin);
+            }
+        }
+        if (num_vertices > 0) {
+            float per_vertex = elapsed / NUM_FRAMES / num_vertices;
+            printf("%s: %s, %d vertices, %.2f ms/frame, %.2f ns/vertex\n",
+                   scene_name, METHOD_NAMES[method], num_vertices,
+                   elapsed / NUM_FRAMES * 1000, per_vertex * 1e9f);
+        }
+    }
+}
+
+void test_skinning(int argc, char *argv[]) {
+    scene_t *scene;
+
+    UNUSED_VAR(argc);
+    UNUSED_VAR(argv);
+
+    scene = blinn_kgirl_scene();
+    benchmark_scene("kgirl", scene);
+    scene_release(scene);
+
+    scene = pbr_junkrat_scene();
+    benchmark_scene("junkrat", scene);
+    scene_release(scene);
+}
@@ -0,0 +1,6 @@
+#ifndef TEST_SKINNING_H
+#define TEST_SKINNING_H
+
+void test_skinning(int argc, char *argv[]);
+
+#endif